@@ -0,0 +1,108 @@
+#include "announcer.h"
+#include <algorithm>
+#include <iostream>
+
+Announcer::Announcer(TrackerList& trackers, const TorrentFile& tf, std::string peerId, int port, StatsCallback stats,
+                     TrackerList::PeersCallback onPeers, std::chrono::milliseconds retryDelay)
+: trackers_(trackers)
+, tf_(tf)
+, peerId_(std::move(peerId))
+, port_(port)
+, stats_(std::move(stats))
+, onPeers_(std::move(onPeers))
+, retryDelay_(retryDelay)
+, stopping_(false)
+, requested_(false)
+, announces_(0)
+{
+}
+
+Announcer::~Announcer()
+{
+    Stop();
+}
+
+void Announcer::Start()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(thread_.joinable()) return;
+
+    stopping_ = false;
+    trackers_.Resume();
+    thread_ = std::thread([this] { Loop(); });
+}
+
+void Announcer::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    changed_.notify_all();
+    trackers_.Cancel();
+    if(thread_.joinable())
+    {
+        thread_.join();
+    }
+}
+
+void Announcer::RequestAnnounce()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        requested_ = true;
+    }
+    changed_.notify_all();
+}
+
+size_t Announcer::AnnouncesCount() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return announces_;
+}
+
+void Announcer::Loop()
+{
+    size_t failures = 0;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while(!stopping_)
+    {
+        requested_ = false;
+        lock.unlock();
+
+        AnnounceStats stats = stats_ ? stats_() : AnnounceStats{0, 0, tf_.length};
+        trackers_.Announce(tf_, peerId_, port_, stats, onPeers_);
+
+        // следующий анонс -- по interval трекера, досрочный -- не раньше min interval
+        auto now = Clock::now();
+        Clock::time_point next;
+        Clock::time_point earliest;
+        if(trackers_.Answered())
+        {
+            failures = 0;
+            auto interval = trackers_.Interval().count() > 0
+                    ? std::chrono::duration_cast<std::chrono::milliseconds>(trackers_.Interval()) : DEFAULT_INTERVAL;
+            auto minInterval = trackers_.MinInterval().count() > 0
+                    ? std::chrono::duration_cast<std::chrono::milliseconds>(trackers_.MinInterval()) : DEFAULT_MIN_INTERVAL;
+            next = now + interval;
+            earliest = now + std::min(minInterval, interval);
+        }
+        else
+        {
+            auto delay = retryDelay_;
+            for(size_t i = 0; i < failures && delay < DEFAULT_INTERVAL; ++i)
+            {
+                delay *= 2;
+            }
+            ++failures;
+            next = earliest = now + std::min(delay, DEFAULT_INTERVAL);
+        }
+        std::cerr << "Logger: next announce in "
+                  << std::chrono::duration_cast<std::chrono::seconds>(next - now).count() << " s" << std::endl;
+
+        lock.lock();
+        ++announces_;
+        changed_.wait_until(lock, earliest, [this] { return stopping_; });
+        changed_.wait_until(lock, next, [this] { return stopping_ || requested_; });
+    }
+}
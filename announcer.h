@@ -0,0 +1,87 @@
+#pragma once
+
+#include "peer.h"
+#include "torrent_file.h"
+#include "torrent_tracker.h"
+#include "tracker_list.h"
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/*
+ * Фоновые повторные анонсы.
+ * Поток анонсов опрашивает трекеры (см. TrackerList) с настоящей статистикой скачивания и отдает всех полученных
+ * пиров в callback, а следующий анонс делает через `interval` из ответа трекера. Если пиры кончаются раньше,
+ * владелец может попросить анонс досрочно (`RequestAnnounce`), но не чаще, чем разрешает `min interval` трекера.
+ * Если не ответил ни один трекер, анонс повторяется через `retryDelay`, удваивая паузу после каждой неудачи
+ * (но не дольше `DEFAULT_INTERVAL`)
+ * https://wiki.theory.org/BitTorrentSpecification#Tracker_Response
+ */
+class Announcer {
+public:
+    /*
+     * Вызывается перед каждым анонсом из потока анонсов
+     */
+    using StatsCallback = std::function<AnnounceStats()>;
+
+    /*
+     * trackers, tf и все, что используют callback'и, должны жить дольше анонсера.
+     * retryDelay -- пауза перед повтором, если не ответил ни один трекер
+     */
+    Announcer(TrackerList& trackers, const TorrentFile& tf, std::string peerId, int port, StatsCallback stats,
+              TrackerList::PeersCallback onPeers, std::chrono::milliseconds retryDelay = DEFAULT_RETRY_DELAY);
+
+    /*
+     * Останавливает поток анонсов
+     */
+    ~Announcer();
+
+    Announcer(const Announcer&) = delete;
+    Announcer& operator=(const Announcer&) = delete;
+
+    /*
+     * Запустить поток анонсов. Первый анонс делается сразу
+     */
+    void Start();
+
+    /*
+     * Прервать идущий анонс и дождаться потока анонсов
+     */
+    void Stop();
+
+    /*
+     * Анонсировать досрочно, как только это разрешит `min interval`. Можно вызывать из любого потока
+     */
+    void RequestAnnounce();
+
+    /*
+     * Сколько анонсов сделано, включая неудачные
+     */
+    size_t AnnouncesCount() const;
+
+    static constexpr std::chrono::milliseconds DEFAULT_INTERVAL{30 * 60 * 1000};  // если трекер не назвал interval
+    static constexpr std::chrono::milliseconds DEFAULT_MIN_INTERVAL{60 * 1000};  // если трекер не назвал min interval
+    static constexpr std::chrono::milliseconds DEFAULT_RETRY_DELAY{15000};
+private:
+    using Clock = std::chrono::steady_clock;
+
+    TrackerList& trackers_;
+    const TorrentFile& tf_;
+    const std::string peerId_;
+    const int port_;
+    const StatsCallback stats_;
+    const TrackerList::PeersCallback onPeers_;
+    const std::chrono::milliseconds retryDelay_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable changed_;
+    bool stopping_;
+    bool requested_;  // владелец попросил анонс досрочно
+    size_t announces_;
+    std::thread thread_;
+
+    void Loop();
+};
@@ -0,0 +1,155 @@
+#include "async_socket.h"
+#include "byte_tools.h"
+#include <stdexcept>
+#include <utility>
+
+AsyncSocket::AsyncSocket(TcpConnect& socket, EventLoop& loop)
+: socket_(socket)
+, loop_(loop)
+, ready_(0)
+, timer_(0)
+{
+}
+
+AsyncSocket::~AsyncSocket()
+{
+    if(timer_)
+    {
+        loop_.CancelTimer(timer_);
+    }
+    socket_.Unwatch();
+}
+
+AsyncSocket::WaitAwaiter::WaitAwaiter(AsyncSocket& socket, uint32_t events, std::chrono::milliseconds timeout)
+: socket_(socket)
+, events_(events)
+, timeout_(timeout)
+{
+}
+
+bool AsyncSocket::WaitAwaiter::await_ready() const noexcept
+{
+    return false;
+}
+
+void AsyncSocket::WaitAwaiter::await_suspend(std::coroutine_handle<> handle)
+{
+    socket_.waiter_ = handle;
+    socket_.ready_ = 0;
+    socket_.loop_.Modify(socket_.socket_.GetSocket(), events_);
+    socket_.timer_ = socket_.loop_.RunAfter(timeout_, [&socket = socket_] { socket.OnTimeout(); });
+}
+
+uint32_t AsyncSocket::WaitAwaiter::await_resume() const noexcept
+{
+    return socket_.ready_;
+}
+
+AsyncSocket::WaitAwaiter AsyncSocket::Wait(uint32_t events, std::chrono::milliseconds timeout)
+{
+    return WaitAwaiter(*this, events, timeout);
+}
+
+void AsyncSocket::OnEvent(uint32_t events)
+{
+    if(timer_)
+    {
+        loop_.CancelTimer(timer_);
+        timer_ = 0;
+    }
+    Resume(events);
+}
+
+void AsyncSocket::OnTimeout()
+{
+    timer_ = 0;
+    Resume(0);
+}
+
+void AsyncSocket::Resume(uint32_t events)
+{
+    // ожидание одно, поэтому сокет снова готов, только когда корутина уже продолжена и подписалась заново
+    auto waiter = std::exchange(waiter_, {});
+    if(!waiter) return;
+
+    ready_ = events;
+    waiter.resume();
+}
+
+Task<> AsyncSocket::WaitFor(uint32_t events, std::chrono::milliseconds timeout)
+{
+    uint32_t ready = co_await Wait(events, timeout);
+    if(!ready)
+    {
+        throw std::runtime_error("Error: time limit exceeded");
+    }
+}
+
+Task<> AsyncSocket::Connect()
+{
+    // сокет, подключенный заранее (см. Connector), только подписываем на события
+    bool connected = socket_.IsOpen() || socket_.StartConnect();
+    socket_.Watch(loop_, 0, [this](uint32_t events) { OnEvent(events); });
+    if(!connected)
+    {
+        co_await WaitFor(EPOLLOUT, socket_.GetConnectTimeout());
+        socket_.FinishConnect();
+    }
+}
+
+Task<> AsyncSocket::ReadExact(char* buffer, size_t size, std::chrono::milliseconds timeout)
+{
+    size_t received = 0;
+    while(received < size)
+    {
+        size_t curSession = socket_.ReceiveSome(buffer + received, size - received);
+        if(curSession == 0)
+        {
+            co_await WaitFor(EPOLLIN, timeout);
+            continue;
+        }
+        received += curSession;
+    }
+}
+
+Task<std::string_view> AsyncSocket::ReadMessage(RecvBuffer& buffer, std::chrono::milliseconds timeout, size_t maxLength)
+{
+    while(true)
+    {
+        if(buffer.Size() >= 4)
+        {
+            size_t length = BytesToInt(buffer.Data().substr(0, 4));
+            if(length > maxLength)
+            {
+                throw std::runtime_error("Error: message is too long");
+            }
+            if(buffer.Size() - 4 >= length)
+            {
+                co_return buffer.Data().substr(4, length);
+            }
+            buffer.Reserve(4 + length);
+        }
+
+        size_t received = socket_.ReceiveSome(buffer.WriteBegin(), buffer.WriteCapacity());
+        buffer.Commit(received);
+        if(received == 0)
+        {
+            co_await WaitFor(EPOLLIN, timeout);
+        }
+    }
+}
+
+Task<> AsyncSocket::Write(std::string_view data, std::chrono::milliseconds timeout)
+{
+    size_t sent = 0;
+    while(sent < data.size())
+    {
+        size_t curSession = socket_.SendSome(data.data() + sent, data.size() - sent);
+        if(curSession == 0)
+        {
+            co_await WaitFor(EPOLLOUT, timeout);
+            continue;
+        }
+        sent += curSession;
+    }
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "tcp_connect.h"
+#include "event_loop.h"
+#include "recv_buffer.h"
+#include "task.h"
+#include <coroutine>
+#include <chrono>
+#include <cstdint>
+#include <string_view>
+
+/*
+ * Операции с неблокирующим сокетом в виде ожиданий для корутин (см. Task).
+ * Вместо того чтобы блокировать поток в poll, корутина подписывается на готовность сокета в цикле событий
+ * и приостанавливается; callback цикла продолжает ее с того же места. Так код общения с пиром остается
+ * последовательным, а один поток цикла обслуживает сколько угодно соединений.
+ * Все операции, кроме `Wait`, бросают исключение по таймауту, при разрыве соединения или ошибке сокета.
+ * Объект и корутина, которая его использует, должны жить в потоке цикла `loop`. Одновременно может ждать
+ * только одна корутина
+ */
+class AsyncSocket {
+public:
+    AsyncSocket(TcpConnect& socket, EventLoop& loop);
+
+    /*
+     * Отменяет таймер ожидания и отписывает сокет от цикла
+     */
+    ~AsyncSocket();
+
+    AsyncSocket(const AsyncSocket&) = delete;
+    AsyncSocket& operator=(const AsyncSocket&) = delete;
+
+    /*
+     * Ожидание готовности сокета. `co_await` возвращает маску наступивших событий (EPOLLIN / EPOLLOUT / ...)
+     * или 0, если за `timeout` ничего не произошло
+     */
+    class WaitAwaiter {
+    public:
+        WaitAwaiter(AsyncSocket& socket, uint32_t events, std::chrono::milliseconds timeout);
+
+        bool await_ready() const noexcept;
+        void await_suspend(std::coroutine_handle<> handle);
+        uint32_t await_resume() const noexcept;
+    private:
+        AsyncSocket& socket_;
+        uint32_t events_;
+        std::chrono::milliseconds timeout_;
+    };
+
+    /*
+     * Дождаться событий `events` на сокете, но не дольше `timeout`. Сокет должен быть создан (см. `Connect`)
+     */
+    WaitAwaiter Wait(uint32_t events, std::chrono::milliseconds timeout);
+
+    /*
+     * Подключиться к пиру, не дольше `TcpConnect::GetConnectTimeout`. Если сокет уже подключен, только подписаться
+     * на его события
+     */
+    Task<> Connect();
+
+    /*
+     * Прочитать ровно `size` байт. Лишнего из сокета не читается
+     */
+    Task<> ReadExact(char* buffer, size_t size, std::chrono::milliseconds timeout);
+
+    /*
+     * Дочитать в `buffer` одно сообщение протокола (4 байта длины в big endian и само сообщение) и вернуть его
+     * без длины. Сообщение остается в буфере: разобрав его, надо вызвать `buffer.Consume(4 + message.size())`.
+     * Все, что пришло после сообщения, тоже остается в буфере. Сообщения длиннее `maxLength` считаются ошибкой
+     */
+    Task<std::string_view> ReadMessage(RecvBuffer& buffer, std::chrono::milliseconds timeout, size_t maxLength);
+
+    /*
+     * Отправить `data` целиком. Данные должны оставаться валидными, пока запись не завершится
+     */
+    Task<> Write(std::string_view data, std::chrono::milliseconds timeout);
+private:
+    TcpConnect& socket_;
+    EventLoop& loop_;
+    std::coroutine_handle<> waiter_;  // корутина, которая ждет готовности сокета
+    uint32_t ready_;  // события, с которыми продолжится `waiter_`
+    EventLoop::TimerId timer_;  // таймаут текущего ожидания
+
+    void OnEvent(uint32_t events);
+    void OnTimeout();
+
+    /*
+     * Продолжить `waiter_` с событиями `events`
+     */
+    void Resume(uint32_t events);
+
+    /*
+     * `Wait`, но с исключением по таймауту
+     */
+    Task<> WaitFor(uint32_t events, std::chrono::milliseconds timeout);
+};
@@ -0,0 +1,122 @@
+/*
+ * Сравнение пакетного SHA1 (`CalculateSHA1Batch`) с циклом `CalculateSHA1` (OpenSSL) по частям одинаковой длины --
+ * как при перепроверке скачанного торрента. Замеряется каждая реализация, которую поддерживает процессор; перед
+ * замером результаты сверяются с OpenSSL.
+ * Сборка и запуск из корня репозитория:
+ * g++ -std=c++20 -O2 -o sha1_bench bench/sha1_bench.cpp sha1_batch.cpp byte_tools.cpp -lssl -lcrypto
+ * ./sha1_bench [длина части, байт = 262144] [число частей = 64] [повторов = 5]
+ */
+#include "../byte_tools.h"
+#include "../sha1_batch.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+const char* KernelName(Sha1Kernel kernel)
+{
+    switch(kernel)
+    {
+        case Sha1Kernel::OpenSsl:
+            return "openssl";
+        case Sha1Kernel::Scalar:
+            return "scalar";
+        case Sha1Kernel::ShaNi:
+            return "sha-ni";
+        case Sha1Kernel::Avx2:
+            return "avx2";
+        case Sha1Kernel::Avx512:
+            return "avx512";
+    }
+    return "?";
+}
+
+/*
+ * Лучшее время из `repeats` запусков `hash`, в секундах. Лучшее, а не среднее: так меньше шума от соседних процессов
+ */
+template <typename Hash>
+double BestTime(size_t repeats, Hash hash)
+{
+    double best = 0;
+    for(size_t i = 0; i < repeats; ++i)
+    {
+        auto start = Clock::now();
+        hash();
+        double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+        best = i == 0 ? elapsed : std::min(best, elapsed);
+    }
+    return best;
+}
+
+void Report(const char* name, double seconds, size_t bytes, double baseline)
+{
+    std::printf("%-16s %10.2f ms %10.1f MB/s %8.2fx\n", name, seconds * 1000, bytes / seconds / (1 << 20),
+                baseline / seconds);
+}
+}
+
+int main(int argc, char** argv)
+{
+    size_t pieceLength = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1 << 18;
+    size_t piecesCount = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 64;
+    size_t repeats = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 5;
+    if(pieceLength == 0 || piecesCount == 0 || repeats == 0)
+    {
+        std::fprintf(stderr, "usage: %s [piece length] [pieces count] [repeats]\n", argv[0]);
+        return 1;
+    }
+
+    std::string data(pieceLength * piecesCount, '\0');
+    std::mt19937 rng(42);
+    std::generate(data.begin(), data.end(), [&rng] { return static_cast<char>(rng()); });
+    std::vector<std::string_view> pieces;
+    for(size_t i = 0; i < piecesCount; ++i)
+    {
+        pieces.push_back(std::string_view(data).substr(i * pieceLength, pieceLength));
+    }
+
+    std::vector<std::string> expected;
+    for(auto piece : pieces)
+    {
+        expected.push_back(CalculateSHA1(piece));
+    }
+
+    std::printf("%zu pieces of %zu bytes, best of %zu, detected kernel: %s\n", piecesCount, pieceLength, repeats,
+                KernelName(DetectSha1Kernel()));
+    double baseline = BestTime(repeats, [&pieces] {
+        for(auto piece : pieces)
+        {
+            volatile char sink = CalculateSHA1(piece)[0];
+            (void) sink;
+        }
+    });
+    Report("CalculateSHA1", baseline, data.size(), baseline);
+
+    for(auto kernel : {Sha1Kernel::OpenSsl, Sha1Kernel::Scalar, Sha1Kernel::ShaNi, Sha1Kernel::Avx2, Sha1Kernel::Avx512})
+    {
+        std::string name = std::string("batch/") + KernelName(kernel);
+        if(!Sha1KernelSupported(kernel))
+        {
+            std::printf("%-16s not supported\n", name.c_str());
+            continue;
+        }
+        if(CalculateSHA1Batch(pieces, kernel) != expected)
+        {
+            std::fprintf(stderr, "%s: digests differ from CalculateSHA1\n", name.c_str());
+            return 1;
+        }
+        double seconds = BestTime(repeats, [&pieces, kernel] {
+            volatile size_t sink = CalculateSHA1Batch(pieces, kernel).size();
+            (void) sink;
+        });
+        Report(name.c_str(), seconds, data.size(), baseline);
+    }
+    return 0;
+}
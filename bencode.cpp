@@ -1,5 +1,7 @@
 #pragma once
 #include "bencode.h"
+#include <stdexcept>
+#include <algorithm>
 
 /******************INTEGER******************/
 bencode::Integer::Integer(const int64_t &num) : val(num) {}
@@ -31,7 +33,7 @@ const std::string& bencode::String::get() const
 bencode::List::List(const std::vector<std::shared_ptr<bencode::bcType>>& data) : list(data) {}
 std::string bencode::List::encode() const
 {
-    std::string bencode = "l:";
+    std::string bencode = "l";
     for(const auto& dataPtr : list)
     {
         bencode += dataPtr->encode();
@@ -71,4 +73,430 @@ const std::map<std::string, std::shared_ptr<bencode::bcType>>& bencode::Dictiona
 size_t bencode::Dictionary::size() const
 {
     return dict.size();
-}
\ No newline at end of file
+}
+
+/******************VIEW******************/
+namespace
+{
+    constexpr size_t MAX_BENCODE_DEPTH = 512;
+
+    [[noreturn]] void BadBencode(const char* what)
+    {
+        throw std::runtime_error(std::string("Error: bad bencode: ") + what);
+    }
+}
+
+bencode::View::View(const Document* doc, uint32_t index) : doc_(doc), index_(index) {}
+bencode::View::operator bool() const
+{
+    return doc_ != nullptr;
+}
+bencode::View::Type bencode::View::type() const
+{
+    if(!doc_) throw std::runtime_error("Error: empty bencode value");
+    return doc_->nodes_[index_].type;
+}
+bool bencode::View::isInteger() const
+{
+    return doc_ && type() == Type::Integer;
+}
+bool bencode::View::isString() const
+{
+    return doc_ && type() == Type::String;
+}
+bool bencode::View::isList() const
+{
+    return doc_ && type() == Type::List;
+}
+bool bencode::View::isDictionary() const
+{
+    return doc_ && type() == Type::Dictionary;
+}
+int64_t bencode::View::integer() const
+{
+    if(!isInteger()) throw std::runtime_error("Error: bencode value is not an integer");
+    return doc_->nodes_[index_].integer;
+}
+std::string_view bencode::View::string() const
+{
+    if(!isString()) throw std::runtime_error("Error: bencode value is not a string");
+    const auto& node = doc_->nodes_[index_];
+    return doc_->data_.substr(node.begin + node.size, node.length - node.size);
+}
+std::string_view bencode::View::raw() const
+{
+    if(!doc_) return {};
+    const auto& node = doc_->nodes_[index_];
+    return doc_->data_.substr(node.begin, node.length);
+}
+size_t bencode::View::size() const
+{
+    if(!isList() && !isDictionary()) return 0;
+    return doc_->nodes_[index_].size;
+}
+bencode::View bencode::View::operator[](std::string_view key) const
+{
+    if(!isDictionary()) return {};
+    for(auto it = begin(); it != end(); ++it)
+    {
+        if(it.key().string() == key) return it.value();
+    }
+    return {};
+}
+bencode::View bencode::View::operator[](size_t i) const
+{
+    if(!isList() || i >= size()) return {};
+    auto it = begin();
+    while(i--) ++it;
+    return *it;
+}
+bencode::View::Iterator bencode::View::begin() const
+{
+    if(!isList() && !isDictionary()) return end();
+    return Iterator(doc_, index_ + 1, type() == Type::Dictionary);
+}
+bencode::View::Iterator bencode::View::end() const
+{
+    if(!doc_) return Iterator(nullptr, 0, false);
+    return Iterator(doc_, doc_->nodes_[index_].next, doc_->nodes_[index_].type == Type::Dictionary);
+}
+
+bencode::View::Iterator::Iterator(const Document* doc, uint32_t index, bool pairs) : doc_(doc), index_(index), pairs_(pairs) {}
+bencode::View bencode::View::Iterator::operator*() const
+{
+    return pairs_ ? value() : View(doc_, index_);
+}
+bencode::View bencode::View::Iterator::key() const
+{
+    return pairs_ ? View(doc_, index_) : View();
+}
+bencode::View bencode::View::Iterator::value() const
+{
+    return View(doc_, pairs_ ? index_ + 1 : index_);
+}
+bencode::View::Iterator& bencode::View::Iterator::operator++()
+{
+    // у словаря за ключом (строкой, один узел) идет поддерево значения
+    index_ = doc_->nodes_[pairs_ ? index_ + 1 : index_].next;
+    return *this;
+}
+bool bencode::View::Iterator::operator!=(const Iterator& other) const
+{
+    return index_ != other.index_ || doc_ != other.doc_;
+}
+
+/******************DOCUMENT******************/
+bencode::Document bencode::Document::Parse(std::string_view data)
+{
+    struct Open
+    {
+        uint32_t node;
+        uint32_t items;  // для словаря считаются и ключи, и значения
+    };
+
+    if(data.size() > UINT32_MAX) BadBencode("data is too large");
+
+    Document doc;
+    doc.data_ = data;
+    doc.nodes_.reserve(data.size() / 16 + 1);  // грубая оценка: один узел примерно на каждые 16 байт
+    std::vector<Open> stack;
+    size_t pos = 0;
+
+    auto parseNumber = [&](char terminator, bool allowSign) {
+        bool negative = allowSign && pos < data.size() && data[pos] == '-';
+        if(negative) ++pos;
+        size_t begin = pos;
+        uint64_t value = 0;
+        while(pos < data.size() && '0' <= data[pos] && data[pos] <= '9')
+        {
+            if(value > (UINT64_MAX - 9) / 10) BadBencode("number is too large");
+            value = value * 10 + (data[pos++] - '0');
+        }
+        if(pos == begin || pos >= data.size() || data[pos] != terminator) BadBencode("malformed number");
+        ++pos;
+        if(value > static_cast<uint64_t>(INT64_MAX)) BadBencode("number is too large");
+        return negative ? -static_cast<int64_t>(value) : static_cast<int64_t>(value);
+    };
+
+    do
+    {
+        if(pos >= data.size()) BadBencode("unexpected end of data");
+
+        if(!stack.empty() && data[pos] == 'e')
+        {
+            Open open = stack.back();
+            stack.pop_back();
+            Node& node = doc.nodes_[open.node];
+            if(node.type == View::Type::Dictionary && open.items % 2) BadBencode("dictionary key without value");
+            node.size = node.type == View::Type::Dictionary ? open.items / 2 : open.items;
+            node.next = doc.nodes_.size();
+            ++pos;
+            node.length = pos - node.begin;
+            continue;
+        }
+
+        bool expectKey = false;
+        if(!stack.empty())
+        {
+            Open& parent = stack.back();
+            expectKey = doc.nodes_[parent.node].type == View::Type::Dictionary && parent.items % 2 == 0;
+            ++parent.items;
+        }
+
+        uint32_t index = doc.nodes_.size();
+        size_t begin = pos;
+        char c = data[pos];
+        if(c == 'i' && !expectKey)
+        {
+            ++pos;
+            int64_t value = parseNumber('e', true);
+            doc.nodes_.push_back({View::Type::Integer, 0, index + 1, uint32_t(begin), uint32_t(pos - begin), value});
+        }
+        else if('0' <= c && c <= '9')
+        {
+            size_t length = parseNumber(':', false);
+            if(length > data.size() - pos) BadBencode("string is out of data");
+            uint32_t prefix = pos - begin;
+            pos += length;
+            doc.nodes_.push_back({View::Type::String, prefix, index + 1, uint32_t(begin), uint32_t(pos - begin), 0});
+        }
+        else if((c == 'l' || c == 'd') && !expectKey)
+        {
+            if(stack.size() >= MAX_BENCODE_DEPTH) BadBencode("nesting is too deep");
+            ++pos;
+            auto type = c == 'l' ? View::Type::List : View::Type::Dictionary;
+            // длина участка и `next` выставляются, когда встретится закрывающий 'e'
+            doc.nodes_.push_back({type, 0, 0, uint32_t(begin), 0, 0});
+            stack.push_back({index, 0});
+        }
+        else
+        {
+            BadBencode(expectKey ? "dictionary key is not a string" : "unexpected character");
+        }
+    } while(!stack.empty());
+
+    doc.consumed_ = pos;
+    return doc;
+}
+bencode::View bencode::Document::root() const
+{
+    return View(this, 0);
+}
+size_t bencode::Document::consumed() const
+{
+    return consumed_;
+}
+
+/******************READER******************/
+namespace
+{
+    constexpr size_t MAX_KEY_LENGTH = 4096;
+    constexpr size_t MAX_NUMBER_LENGTH = 21;  // знак и 20 цифр
+}
+
+void bencode::Reader::feed(std::string_view chunk)
+{
+    // разобранное начало буфера больше не нужно
+    buffer_.erase(0, pos_);
+    base_ += pos_;
+    pos_ = 0;
+    buffer_.append(chunk);
+}
+void bencode::Reader::finish()
+{
+    finished_ = true;
+}
+bencode::Reader::Event bencode::Reader::next()
+{
+    for(;;)
+    {
+        if(inString_)
+        {
+            size_t available = std::min(stringLeft_, buffer_.size() - pos_);
+            if(available == 0 && stringLeft_ > 0) return needMore();
+
+            value_ = std::string_view(buffer_).substr(pos_, available);
+            pos_ += available;
+            stringLeft_ -= available;
+            bool skipped = skipping_;
+            if(stringLeft_ == 0)
+            {
+                inString_ = false;
+                skipped = valueFinished();
+            }
+            if(skipped) continue;
+            return event_ = Event::String;
+        }
+
+        if(done_) return event_ = Event::Done;
+        if(pos_ >= buffer_.size()) return needMore();
+
+        char c = buffer_[pos_];
+        Container* top = stack_.empty() ? nullptr : &stack_.back();
+        bool expectKey = top && top->dictionary && top->expectKey;
+
+        if(c == 'e' && top)
+        {
+            if(top->dictionary && !top->expectKey) BadBencode("dictionary key without value");
+            stack_.pop_back();
+            ++pos_;
+            if(valueFinished()) continue;
+            return event_ = Event::End;
+        }
+
+        size_t begin = pos_;
+        if(c == 'i' && !expectKey)
+        {
+            ++pos_;
+            auto value = parseNumber('e', true);
+            if(!value)
+            {
+                pos_ = begin;
+                return needMore();
+            }
+            integer_ = *value;
+            if(valueFinished()) continue;
+            return event_ = Event::Integer;
+        }
+        else if('0' <= c && c <= '9')
+        {
+            auto length = parseNumber(':', false);
+            if(!length)
+            {
+                pos_ = begin;
+                return needMore();
+            }
+
+            if(!expectKey)
+            {
+                // строку-значение выдаем кусками по мере поступления данных
+                inString_ = true;
+                stringLeft_ = stringLength_ = *length;
+                continue;
+            }
+
+            if(static_cast<size_t>(*length) > MAX_KEY_LENGTH) BadBencode("dictionary key is too long");
+            if(buffer_.size() - pos_ < static_cast<size_t>(*length))
+            {
+                pos_ = begin;
+                return needMore();
+            }
+            value_ = std::string_view(buffer_).substr(pos_, *length);
+            pos_ += *length;
+            top->expectKey = false;
+            if(skipping_) continue;
+            return event_ = Event::Key;
+        }
+        else if((c == 'l' || c == 'd') && !expectKey)
+        {
+            if(stack_.size() >= MAX_BENCODE_DEPTH) BadBencode("nesting is too deep");
+            ++pos_;
+            stack_.push_back({c == 'd', true});
+            if(skipping_) continue;
+            return event_ = c == 'l' ? Event::BeginList : Event::BeginDictionary;
+        }
+        else
+        {
+            BadBencode(expectKey ? "dictionary key is not a string" : "unexpected character");
+        }
+    }
+}
+int64_t bencode::Reader::integer() const
+{
+    return integer_;
+}
+std::string_view bencode::Reader::key() const
+{
+    return value_;
+}
+std::string_view bencode::Reader::string() const
+{
+    return value_;
+}
+bool bencode::Reader::last() const
+{
+    return !inString_;
+}
+size_t bencode::Reader::stringLength() const
+{
+    return stringLength_;
+}
+void bencode::Reader::skip()
+{
+    if(skipping_) return;
+    switch(event_)
+    {
+        case Event::Key:
+            skipDepth_ = stack_.size();
+            skipping_ = true;
+            break;
+        case Event::BeginList:
+        case Event::BeginDictionary:
+            skipDepth_ = stack_.size() - 1;
+            skipping_ = true;
+            break;
+        case Event::String:
+            if(inString_)
+            {
+                skipDepth_ = stack_.size();
+                skipping_ = true;
+            }
+            break;
+        default:
+            break;
+    }
+}
+size_t bencode::Reader::depth() const
+{
+    return stack_.size();
+}
+size_t bencode::Reader::offset() const
+{
+    return base_ + pos_;
+}
+bool bencode::Reader::valueFinished()
+{
+    if(stack_.empty())
+    {
+        done_ = true;
+    }
+    else if(stack_.back().dictionary)
+    {
+        stack_.back().expectKey = true;
+    }
+
+    bool skipped = skipping_;
+    if(skipping_ && stack_.size() == skipDepth_)
+    {
+        skipping_ = false;
+    }
+    return skipped;
+}
+std::optional<int64_t> bencode::Reader::parseNumber(char terminator, bool allowSign)
+{
+    std::string_view data(buffer_);
+    size_t begin = pos_;
+    bool negative = allowSign && pos_ < data.size() && data[pos_] == '-';
+    if(negative) ++pos_;
+    size_t digits = pos_;
+    uint64_t value = 0;
+    while(pos_ < data.size() && '0' <= data[pos_] && data[pos_] <= '9')
+    {
+        if(value > (UINT64_MAX - 9) / 10) BadBencode("number is too large");
+        value = value * 10 + (data[pos_++] - '0');
+    }
+    if(pos_ >= data.size())
+    {
+        if(pos_ - begin > MAX_NUMBER_LENGTH) BadBencode("number is too long");
+        return std::nullopt;
+    }
+    if(pos_ == digits || data[pos_] != terminator) BadBencode("malformed number");
+    ++pos_;
+    if(value > static_cast<uint64_t>(INT64_MAX)) BadBencode("number is too large");
+    return negative ? -static_cast<int64_t>(value) : static_cast<int64_t>(value);
+}
+bencode::Reader::Event bencode::Reader::needMore()
+{
+    if(finished_) BadBencode("unexpected end of data");
+    return event_ = Event::NeedMore;
+}
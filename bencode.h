@@ -5,6 +5,9 @@
 #include <vector>
 #include <memory>
 #include <map>
+#include <string_view>
+#include <cstdint>
+#include <optional>
 
 namespace bencode
 {
@@ -112,4 +115,233 @@ namespace bencode
             return std::shared_ptr<bcType>(new Dictionary(dict));
         }
     }
+
+    /*
+     * Разбор bencode без копирования.
+     * Весь документ разбирается за один проход по непрерывному буферу (например, отображенному в память файлу) в
+     * плоский массив узлов, выделенный одним куском. Строки не копируются, а ссылаются на исходный буфер, поэтому
+     * буфер должен жить дольше документа. Для каждого узла запоминается его исходный участок буфера: например,
+     * info hash считается прямо по байтам словаря `info`, без повторного кодирования
+     */
+    class Document;
+
+    /*
+     * Легкая ссылка на узел документа. Пустая ссылка (`operator bool` == false) получается при поиске отсутствующего
+     * ключа или узла неподходящего типа, так что цепочки вида `root["info"]["length"]` не требуют проверок на каждом шаге
+     */
+    class View
+    {
+    public:
+        enum class Type : uint8_t
+        {
+            Integer,
+            String,
+            List,
+            Dictionary,
+        };
+
+        View() = default;
+
+        explicit operator bool() const;
+        Type type() const;
+        bool isInteger() const;
+        bool isString() const;
+        bool isList() const;
+        bool isDictionary() const;
+
+        /*
+         * Значение узла. Бросают исключение, если узел пустой или другого типа
+         */
+        int64_t integer() const;
+        std::string_view string() const;
+
+        /*
+         * Исходные байты узла целиком, вместе с префиксом типа и завершающим 'e'
+         */
+        std::string_view raw() const;
+
+        /*
+         * Число элементов списка или пар ключ-значение словаря
+         */
+        size_t size() const;
+
+        /*
+         * Значение по ключу словаря или пустая ссылка
+         */
+        View operator[](std::string_view key) const;
+
+        /*
+         * i-й элемент списка (линейный проход) или пустая ссылка
+         */
+        View operator[](size_t i) const;
+
+        /*
+         * Обход элементов списка или пар словаря: для словаря `key()` -- ключ, `value()` -- значение
+         */
+        class Iterator
+        {
+        public:
+            View operator*() const;
+            View key() const;
+            View value() const;
+            Iterator& operator++();
+            bool operator!=(const Iterator& other) const;
+        private:
+            friend class View;
+            Iterator(const Document* doc, uint32_t index, bool pairs);
+            const Document* doc_;
+            uint32_t index_;
+            bool pairs_;
+        };
+        Iterator begin() const;
+        Iterator end() const;
+    private:
+        friend class Document;
+        View(const Document* doc, uint32_t index);
+
+        const Document* doc_ = nullptr;
+        uint32_t index_ = 0;
+    };
+
+    class Document
+    {
+    public:
+        /*
+         * Разобрать `data`. Бросает std::runtime_error, если данные не являются корректным bencode.
+         * Все, что идет после первого значения, игнорируется
+         */
+        static Document Parse(std::string_view data);
+
+        View root() const;
+
+        /*
+         * Сколько байт буфера занял разобранный документ
+         */
+        size_t consumed() const;
+    private:
+        friend class View;
+
+        /*
+         * Узел хранит не указатели, а смещения в буфере, чтобы занимать поменьше места
+         */
+        struct Node
+        {
+            View::Type type;
+            uint32_t size;  // число элементов списка или пар словаря, у строки -- длина префикса "<длина>:"
+            uint32_t next;  // номер узла, следующего за поддеревом этого узла
+            uint32_t begin;  // исходный участок буфера
+            uint32_t length;
+            int64_t integer;
+        };
+
+        std::string_view data_;
+        std::vector<Node> nodes_;  // узлы в порядке обхода в глубину
+        size_t consumed_ = 0;
+    };
+
+    /*
+     * Потоковое чтение bencode по событиям (pull-парсер).
+     * Данные передаются кусками через `feed()` (например, прямо из callback'а, получающего тело HTTP ответа), а
+     * `next()` выдает очередное событие: начало и конец списка или словаря, ключ, число или кусок строки. Дерево
+     * целиком не строится, а в буфере хранится только еще не разобранный хвост, поэтому память ограничена размером
+     * куска и самого длинного ключа или числа. Длинные строки-значения (например, `pieces`) выдаются по мере
+     * поступления данных несколькими событиями `String`, а ненужные поддеревья можно пропустить через `skip()`
+     */
+    class Reader
+    {
+    public:
+        enum class Event : uint8_t
+        {
+            NeedMore,  // разобранные данные закончились, нужен следующий кусок
+            Integer,
+            Key,  // ключ словаря, всегда целиком
+            String,  // очередной кусок строки-значения, `last()` -- кусок последний
+            BeginList,
+            BeginDictionary,
+            End,  // конец списка или словаря
+            Done,  // корневое значение прочитано целиком
+        };
+
+        Reader() = default;
+
+        /*
+         * Добавить очередной кусок данных. Делает недействительными строки, полученные из `key()` и `string()`
+         */
+        void feed(std::string_view chunk);
+
+        /*
+         * Данных больше не будет: если значение не закончилось, `next()` бросит исключение вместо `NeedMore`
+         */
+        void finish();
+
+        /*
+         * Следующее событие. Бросает std::runtime_error на некорректных данных
+         */
+        Event next();
+
+        /*
+         * Значение последнего события `Integer`, `Key` или `String`. Строки ссылаются на внутренний буфер и
+         * действительны до следующего вызова `next()` или `feed()`
+         */
+        int64_t integer() const;
+        std::string_view key() const;
+        std::string_view string() const;
+        bool last() const;
+
+        /*
+         * Полная длина строки, кусок которой выдан последним событием `String`
+         */
+        size_t stringLength() const;
+
+        /*
+         * Пропустить без разбора на события: после `Key` -- его значение, после `BeginList` / `BeginDictionary` --
+         * остаток контейнера вместе с его `End`, после не последнего куска строки -- ее остаток
+         */
+        void skip();
+
+        /*
+         * Глубина вложенности: число открытых списков и словарей
+         */
+        size_t depth() const;
+
+        /*
+         * Сколько байт входных данных разобрано с начала. Сразу после события `Key` -- смещение начала значения,
+         * после `End` -- смещение байта, следующего за контейнером
+         */
+        size_t offset() const;
+    private:
+        struct Container
+        {
+            bool dictionary;
+            bool expectKey;
+        };
+
+        std::string buffer_;
+        size_t pos_ = 0;  // начало неразобранных данных в буфере
+        size_t base_ = 0;  // смещение начала буфера от начала входных данных
+        bool finished_ = false;
+        bool done_ = false;
+        std::vector<Container> stack_;
+        size_t stringLeft_ = 0;  // сколько байт текущей строки-значения еще не выдано
+        size_t stringLength_ = 0;
+        bool inString_ = false;
+        bool skipping_ = false;
+        size_t skipDepth_ = 0;  // пропускаем события, пока не закончится значение на этой глубине
+        Event event_ = Event::NeedMore;  // последнее выданное событие
+        int64_t integer_ = 0;
+        std::string_view value_;
+
+        /*
+         * Значение закончилось на текущей глубине: у словаря дальше ожидается ключ. Возвращает true, если значение
+         * было частью пропускаемого поддерева и событие о нем выдавать не нужно
+         */
+        bool valueFinished();
+
+        /*
+         * Разобрать число вида `<цифры><terminator>`, начиная с `pos_`. Пустой результат -- данных пока не хватает
+         */
+        std::optional<int64_t> parseNumber(char terminator, bool allowSign);
+
+        Event needMore();
+    };
 }
\ No newline at end of file
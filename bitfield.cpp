@@ -0,0 +1,265 @@
+#include "bitfield.h"
+#include <immintrin.h>
+#include <algorithm>
+#include <bit>
+#include <stdexcept>
+
+namespace {
+constexpr size_t WORD_BITS = 64;
+constexpr size_t WORDS_PER_CHUNK = 8;  // 512 бит: один регистр AVX-512, два AVX2
+
+size_t WordsFor(size_t bits)
+{
+    size_t words = (bits + WORD_BITS - 1) / WORD_BITS;
+    return (words + WORDS_PER_CHUNK - 1) / WORDS_PER_CHUNK * WORDS_PER_CHUNK;
+}
+
+/*
+ * Переставить биты внутри каждого байта в обратном порядке: в протоколе первая часть -- старший бит байта
+ */
+uint64_t ReverseBitsInBytes(uint64_t x)
+{
+    x = ((x >> 1) & 0x5555555555555555ULL) | ((x & 0x5555555555555555ULL) << 1);
+    x = ((x >> 2) & 0x3333333333333333ULL) | ((x & 0x3333333333333333ULL) << 2);
+    x = ((x >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((x & 0x0F0F0F0F0F0F0F0FULL) << 4);
+    return x;
+}
+
+/*
+ * Подсчет единиц в `count` словах (count кратно WORDS_PER_CHUNK). `mode`: 0 -- a, 1 -- a & b, 2 -- a & ~b
+ */
+using PopCountFunction = size_t (*)(const uint64_t* a, const uint64_t* b, size_t count, int mode);
+
+inline uint64_t Combine(uint64_t a, uint64_t b, int mode)
+{
+    return mode == 0 ? a : mode == 1 ? (a & b) : (a & ~b);
+}
+
+size_t PopCountGeneric(const uint64_t* a, const uint64_t* b, size_t count, int mode)
+{
+    size_t result = 0;
+    for(size_t i = 0; i < count; ++i)
+    {
+        result += std::popcount(Combine(a[i], b ? b[i] : 0, mode));
+    }
+    return result;
+}
+
+#pragma GCC push_options
+#pragma GCC target("popcnt")
+
+size_t PopCountPopcnt(const uint64_t* a, const uint64_t* b, size_t count, int mode)
+{
+    size_t result = 0;
+    for(size_t i = 0; i < count; ++i)
+    {
+        result += _mm_popcnt_u64(Combine(a[i], b ? b[i] : 0, mode));
+    }
+    return result;
+}
+
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512vpopcntdq")
+
+size_t PopCountAvx512(const uint64_t* a, const uint64_t* b, size_t count, int mode)
+{
+    __m512i sum = _mm512_setzero_si512();
+    for(size_t i = 0; i < count; i += WORDS_PER_CHUNK)
+    {
+        __m512i x = _mm512_loadu_si512(a + i);
+        if(mode == 1) x = _mm512_and_si512(x, _mm512_loadu_si512(b + i));
+        if(mode == 2) x = _mm512_andnot_si512(_mm512_loadu_si512(b + i), x);
+        sum = _mm512_add_epi64(sum, _mm512_popcnt_epi64(x));
+    }
+    return _mm512_reduce_add_epi64(sum);
+}
+
+#pragma GCC pop_options
+
+PopCountFunction SelectPopCount()
+{
+    if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vpopcntdq")) return PopCountAvx512;
+    if(__builtin_cpu_supports("popcnt")) return PopCountPopcnt;
+    return PopCountGeneric;
+}
+
+size_t PopCount(const uint64_t* a, const uint64_t* b, size_t count, int mode)
+{
+    static const PopCountFunction function = SelectPopCount();
+    return function(a, b, count, mode);
+}
+}
+
+Bitfield::Bitfield(size_t size)
+: size_(size)
+, words_(WordsFor(size), 0)
+{}
+
+Bitfield Bitfield::FromBytes(std::string_view bytes, size_t size)
+{
+    Bitfield result(size);
+    size_t usedBytes = std::min(bytes.size(), (size + 7) / 8);
+    for(size_t i = 0; i < usedBytes; i += sizeof(uint64_t))
+    {
+        // байты слова идут в порядке little endian: байт j дает биты 8j..8j+7
+        uint64_t word = 0;
+        for(size_t j = 0; j < sizeof(uint64_t) && i + j < usedBytes; ++j)
+        {
+            word |= uint64_t(static_cast<unsigned char>(bytes[i + j])) << (8 * j);
+        }
+        result.words_[i / sizeof(uint64_t)] = ReverseBitsInBytes(word);
+    }
+    result.ClearTail();
+    return result;
+}
+
+std::string Bitfield::ToBytes() const
+{
+    std::string bytes((size_ + 7) / 8, '\0');
+    for(size_t i = 0; i < bytes.size(); ++i)
+    {
+        uint64_t word = ReverseBitsInBytes(words_[i / sizeof(uint64_t)]);
+        bytes[i] = static_cast<char>(word >> (8 * (i % sizeof(uint64_t))));
+    }
+    return bytes;
+}
+
+size_t Bitfield::Size() const
+{
+    return size_;
+}
+
+bool Bitfield::Test(size_t index) const
+{
+    if(index >= size_) return false;
+    return (words_[index / WORD_BITS] >> (index % WORD_BITS)) & 1;
+}
+
+bool Bitfield::Set(size_t index)
+{
+    if(index >= size_) return false;
+    words_[index / WORD_BITS] |= uint64_t(1) << (index % WORD_BITS);
+    return true;
+}
+
+bool Bitfield::Reset(size_t index)
+{
+    if(index >= size_) return false;
+    words_[index / WORD_BITS] &= ~(uint64_t(1) << (index % WORD_BITS));
+    return true;
+}
+
+void Bitfield::SetAll()
+{
+    std::fill(words_.begin(), words_.end(), ~uint64_t(0));
+    ClearTail();
+}
+
+size_t Bitfield::Count() const
+{
+    return PopCount(words_.data(), nullptr, words_.size(), 0);
+}
+
+bool Bitfield::None() const
+{
+    return FindNext() == npos;
+}
+
+bool Bitfield::All() const
+{
+    return Count() == size_;
+}
+
+size_t Bitfield::CountAnd(const Bitfield& other) const
+{
+    return PopCount(words_.data(), other.words_.data(), std::min(words_.size(), other.words_.size()), 1);
+}
+
+size_t Bitfield::CountAndNot(const Bitfield& other) const
+{
+    size_t common = std::min(words_.size(), other.words_.size());
+    return PopCount(words_.data(), other.words_.data(), common, 2)
+            + PopCount(words_.data() + common, nullptr, words_.size() - common, 0);
+}
+
+size_t Bitfield::FindNext(size_t from) const
+{
+    return FindNextAnd(*this, from);
+}
+
+size_t Bitfield::FindNextAnd(const Bitfield& other, size_t from) const
+{
+    size_t limit = std::min(size_, other.size_);
+    if(from >= limit) return npos;
+
+    size_t wordIndex = from / WORD_BITS;
+    uint64_t word = words_[wordIndex] & other.words_[wordIndex] & (~uint64_t(0) << (from % WORD_BITS));
+    size_t words = (limit + WORD_BITS - 1) / WORD_BITS;
+    while(!word)
+    {
+        if(++wordIndex >= words) return npos;
+        word = words_[wordIndex] & other.words_[wordIndex];
+    }
+    size_t index = wordIndex * WORD_BITS + std::countr_zero(word);
+    return index < limit ? index : npos;
+}
+
+Bitfield& Bitfield::operator&=(const Bitfield& other)
+{
+    if(other.size_ != size_) throw std::invalid_argument("Error: bitfield sizes differ");
+    // пачки фиксированной длины компилятор превращает в векторные инструкции
+    for(size_t i = 0; i < words_.size(); i += WORDS_PER_CHUNK)
+    {
+        for(size_t j = 0; j < WORDS_PER_CHUNK; ++j)
+        {
+            words_[i + j] &= other.words_[i + j];
+        }
+    }
+    return *this;
+}
+
+Bitfield& Bitfield::AndNot(const Bitfield& other)
+{
+    if(other.size_ != size_) throw std::invalid_argument("Error: bitfield sizes differ");
+    for(size_t i = 0; i < words_.size(); i += WORDS_PER_CHUNK)
+    {
+        for(size_t j = 0; j < WORDS_PER_CHUNK; ++j)
+        {
+            words_[i + j] &= ~other.words_[i + j];
+        }
+    }
+    return *this;
+}
+
+Bitfield& Bitfield::operator|=(const Bitfield& other)
+{
+    if(other.size_ != size_) throw std::invalid_argument("Error: bitfield sizes differ");
+    for(size_t i = 0; i < words_.size(); i += WORDS_PER_CHUNK)
+    {
+        for(size_t j = 0; j < WORDS_PER_CHUNK; ++j)
+        {
+            words_[i + j] |= other.words_[i + j];
+        }
+    }
+    return *this;
+}
+
+const std::vector<uint64_t>& Bitfield::Words() const
+{
+    return words_;
+}
+
+void Bitfield::ClearTail()
+{
+    if(size_ % WORD_BITS)
+    {
+        words_[size_ / WORD_BITS] &= ~uint64_t(0) >> (WORD_BITS - size_ % WORD_BITS);
+    }
+    // слова-заполнители за последним словом и так нулевые
+    for(size_t i = (size_ + WORD_BITS - 1) / WORD_BITS; i < words_.size(); ++i)
+    {
+        words_[i] = 0;
+    }
+}
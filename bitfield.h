@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+ * Битовое множество номеров частей файла, упакованное в 64-битные слова.
+ * Массовые операции (пересечение, разность, подсчет единиц, поиск следующего бита) идут по словам, а не по битам:
+ * "какие из нужных нам частей есть у пира" -- это несколько проходов по словам, а не цикл по всем частям.
+ * Слова хранятся с запасом до кратного 8 числа (512 бит), хвостовые биты всегда нулевые, поэтому циклы по словам
+ * идут пачками фиксированной длины и векторизуются компилятором. Подсчет единиц выбирает во время работы инструкции
+ * AVX-512 VPOPCNTDQ или POPCNT, если процессор их поддерживает.
+ * Внутри слова биты идут от младшего к старшему, в сообщении bitfield -- от старшего бита байта к младшему
+ * https://wiki.theory.org/BitTorrentSpecification#bitfield:_.3Clen.3D0001.2BX.3E.3Cid.3D5.3E.3Cbitfield.3E
+ */
+class Bitfield {
+public:
+    static constexpr size_t npos = SIZE_MAX;
+
+    Bitfield() = default;
+
+    /*
+     * size -- число бит, все биты сброшены
+     */
+    explicit Bitfield(size_t size);
+
+    /*
+     * Разобрать bitfield в формате протокола. Лишние байты и биты за пределами `size` отбрасываются
+     */
+    static Bitfield FromBytes(std::string_view bytes, size_t size);
+
+    /*
+     * Bitfield в формате протокола: ceil(size / 8) байт
+     */
+    std::string ToBytes() const;
+
+    /*
+     * Число бит (а не единиц, см. `Count`)
+     */
+    size_t Size() const;
+
+    /*
+     * Значение бита. За пределами множества -- false
+     */
+    bool Test(size_t index) const;
+
+    /*
+     * Установить / сбросить бит. Индексы за пределами множества игнорируются, возвращается false
+     */
+    bool Set(size_t index);
+    bool Reset(size_t index);
+
+    /*
+     * Установить все биты
+     */
+    void SetAll();
+
+    /*
+     * Сколько бит установлено
+     */
+    size_t Count() const;
+    bool None() const;
+    bool All() const;
+
+    /*
+     * Сколько бит установлено и здесь, и в `other` (и здесь, но не в `other`), без построения нового множества
+     */
+    size_t CountAnd(const Bitfield& other) const;
+    size_t CountAndNot(const Bitfield& other) const;
+
+    /*
+     * Первый установленный бит, начиная с `from`, или npos
+     */
+    size_t FindNext(size_t from = 0) const;
+
+    /*
+     * Первый бит, начиная с `from`, установленный и здесь, и в `other`, или npos
+     */
+    size_t FindNextAnd(const Bitfield& other, size_t from = 0) const;
+
+    /*
+     * Пересечение и разность на месте. Множества должны быть одного размера
+     */
+    Bitfield& operator&=(const Bitfield& other);
+    Bitfield& AndNot(const Bitfield& other);
+    Bitfield& operator|=(const Bitfield& other);
+
+    bool operator==(const Bitfield& other) const = default;
+
+    const std::vector<uint64_t>& Words() const;
+private:
+    size_t size_ = 0;
+    std::vector<uint64_t> words_;  // длина кратна 8, биты за `size_` нулевые
+
+    /*
+     * Сбросить биты за пределами `size_` в последнем слове
+     */
+    void ClearTail();
+};
@@ -0,0 +1,240 @@
+#include "buffer_pool.h"
+#include <cstdlib>
+#include <new>
+#include <bit>
+#include <algorithm>
+#include <utility>
+
+BufferPool::Buffer::Buffer(BufferPool* pool, char* data, size_t size, size_t sizeClass)
+: pool_(pool)
+, data_(data)
+, size_(size)
+, sizeClass_(sizeClass)
+{}
+
+BufferPool::Buffer::Buffer(Buffer&& other) noexcept
+: pool_(std::exchange(other.pool_, nullptr))
+, data_(std::exchange(other.data_, nullptr))
+, size_(std::exchange(other.size_, 0))
+, sizeClass_(std::exchange(other.sizeClass_, 0))
+{}
+
+BufferPool::Buffer& BufferPool::Buffer::operator=(Buffer&& other) noexcept
+{
+    if(this != &other)
+    {
+        Release();
+        pool_ = std::exchange(other.pool_, nullptr);
+        data_ = std::exchange(other.data_, nullptr);
+        size_ = std::exchange(other.size_, 0);
+        sizeClass_ = std::exchange(other.sizeClass_, 0);
+    }
+    return *this;
+}
+
+BufferPool::Buffer::~Buffer()
+{
+    Release();
+}
+
+char* BufferPool::Buffer::Data() const
+{
+    return data_;
+}
+
+size_t BufferPool::Buffer::Size() const
+{
+    return size_;
+}
+
+size_t BufferPool::Buffer::Capacity() const
+{
+    return data_ ? ClassSize(sizeClass_) : 0;
+}
+
+BufferPool::Buffer::operator bool() const
+{
+    return data_ != nullptr;
+}
+
+void BufferPool::Buffer::Release()
+{
+    if(data_)
+    {
+        pool_->Return(data_, sizeClass_);
+        data_ = nullptr;
+        size_ = 0;
+    }
+}
+
+BufferPool::BufferPool(size_t maxCachedBytes)
+: cachedBytes_(0)
+, maxCachedBytes_(maxCachedBytes)
+{}
+
+BufferPool::~BufferPool()
+{
+    for(auto& buffers : free_)
+    {
+        for(char* data : buffers)
+        {
+            std::free(data);
+        }
+    }
+    for(auto& state : regions_)
+    {
+        std::free(state.region.data);
+    }
+}
+
+BufferPool& BufferPool::Instance()
+{
+    static BufferPool pool;
+    return pool;
+}
+
+BufferPool::Buffer BufferPool::Acquire(size_t size)
+{
+    size_t sizeClass = SizeClass(size);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(sizeClass < regionFree_.size() && !regionFree_[sizeClass].empty())
+        {
+            char* data = regionFree_[sizeClass].back();
+            regionFree_[sizeClass].pop_back();
+            cachedBytes_ -= ClassSize(sizeClass);
+            ++FindRegion(data)->outstanding;
+            return Buffer(this, data, size, sizeClass);
+        }
+        if(sizeClass < free_.size() && !free_[sizeClass].empty())
+        {
+            char* data = free_[sizeClass].back();
+            free_[sizeClass].pop_back();
+            cachedBytes_ -= ClassSize(sizeClass);
+            return Buffer(this, data, size, sizeClass);
+        }
+    }
+
+    char* data = static_cast<char*>(std::aligned_alloc(ALIGNMENT, ClassSize(sizeClass)));
+    if(!data)
+    {
+        throw std::bad_alloc();
+    }
+    return Buffer(this, data, size, sizeClass);
+}
+
+void BufferPool::Reserve(size_t size, size_t count)
+{
+    std::vector<Buffer> buffers;
+    for(size_t i = 0; i < count; ++i)
+    {
+        buffers.emplace_back(Acquire(size));
+    }
+}
+
+BufferPool::Region BufferPool::ReserveRegion(size_t size, size_t count)
+{
+    if(count == 0) return Region{nullptr, 0};
+
+    size_t sizeClass = SizeClass(size);
+    size_t bytes = ClassSize(sizeClass) * count;
+    char* data = static_cast<char*>(std::aligned_alloc(ALIGNMENT, bytes));
+    if(!data)
+    {
+        throw std::bad_alloc();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    regions_.push_back({{data, bytes}, sizeClass, 0, false});
+    if(regionFree_.size() <= sizeClass)
+    {
+        regionFree_.resize(sizeClass + 1);
+    }
+    for(size_t i = 0; i < count; ++i)
+    {
+        regionFree_[sizeClass].push_back(data + i * ClassSize(sizeClass));
+    }
+    cachedBytes_ += bytes;
+    return regions_.back().region;
+}
+
+void BufferPool::ReleaseRegion(const Region& region)
+{
+    if(!region.data) return;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto state = FindRegion(region.data);
+    if(state == regions_.end() || state->released) return;
+
+    state->released = true;
+    auto& buffers = regionFree_[state->sizeClass];
+    auto unused = std::remove_if(buffers.begin(), buffers.end(), [&region](const char* data) {
+        return region.data <= data && data < region.data + region.size;
+    });
+    cachedBytes_ -= (buffers.end() - unused) * ClassSize(state->sizeClass);
+    buffers.erase(unused, buffers.end());
+
+    if(state->outstanding == 0)
+    {
+        std::free(state->region.data);
+        regions_.erase(state);
+    }
+}
+
+size_t BufferPool::CachedBytes() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return cachedBytes_;
+}
+
+size_t BufferPool::SizeClass(size_t size)
+{
+    if(size <= MIN_CLASS_SIZE) return 0;
+    return std::bit_width(size - 1) - std::bit_width(MIN_CLASS_SIZE - 1);
+}
+
+size_t BufferPool::ClassSize(size_t sizeClass)
+{
+    return MIN_CLASS_SIZE << sizeClass;
+}
+
+std::vector<BufferPool::RegionState>::iterator BufferPool::FindRegion(const char* data)
+{
+    return std::find_if(regions_.begin(), regions_.end(), [data](const RegionState& state) {
+        return state.region.data <= data && data < state.region.data + state.region.size;
+    });
+}
+
+void BufferPool::Return(char* data, size_t sizeClass)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto region = FindRegion(data);
+        if(region != regions_.end())
+        {
+            --region->outstanding;
+            if(!region->released)
+            {
+                regionFree_[sizeClass].push_back(data);
+                cachedBytes_ += ClassSize(sizeClass);
+            }
+            else if(region->outstanding == 0)
+            {
+                std::free(region->region.data);
+                regions_.erase(region);
+            }
+            return;
+        }
+        if(cachedBytes_ + ClassSize(sizeClass) <= maxCachedBytes_)
+        {
+            if(free_.size() <= sizeClass)
+            {
+                free_.resize(sizeClass + 1);
+            }
+            free_[sizeClass].push_back(data);
+            cachedBytes_ += ClassSize(sizeClass);
+            return;
+        }
+    }
+    std::free(data);
+}
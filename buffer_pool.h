@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+/*
+ * Пул буферов под данные частей файла.
+ * Размеры буферов округляются вверх до степени двойки (классы размеров), освобожденные буферы не возвращаются
+ * системе, а складываются в список свободных буферов своего класса и выдаются снова. Так при скачивании в
+ * установившемся режиме на каждую часть файла не приходится ни одного выделения памяти в куче.
+ * Буферы выровнены на границу страницы, чтобы их можно было напрямую отдавать в дисковый ввод-вывод
+ */
+class BufferPool {
+public:
+    /*
+     * Буфер, взятый из пула. При уничтожении автоматически возвращается в пул
+     */
+    class Buffer {
+    public:
+        Buffer() = default;
+        Buffer(Buffer&& other) noexcept;
+        Buffer& operator=(Buffer&& other) noexcept;
+        Buffer(const Buffer&) = delete;
+        Buffer& operator=(const Buffer&) = delete;
+        ~Buffer();
+
+        char* Data() const;
+
+        /*
+         * Запрошенный размер и реальная вместимость буфера (размер его класса)
+         */
+        size_t Size() const;
+        size_t Capacity() const;
+
+        explicit operator bool() const;
+
+        /*
+         * Вернуть буфер в пул раньше, чем он будет уничтожен
+         */
+        void Release();
+    private:
+        friend class BufferPool;
+        Buffer(BufferPool* pool, char* data, size_t size, size_t sizeClass);
+
+        BufferPool* pool_ = nullptr;
+        char* data_ = nullptr;
+        size_t size_ = 0;
+        size_t sizeClass_ = 0;
+    };
+
+    /*
+     * maxCachedBytes -- сколько памяти пул может держать в свободных буферах. Сверх этого буферы освобождаются
+     */
+    explicit BufferPool(size_t maxCachedBytes = DEFAULT_MAX_CACHED_BYTES);
+    ~BufferPool();
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    /*
+     * Общий пул, которым по умолчанию пользуются части файла
+     */
+    static BufferPool& Instance();
+
+    /*
+     * Взять буфер размером не меньше `size` байт
+     */
+    Buffer Acquire(size_t size);
+
+    /*
+     * Заранее выделить `count` свободных буферов под размер `size`
+     */
+    void Reserve(size_t size, size_t count);
+
+    struct Region {
+        char* data;
+        size_t size;
+    };
+
+    /*
+     * Заранее выделить `count` буферов под размер `size` одним непрерывным участком памяти (регионом).
+     * Буферы регионов выдаются в первую очередь и не освобождаются до `ReleaseRegion`, поэтому регион можно
+     * один раз зарегистрировать в ядре для ввода-вывода без копирования (см. IoUring)
+     */
+    Region ReserveRegion(size_t size, size_t count);
+
+    /*
+     * Регион больше не нужен: его буферы перестают выдаваться, а память освобождается, как только в пул вернется
+     * последний выданный из него буфер. Регистрацию в ядре надо снять раньше
+     */
+    void ReleaseRegion(const Region& region);
+
+    /*
+     * Сколько памяти сейчас лежит в свободных буферах
+     */
+    size_t CachedBytes() const;
+
+    static constexpr size_t DEFAULT_MAX_CACHED_BYTES = 1 << 28;
+    static constexpr size_t MIN_CLASS_SIZE = 1 << 14;
+    static constexpr size_t ALIGNMENT = 4096;
+private:
+    mutable std::mutex mutex_;
+    std::vector<std::vector<char*>> free_;  // свободные буферы по классам размеров
+    std::vector<std::vector<char*>> regionFree_;  // свободные буферы из регионов по классам размеров
+    struct RegionState {
+        Region region;
+        size_t sizeClass;
+        size_t outstanding;  // сколько буферов региона сейчас выдано
+        bool released;  // память освобождается, когда вернется последний выданный буфер
+    };
+    std::vector<RegionState> regions_;
+    size_t cachedBytes_;
+    const size_t maxCachedBytes_;
+
+    /*
+     * Номер класса размера для буфера размером `size` и размер буферов этого класса
+     */
+    static size_t SizeClass(size_t size);
+    static size_t ClassSize(size_t sizeClass);
+
+    /*
+     * Регион, которому принадлежит буфер, или `regions_.end()`. Вызывается под `mutex_`
+     */
+    std::vector<RegionState>::iterator FindRegion(const char* data);
+
+    void Return(char* data, size_t sizeClass);
+};
@@ -1,6 +1,8 @@
 #pragma once
 #include "byte_tools.h"
 #include <openssl/sha.h>
+#include <openssl/evp.h>
+#include <stdexcept>
 #include <vector>
 #include <sstream>
 #include <iomanip>
@@ -32,10 +34,42 @@ std::string IntToBytes(size_t X)
     return BigEndian;
 }
 
-std::string CalculateSHA1(const std::string& msg)
+std::string CalculateSHA1(std::string_view msg)
 {
     unsigned char hash[20];
-    SHA1((const unsigned char*) msg.c_str(), msg.size(), hash);
+    SHA1((const unsigned char*) msg.data(), msg.size(), hash);
+    return std::string(hash, hash + 20);
+}
+
+Sha1Context::Sha1Context()
+: ctx_(EVP_MD_CTX_new())
+{
+    if(!ctx_)
+    {
+        throw std::runtime_error("Error: cannot create SHA1 context");
+    }
+    Reset();
+}
+
+Sha1Context::~Sha1Context()
+{
+    EVP_MD_CTX_free(ctx_);
+}
+
+void Sha1Context::Reset()
+{
+    EVP_DigestInit_ex(ctx_, EVP_sha1(), nullptr);
+}
+
+void Sha1Context::Update(std::string_view data)
+{
+    EVP_DigestUpdate(ctx_, data.data(), data.size());
+}
+
+std::string Sha1Context::Final()
+{
+    unsigned char hash[20];
+    EVP_DigestFinal_ex(ctx_, hash, nullptr);
     return std::string(hash, hash + 20);
 }
 
@@ -1,6 +1,9 @@
 #pragma once
 
 #include <string>
+#include <string_view>
+
+typedef struct evp_md_ctx_st EVP_MD_CTX;
 
 /*
  * Преобразовать 4 байта в формате big endian в int
@@ -13,7 +16,37 @@ std::string IntToBytes(size_t X);
  * Расчет SHA1 хеш-суммы. Здесь в результате подразумевается не человеко-читаемая строка, а массив из 20 байтов
  * в том виде, в котором его генерирует библиотека OpenSSL
  */
-std::string CalculateSHA1(const std::string& msg);
+std::string CalculateSHA1(std::string_view msg);
+
+/*
+ * Инкрементальный расчет SHA1: данные можно подавать кусками по мере их появления,
+ * результат совпадает с `CalculateSHA1` от всех кусков, склеенных по порядку
+ */
+class Sha1Context {
+public:
+    Sha1Context();
+    ~Sha1Context();
+
+    Sha1Context(const Sha1Context&) = delete;
+    Sha1Context& operator=(const Sha1Context&) = delete;
+
+    /*
+     * Начать расчет заново
+     */
+    void Reset();
+
+    /*
+     * Добавить очередной кусок данных
+     */
+    void Update(std::string_view data);
+
+    /*
+     * Закончить расчет и получить хеш (20 байт). После этого надо вызвать `Reset`
+     */
+    std::string Final();
+private:
+    EVP_MD_CTX* ctx_;
+};
 
 /*
  * Представить массив байтов в виде строки, содержащей только символы, соответствующие цифрам в шестнадцатеричном исчислении.
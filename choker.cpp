@@ -0,0 +1,126 @@
+#include "choker.h"
+#include <algorithm>
+
+Choker::Choker(size_t slots)
+: slots_(slots)
+, optimistic_()
+, nextRechoke_()
+, nextOptimistic_()
+, random_(std::random_device{}())
+{
+}
+
+void Choker::Rechoke(std::vector<Candidate>& candidates, bool seeding, Clock::time_point now)
+{
+    nextRechoke_ = now + REGULAR_PERIOD;
+
+    std::vector<Candidate*> interested;
+    for(auto& candidate : candidates)
+    {
+        candidate.unchoked = false;
+        if(candidate.interested)
+        {
+            interested.push_back(&candidate);
+        }
+    }
+
+    // пока качаем, отвечаем взаимностью тем, кто отдает нам; на раздаче отдаем тем, кто быстрее всех забирает
+    std::sort(interested.begin(), interested.end(), [seeding](const Candidate* lhs, const Candidate* rhs) {
+        double left = seeding ? lhs->uploadRate : lhs->downloadRate;
+        double right = seeding ? rhs->uploadRate : rhs->downloadRate;
+        if(left != right) return left > right;
+        return (seeding ? lhs->downloadRate : lhs->uploadRate) > (seeding ? rhs->downloadRate : rhs->uploadRate);
+    });
+    for(size_t i = 0; i < std::min(slots_, interested.size()); ++i)
+    {
+        interested[i]->unchoked = true;
+    }
+
+    auto current = std::find_if(candidates.begin(), candidates.end(), [this](const Candidate& candidate) {
+        return candidate.session == optimistic_;
+    });
+    // оптимистичный пир, попавший в число лучших, больше не занимает оптимистичное место
+    if(now >= nextOptimistic_ || current == candidates.end() || !current->interested || current->unchoked)
+    {
+        PickOptimistic(candidates);
+        nextOptimistic_ = now + OPTIMISTIC_PERIOD;
+    }
+    else
+    {
+        current->unchoked = true;
+    }
+}
+
+void Choker::FillSlots(std::vector<Candidate>& candidates, Clock::time_point now)
+{
+    // оптимистичного пира узнаем по номеру соединения, а не по состоянию choke: разчок, который еще не дошел
+    // до соединения, не должен отдавать его место другому пиру до следующей смены
+    auto current = std::find_if(candidates.begin(), candidates.end(), [this](const Candidate& candidate) {
+        return candidate.session == optimistic_;
+    });
+    bool optimisticAlive = current != candidates.end() && current->interested;
+    if(optimisticAlive)
+    {
+        current->unchoked = true;
+    }
+
+    size_t used = 0;
+    for(const auto& candidate : candidates)
+    {
+        if(candidate.session != optimistic_ && candidate.interested && candidate.unchoked)
+        {
+            ++used;
+        }
+    }
+
+    for(auto& candidate : candidates)
+    {
+        if(used >= slots_) break;
+        if(candidate.interested && !candidate.unchoked)
+        {
+            candidate.unchoked = true;
+            ++used;
+        }
+    }
+
+    if(!optimisticAlive)
+    {
+        PickOptimistic(candidates);
+        nextOptimistic_ = now + OPTIMISTIC_PERIOD;
+    }
+}
+
+bool Choker::RechokeDue(Clock::time_point now) const
+{
+    return now >= nextRechoke_;
+}
+
+void Choker::PickOptimistic(std::vector<Candidate>& candidates)
+{
+    std::vector<Candidate*> choked;
+    Candidate* previous = nullptr;
+    for(auto& candidate : candidates)
+    {
+        if(!candidate.interested || candidate.unchoked) continue;
+        if(candidate.session == optimistic_)
+        {
+            previous = &candidate;
+            continue;
+        }
+        choked.push_back(&candidate);
+    }
+    // прежний оптимистичный пир остается, только если больше выбрать некого
+    if(choked.empty() && previous)
+    {
+        choked.push_back(previous);
+    }
+
+    if(choked.empty())
+    {
+        optimistic_.reset();
+        return;
+    }
+    Candidate* chosen = choked[std::uniform_int_distribution<size_t>(0, choked.size() - 1)(random_)];
+    chosen->unchoked = true;
+    optimistic_ = chosen->session;
+}
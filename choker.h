@@ -0,0 +1,71 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <random>
+#include <vector>
+
+/*
+ * Кому из пиров отдавать данные (choking, tit-for-tat).
+ * Раз в `REGULAR_PERIOD` пиры, которым нужны наши части, ранжируются: пока мы качаем -- по скорости, с которой они
+ * отдают данные нам, на раздаче -- по скорости, с которой мы отдаем данные им. Первые `slots` из них разчокиваются,
+ * остальные чокаются. Еще один пир -- оптимистичный -- разчокивается вне очереди и меняется раз в
+ * `OPTIMISTIC_PERIOD`: так новые пиры, которые нам еще ничего не отдали, получают шанс показать свою скорость.
+ * Между пересчетами свободные места (например, пир потерял интерес или отключился) занимают пиры,
+ * которые только что сообщили об интересе, -- не дожидаясь следующего пересчета.
+ * Чокер не потокобезопасен: его владелец (DownloadManager) обращается к нему под своей блокировкой
+ * https://www.bittorrent.org/beps/bep_0003.html#choking-and-optimistic-unchoking
+ */
+class Choker {
+public:
+    using Clock = std::chrono::steady_clock;
+    using SessionId = uint64_t;  // номер соединения, не повторяется за время работы
+
+    /*
+     * Соединение с пиром, как его видит чокер
+     */
+    struct Candidate {
+        SessionId session;
+        bool interested;  // пиру нужны наши части
+        double downloadRate;  // сколько байт в секунду пир отдает нам
+        double uploadRate;  // сколько байт в секунду мы отдаем пиру
+        bool unchoked;  // на входе -- текущее состояние, на выходе -- решение чокера
+    };
+
+    /*
+     * slots -- сколько пиров разчокивать по скорости, не считая оптимистичного
+     */
+    explicit Choker(size_t slots = DEFAULT_SLOTS);
+
+    /*
+     * Полный пересчет: выбрать лучших пиров и, если пора, сменить оптимистичного. seeding -- все части уже скачаны
+     */
+    void Rechoke(std::vector<Candidate>& candidates, bool seeding, Clock::time_point now = Clock::now());
+
+    /*
+     * Отдать свободные места заинтересованным пирам, не трогая уже разчокнутых
+     */
+    void FillSlots(std::vector<Candidate>& candidates, Clock::time_point now = Clock::now());
+
+    /*
+     * Пора ли делать полный пересчет
+     */
+    bool RechokeDue(Clock::time_point now = Clock::now()) const;
+
+    static constexpr size_t DEFAULT_SLOTS = 4;
+    static constexpr std::chrono::seconds REGULAR_PERIOD{10};
+    static constexpr std::chrono::seconds OPTIMISTIC_PERIOD{30};
+private:
+    const size_t slots_;
+    std::optional<SessionId> optimistic_;  // текущий оптимистичный пир; соединение может уже не существовать
+    Clock::time_point nextRechoke_;
+    Clock::time_point nextOptimistic_;
+    std::mt19937 random_;
+
+    /*
+     * Выбрать нового оптимистичного пира среди заинтересованных и зачоканных
+     */
+    void PickOptimistic(std::vector<Candidate>& candidates);
+};
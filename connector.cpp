@@ -0,0 +1,122 @@
+#include "connector.h"
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+Connector::Connector(EventLoop& loop, size_t maxHalfOpen, std::chrono::milliseconds timeout)
+: loop_(loop)
+, maxHalfOpen_(std::max<size_t>(maxHalfOpen, 1))
+, timeout_(timeout)
+, nextAttempt_(0)
+{
+}
+
+Connector::~Connector()
+{
+    for(auto& [id, attempt] : attempts_)
+    {
+        loop_.CancelTimer(attempt.timer);
+    }
+}
+
+void Connector::Connect(const Peer& peer, Callback onDone)
+{
+    queue_.emplace_back(peer, std::move(onDone));
+    // даже немедленный отказ сообщается из цикла: владелец может звать `Connect` под своей блокировкой
+    loop_.Post([this] { StartQueued(); });
+}
+
+void Connector::CancelAll()
+{
+    auto queue = std::move(queue_);
+    queue_.clear();
+    for(auto& [peer, onDone] : queue)
+    {
+        onDone(peer, -1);
+    }
+
+    std::vector<uint64_t> ids;
+    for(auto& [id, attempt] : attempts_)
+    {
+        ids.push_back(id);
+    }
+    for(uint64_t id : ids)
+    {
+        Complete(id, false);
+    }
+}
+
+size_t Connector::HalfOpenCount() const
+{
+    return attempts_.size();
+}
+
+size_t Connector::QueuedCount() const
+{
+    return queue_.size();
+}
+
+void Connector::StartQueued()
+{
+    while(attempts_.size() < maxHalfOpen_ && !queue_.empty())
+    {
+        auto [peer, onDone] = std::move(queue_.front());
+        queue_.pop_front();
+
+        auto socket = std::make_unique<TcpConnect>(peer, timeout_, timeout_);
+        bool connected = false;
+        try
+        {
+            connected = socket->StartConnect();
+        } catch(const std::exception& e)
+        {
+            std::cerr << "Logger: cannot connect to " << peer.ToString() << " -- " << e.what() << std::endl;
+            onDone(peer, -1);
+            continue;
+        }
+
+        uint64_t id = nextAttempt_++;
+        Attempt& attempt = attempts_[id];
+        attempt.socket = std::move(socket);
+        attempt.onDone = std::move(onDone);
+        if(connected)
+        {
+            loop_.Post([this, id] { Complete(id, true); });
+            continue;
+        }
+        attempt.socket->Watch(loop_, EPOLLOUT, [this, id](uint32_t) { Complete(id, true); });
+        attempt.timer = loop_.RunAfter(timeout_, [this, id] {
+            attempts_.at(id).timer = 0;
+            Complete(id, false);
+        });
+    }
+}
+
+void Connector::Complete(uint64_t id, bool ok)
+{
+    auto node = attempts_.extract(id);
+    if(node.empty()) return;
+
+    Attempt& attempt = node.mapped();
+    if(attempt.timer)
+    {
+        loop_.CancelTimer(attempt.timer);
+    }
+    const Peer& peer = attempt.socket->GetPeer();
+    if(ok)
+    {
+        try
+        {
+            attempt.socket->FinishConnect();
+        } catch(const std::exception& e)
+        {
+            std::cerr << "Logger: cannot connect to " << peer.ToString() << " -- " << e.what() << std::endl;
+            ok = false;
+        }
+    }
+
+    // сокет отдается владельцу, а неудачный закрывается вместе с `attempt`
+    int result = ok ? attempt.socket->Release() : -1;
+    attempt.onDone(peer, result);
+    StartQueued();
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "peer.h"
+#include "tcp_connect.h"
+#include "event_loop.h"
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+
+/*
+ * Подключение к пирам веером.
+ * Неблокирующие connect к многим пирам идут одновременно в одном цикле событий, так что недоступные пиры не
+ * задерживают остальных: сотня мертвых адресов стоит одного таймаута, а не сотни подряд. Одновременно полуоткрытых
+ * сокетов не больше `maxHalfOpen` (ядро, NAT и провайдеры плохо переносят лавину SYN), остальные запросы ждут
+ * в очереди. Подключенный сокет сразу отдается владельцу, который передает его соединению с пиром (PeerConnect).
+ * Все методы, как и callback'и, вызываются из потока цикла
+ */
+class Connector {
+public:
+    /*
+     * sock -- подключенный неблокирующий сокет, которым теперь владеет callback, или -1, если подключиться не удалось
+     */
+    using Callback = std::function<void(const Peer& peer, int sock)>;
+
+    /*
+     * maxHalfOpen -- сколько подключений может идти одновременно.
+     * timeout -- сколько ждать завершения одного подключения
+     */
+    Connector(EventLoop& loop, size_t maxHalfOpen = DEFAULT_MAX_HALF_OPEN,
+              std::chrono::milliseconds timeout = DEFAULT_TIMEOUT);
+
+    /*
+     * Закрывает незавершенные подключения, callback'и не вызываются. Удалять из потока цикла или после его остановки
+     */
+    ~Connector();
+
+    Connector(const Connector&) = delete;
+    Connector& operator=(const Connector&) = delete;
+
+    /*
+     * Подключиться к пиру. `onDone` вызывается ровно один раз -- всегда асинхронно, из цикла
+     */
+    void Connect(const Peer& peer, Callback onDone);
+
+    /*
+     * Прервать все подключения, включая ожидающие в очереди: их callback'и получат -1
+     */
+    void CancelAll();
+
+    /*
+     * Сколько подключений идет прямо сейчас и сколько ждет в очереди
+     */
+    size_t HalfOpenCount() const;
+    size_t QueuedCount() const;
+
+    static constexpr size_t DEFAULT_MAX_HALF_OPEN = 64;
+    static constexpr std::chrono::milliseconds DEFAULT_TIMEOUT{500};
+private:
+    /*
+     * Идущее подключение
+     */
+    struct Attempt {
+        std::unique_ptr<TcpConnect> socket;
+        Callback onDone;
+        EventLoop::TimerId timer = 0;
+    };
+
+    EventLoop& loop_;
+    const size_t maxHalfOpen_;
+    const std::chrono::milliseconds timeout_;
+    std::unordered_map<uint64_t, Attempt> attempts_;  // номер -> подключение. Не дескриптор: он переиспользуется
+    uint64_t nextAttempt_;
+    std::deque<std::pair<Peer, Callback>> queue_;  // ждут, пока освободится место среди полуоткрытых
+
+    /*
+     * Начать подключения из очереди, пока их меньше `maxHalfOpen_`
+     */
+    void StartQueued();
+
+    /*
+     * Подключение `id` завершилось (успешно, если `ok`): отдать сокет владельцу или закрыть его
+     */
+    void Complete(uint64_t id, bool ok);
+};
@@ -0,0 +1,368 @@
+#include "disk_writer.h"
+#include "uring.h"
+#include <unistd.h>
+#include <climits>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+#include <unordered_map>
+
+DiskWriter::DiskWriter(FileStorage& files, size_t threadsCount, size_t maxQueuedBytes, bool sync, Backend backend, BufferPool& pool,
+                       size_t regionBufferSize, size_t regionBuffers)
+: files_(files)
+, maxQueuedBytes_(maxQueuedBytes)
+, sync_(sync)
+, backend_(backend)
+, pool_(pool)
+, region_{nullptr, 0}
+, queuedBytes_(0)
+, busyThreads_(0)
+, stopping_(false)
+{
+    if(backend_ == Backend::IoUring && regionBufferSize > 0)
+    {
+        // буферы частей, которые качаются и ждут записи, должны попасть в регион, зарегистрированный в io_uring
+        region_ = pool_.ReserveRegion(regionBufferSize, regionBuffers);
+    }
+    for(size_t i = 0; i < std::max<size_t>(threadsCount, 1); ++i)
+    {
+        threads_.emplace_back([this] { WorkerLoop(); });
+    }
+}
+
+DiskWriter::~DiskWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    hasWork_.notify_all();
+    for(auto& thread : threads_)
+    {
+        thread.join();
+    }
+    // кольца с регистрацией региона закрылись вместе с потоками
+    pool_.ReleaseRegion(region_);
+}
+
+void DiskWriter::Write(uint64_t offset, std::string_view data, Completion done)
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        // запрос больше всей очереди пропускаем, когда она пуста, иначе он не попадет в нее никогда
+        hasSpace_.wait(lock, [&] {
+            return queuedBytes_ == 0 || queuedBytes_ + data.size() <= maxQueuedBytes_;
+        });
+        queue_.push_back({offset, data, std::move(done)});
+        queuedBytes_ += data.size();
+    }
+    hasWork_.notify_one();
+}
+
+void DiskWriter::Drain()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_.wait(lock, [this] { return queue_.empty() && busyThreads_ == 0; });
+}
+
+std::unique_ptr<IoUring> DiskWriter::MakeRing() const
+{
+    if(backend_ != Backend::IoUring) return nullptr;
+
+    try
+    {
+        auto ring = std::make_unique<IoUring>(URING_ENTRIES);
+        // только свой регион: память чужого могут освободить и отдать под обычный буфер, пока кольцо живо
+        if(!region_.data || !ring->RegisterBuffers({region_}))
+        {
+            std::cerr << "Logger: io_uring works without registered buffers" << std::endl;
+        }
+        return ring;
+    } catch(const std::exception& e)
+    {
+        std::cerr << "Logger: io_uring is unavailable, falling back to pwritev -- " << e.what() << std::endl;
+        return nullptr;
+    }
+}
+
+void DiskWriter::WorkerLoop()
+{
+    auto ring = MakeRing();
+
+    std::vector<Request> batch;
+    std::vector<Run> runs;
+    std::vector<FileWrite> writes;
+    std::vector<iovec> iov;
+    std::vector<bool> runOk;
+    std::vector<bool> written;
+    while(true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            hasWork_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+            if(queue_.empty()) return;  // stopping_ и все записано
+            batch.swap(queue_);
+            ++busyThreads_;
+        }
+
+        std::sort(batch.begin(), batch.end(), [](const Request& lhs, const Request& rhs) {
+            return lhs.offset < rhs.offset;
+        });
+        written.assign(batch.size(), false);
+
+        PlanBatch(batch, runs, writes, iov);
+        runOk.assign(runs.size(), true);
+        if(ring)
+        {
+            WriteFiles(*ring, writes, iov, runOk);
+        }
+        else
+        {
+            WriteFiles(writes, iov, runOk);
+        }
+        for(const auto& run : runs)
+        {
+            std::fill(written.begin() + run.begin, written.begin() + run.end, runOk[&run - runs.data()]);
+        }
+
+        size_t batchBytes = 0;
+        for(size_t i = 0; i < batch.size(); ++i)
+        {
+            batchBytes += batch[i].data.size();
+            batch[i].done(written[i]);
+        }
+        batch.clear();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queuedBytes_ -= batchBytes;
+            --busyThreads_;
+        }
+        hasSpace_.notify_all();
+        idle_.notify_all();
+    }
+}
+
+namespace {
+constexpr uint64_t SYNC_FLAG = uint64_t(1) << 63;  // в user_data операции синхронизации лежит номер файла с этим флагом
+}
+
+void DiskWriter::PlanBatch(const std::vector<Request>& batch, std::vector<Run>& runs, std::vector<FileWrite>& writes,
+                           std::vector<iovec>& iov) const
+{
+    runs.clear();
+    for(size_t i = 0; i < batch.size(); ++i)
+    {
+        if(runs.empty() || runs.back().offset + runs.back().length != batch[i].offset || i - runs.back().begin >= IOV_MAX)
+        {
+            runs.push_back({i, i, batch[i].offset, 0});
+        }
+        runs.back().end = i + 1;
+        runs.back().length += batch[i].data.size();
+    }
+
+    // участок режется по границам файлов, при этом один запрос может попасть в несколько кусков
+    writes.clear();
+    iov.clear();
+    std::vector<FileStorage::Segment> segments;
+    for(size_t r = 0; r < runs.size(); ++r)
+    {
+        segments.clear();
+        files_.MapRange(runs[r].offset, runs[r].length, segments);
+
+        size_t request = runs[r].begin;
+        size_t used = 0;  // сколько байт текущего запроса уже разложено по кускам
+        for(const auto& segment : segments)
+        {
+            FileWrite write{r, segment.file, segment.offset, segment.length, iov.size(), 0};
+            for(size_t need = segment.length; need > 0;)
+            {
+                std::string_view data = batch[request].data;
+                size_t take = std::min(need, data.size() - used);
+                iov.push_back({const_cast<char*>(data.data()) + used, take});
+                used += take;
+                need -= take;
+                if(used == data.size())
+                {
+                    ++request;
+                    used = 0;
+                }
+            }
+            write.iovCount = iov.size() - write.iovBegin;
+            writes.push_back(write);
+        }
+    }
+}
+
+void DiskWriter::WriteFiles(const std::vector<FileWrite>& writes, const std::vector<iovec>& iov, std::vector<bool>& runOk)
+{
+    for(size_t first = 0, last; first < writes.size(); first = last)
+    {
+        last = first;
+        while(last < writes.size() && writes[last].file == writes[first].file)
+        {
+            ++last;
+        }
+
+        try
+        {
+            auto handle = files_.Open(writes[first].file);
+            bool fileOk = true;
+            for(size_t i = first; i < last; ++i)
+            {
+                const auto& write = writes[i];
+                if(!WriteChunk(handle.Fd(), iov.data() + write.iovBegin, write.iovCount, write.offset, 0))
+                {
+                    runOk[write.run] = false;
+                }
+            }
+            if(sync_ && fdatasync(handle.Fd()) == -1)
+            {
+                std::cerr << "Logger: fdatasync failed -- " << strerror(errno) << std::endl;
+                fileOk = false;
+            }
+            for(size_t i = first; i < last && !fileOk; ++i)
+            {
+                runOk[writes[i].run] = false;
+            }
+        } catch(const std::exception& e)
+        {
+            std::cerr << "Logger: " << e.what() << std::endl;
+            for(size_t i = first; i < last; ++i)
+            {
+                runOk[writes[i].run] = false;
+            }
+        }
+    }
+}
+
+void DiskWriter::WriteFiles(IoUring& ring, const std::vector<FileWrite>& writes, const std::vector<iovec>& iov,
+                            std::vector<bool>& runOk)
+{
+    std::unordered_map<size_t, FileStorage::FileHandle> handles;  // файлы, в которые идет запись в текущем заходе
+    // файлы, в которые остаток записи дописан уже мимо кольца: fdatasync из кольца мог завершиться раньше
+    std::vector<size_t> resync;
+    auto failFile = [&](size_t file) {
+        for(const auto& write : writes)
+        {
+            if(write.file == file) runOk[write.run] = false;
+        }
+    };
+    auto onComplete = [&](uint64_t userData, int res) {
+        if(userData & SYNC_FLAG)
+        {
+            if(res < 0) failFile(userData & ~SYNC_FLAG);
+            return;
+        }
+        if(userData >= writes.size()) return;
+
+        const auto& write = writes[userData];
+        bool ok = res >= 0;
+        if(ok && static_cast<size_t>(res) < write.length)
+        {
+            // ядро записало не все, остаток дописываем сами
+            ok = WriteChunk(handles.at(write.file).Fd(), iov.data() + write.iovBegin, write.iovCount, write.offset, res);
+            if(ok && sync_ && std::find(resync.begin(), resync.end(), write.file) == resync.end())
+            {
+                resync.push_back(write.file);
+            }
+        }
+        else if(!ok)
+        {
+            std::cerr << "Logger: cannot write to disk -- " << strerror(-res) << std::endl;
+        }
+        if(!ok) runOk[write.run] = false;
+    };
+
+    // куски могут не поместиться в кольцо все сразу, тогда они отправляются в несколько заходов
+    size_t next = 0;
+    while(next < writes.size())
+    {
+        unsigned prepared = 0;
+        try
+        {
+            for(; next < writes.size() && ring.SpaceLeft() >= 2; ++next, ++prepared)
+            {
+                const auto& write = writes[next];
+                auto handle = handles.find(write.file);
+                if(handle == handles.end())
+                {
+                    handle = handles.emplace(write.file, files_.Open(write.file)).first;
+                }
+                ring.PrepareWrite(handle->second.Fd(), iov.data() + write.iovBegin, write.iovCount, write.offset, next);
+
+                bool lastOfFile = next + 1 == writes.size() || writes[next + 1].file != write.file;
+                if(sync_ && lastOfFile)
+                {
+                    ring.PrepareDataSync(handle->second.Fd(), SYNC_FLAG | write.file);
+                    ++prepared;
+                }
+            }
+
+            ring.Submit(prepared);
+            for(unsigned reaped = 0; reaped < prepared;)
+            {
+                reaped += ring.Reap(onComplete);
+                if(reaped < prepared)
+                {
+                    ring.Submit(prepared - reaped);
+                }
+            }
+
+            // части считаются сохраненными только после того, как на диск ушел и дописанный остаток
+            for(size_t file : resync)
+            {
+                if(fdatasync(handles.at(file).Fd()) == -1)
+                {
+                    std::cerr << "Logger: fdatasync failed -- " << strerror(errno) << std::endl;
+                    failFile(file);
+                }
+            }
+            resync.clear();
+        } catch(const std::exception& e)
+        {
+            std::cerr << "Logger: " << e.what() << std::endl;
+            std::fill(runOk.begin(), runOk.end(), false);
+            return;
+        }
+        handles.clear();
+    }
+}
+
+bool DiskWriter::WriteChunk(int fd, const iovec* iov, size_t iovCount, uint64_t offset, size_t skip)
+{
+    std::vector<iovec> left(iov, iov + iovCount);
+    offset += skip;
+
+    // pwritev может записать меньше, чем просили: дописываем остаток, сдвигая начало массива iovec
+    size_t first = 0;
+    size_t done = skip;
+    while(true)
+    {
+        while(first < left.size() && done >= left[first].iov_len)
+        {
+            done -= left[first].iov_len;
+            ++first;
+        }
+        if(first == left.size()) return true;
+        left[first].iov_base = static_cast<char*>(left[first].iov_base) + done;
+        left[first].iov_len -= done;
+
+        ssize_t written = left.size() - first == 1
+                ? pwrite(fd, left[first].iov_base, left[first].iov_len, offset)
+                : pwritev(fd, left.data() + first, left.size() - first, offset);
+        if(written <= 0)
+        {
+            if(written < 0 && errno == EINTR)
+            {
+                done = 0;
+                continue;
+            }
+            std::cerr << "Logger: cannot write to disk -- " << strerror(errno) << std::endl;
+            return false;
+        }
+        offset += written;
+        done = written;
+    }
+}
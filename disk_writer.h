@@ -0,0 +1,152 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string_view>
+#include <functional>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <sys/uio.h>
+#include "buffer_pool.h"
+#include "file_storage.h"
+
+class IoUring;
+
+/*
+ * Асинхронная запись на диск.
+ * Сетевые потоки только кладут готовые данные в очередь, а пишут их на диск отдельные потоки через позиционный
+ * `pwritev`, так что медленный диск не останавливает скачивание и потоки не ждут друг друга на одном мьютексе.
+ * Поток записи забирает из очереди сразу все накопившиеся запросы и склеивает запросы к соседним участкам
+ * в одну операцию. Смещения задаются в общем потоке данных торрента: участок, пересекающий границу файлов,
+ * разрезается на куски по файлам (см. FileStorage), и каждый кусок пишется своей операцией.
+ * После записи (и `fdatasync`, если включена синхронизация) для каждого запроса вызывается callback -- данные
+ * уже на диске.
+ * Очередь ограничена по объему: если диск не успевает, `Write` ждет, пока в очереди освободится место.
+ * Вместо `pwritev` можно использовать io_uring (см. IoUring): тогда вся пачка запросов уходит в ядро одним
+ * системным вызовом, а данные из регионов пула буферов пишутся как из зарегистрированных буферов. Если io_uring
+ * недоступен, поток записи молча возвращается к `pwritev`
+ * https://man7.org/linux/man-pages/man2/pwritev.2.html
+ */
+class DiskWriter {
+public:
+    /*
+     * ok -- удалось ли записать данные. Вызывается из потока записи
+     */
+    using Completion = std::function<void(bool ok)>;
+
+    /*
+     * Чем пишутся данные
+     */
+    enum class Backend {
+        Pwrite,
+        IoUring,
+    };
+
+    /*
+     * files -- файлы торрента, в которые идет запись.
+     * threadsCount -- сколько потоков пишут на диск.
+     * maxQueuedBytes -- сколько байт может ждать записи.
+     * sync -- вызывать ли `fdatasync` перед тем, как сообщить о завершении записи.
+     * backend -- чем писать данные.
+     * pool, regionBufferSize, regionBuffers -- для io_uring в `pool` выделяется регион из `regionBuffers` буферов
+     * размером `regionBufferSize`, который регистрируется в кольцах потоков записи (0 -- без региона)
+     */
+    explicit DiskWriter(FileStorage& files, size_t threadsCount = 1, size_t maxQueuedBytes = DEFAULT_MAX_QUEUED_BYTES, bool sync = true,
+                        Backend backend = Backend::Pwrite, BufferPool& pool = BufferPool::Instance(),
+                        size_t regionBufferSize = 0, size_t regionBuffers = 0);
+
+    /*
+     * Дожидается записи всего, что уже в очереди, и отдает регион обратно пулу
+     */
+    ~DiskWriter();
+
+    DiskWriter(const DiskWriter&) = delete;
+    DiskWriter& operator=(const DiskWriter&) = delete;
+
+    /*
+     * Записать `data` по смещению `offset` от начала данных торрента. Данные должны оставаться валидными до вызова `done`
+     */
+    void Write(uint64_t offset, std::string_view data, Completion done);
+
+    /*
+     * Дождаться, пока все поставленные в очередь запросы будут записаны
+     */
+    void Drain();
+
+    static constexpr size_t DEFAULT_MAX_QUEUED_BYTES = 64 << 20;
+    static constexpr unsigned URING_ENTRIES = 256;
+private:
+    struct Request {
+        uint64_t offset;
+        std::string_view data;
+        Completion done;
+    };
+
+    FileStorage& files_;
+    const size_t maxQueuedBytes_;
+    const bool sync_;
+    const Backend backend_;
+    BufferPool& pool_;
+    BufferPool::Region region_;  // регион пула, зарегистрированный в кольцах этого писателя
+    std::mutex mutex_;
+    std::condition_variable hasWork_;
+    std::condition_variable hasSpace_;
+    std::condition_variable idle_;
+    std::vector<Request> queue_;
+    size_t queuedBytes_;  // объем данных в `queue_` и в запросах, которые сейчас пишутся
+    size_t busyThreads_;
+    bool stopping_;
+    std::vector<std::thread> threads_;
+
+    /*
+     * Подряд идущие участки данных из пачки запросов, которые пишутся одной операцией
+     */
+    struct Run {
+        size_t begin;  // номера запросов в пачке
+        size_t end;
+        uint64_t offset;
+        size_t length;
+    };
+
+    /*
+     * Кусок участка, попавший в один файл. Описывается отрезком общего массива iovec
+     */
+    struct FileWrite {
+        size_t run;
+        size_t file;
+        uint64_t offset;  // смещение внутри файла
+        size_t length;
+        size_t iovBegin;
+        size_t iovCount;
+    };
+
+    void WorkerLoop();
+
+    /*
+     * Создать io_uring для текущего потока записи. Возвращает nullptr, если io_uring недоступен
+     */
+    std::unique_ptr<IoUring> MakeRing() const;
+
+    /*
+     * Разбить отсортированную по смещению пачку на участки, а участки -- на куски по файлам
+     */
+    void PlanBatch(const std::vector<Request>& batch, std::vector<Run>& runs, std::vector<FileWrite>& writes,
+                   std::vector<iovec>& iov) const;
+
+    /*
+     * Записать куски. Для участков, которые не удалось записать целиком, в `runOk` выставляется false.
+     * Куски одного файла идут подряд, после последнего из них файл синхронизируется
+     */
+    void WriteFiles(const std::vector<FileWrite>& writes, const std::vector<iovec>& iov, std::vector<bool>& runOk);
+    void WriteFiles(IoUring& ring, const std::vector<FileWrite>& writes, const std::vector<iovec>& iov,
+                    std::vector<bool>& runOk);
+
+    /*
+     * Записать кусок `pwritev`, пропустив первые `skip` байт, которые уже записаны.
+     * Если запись прошла не полностью, дописывает остаток
+     */
+    bool WriteChunk(int fd, const iovec* iov, size_t iovCount, uint64_t offset, size_t skip);
+};
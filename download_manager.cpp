@@ -0,0 +1,379 @@
+#include "download_manager.h"
+#include <iostream>
+#include <memory>
+#include <algorithm>
+#include <optional>
+#include <unistd.h>
+
+DownloadManager::DownloadManager(const TorrentFile& tf, const std::filesystem::path& outputDirectory, std::string selfPeerId,
+                                 size_t maxSessions, size_t loopThreads, DiskWriter::Backend diskBackend,
+                                 size_t pipelineDepth, bool adaptivePipeline, std::chrono::milliseconds peerBackoff,
+                                 size_t maxHalfOpen, size_t uploadSlots)
+: tf_(tf)
+, selfPeerId_(std::move(selfPeerId))
+, maxSessions_(std::max<size_t>(maxSessions, 1))
+, loopThreads_(std::max<size_t>(loopThreads, 1))
+, pipelineDepth_(pipelineDepth)
+, adaptivePipeline_(adaptivePipeline)
+, maxHalfOpen_(maxHalfOpen)
+, pieces_(tf, outputDirectory, diskBackend)
+, pool_(peerBackoff)
+, connecting_(0)
+, nextLoop_(0)
+, nextSession_(0)
+, stopping_(false)
+, choker_(uploadSlots)
+, peerUploadRate_(0)
+, peerDownloadRate_(0)
+{
+}
+
+void DownloadManager::AddPeers(const std::vector<Peer>& peers)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        size_t added = pool_.Add(peers);
+        if(added)
+        {
+            std::cerr << "Logger: " << added << " new peer(s), " << pool_.Size() << " known" << std::endl;
+        }
+        StartSessions();
+    }
+    changed_.notify_all();
+}
+
+void DownloadManager::StartAnnouncing(std::vector<std::vector<std::string>> tiers, int port)
+{
+    if(announcer_) return;
+
+    trackers_ = std::make_unique<TrackerList>(std::move(tiers));
+    announcer_ = std::make_unique<Announcer>(*trackers_, tf_, selfPeerId_, port, [this] { return Stats(); },
+                                             [this](const std::vector<Peer>& peers) { AddPeers(peers); });
+    announcer_->Start();
+}
+
+uint16_t DownloadManager::StartListening(uint16_t port)
+{
+    if(!listener_)
+    {
+        listener_ = std::make_unique<Listener>(port);
+    }
+    return listener_->Port();
+}
+
+void DownloadManager::LimitRate(uint64_t upload, uint64_t download, uint64_t peerUpload, uint64_t peerDownload)
+{
+    uploadLimit_.SetRate(upload);
+    downloadLimit_.SetRate(download);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    peerUploadRate_ = peerUpload;
+    peerDownloadRate_ = peerDownload;
+    for(auto& [id, session] : sessions_)
+    {
+        session.connect->SetRateLimit(peerUpload, peerDownload);
+    }
+}
+
+void DownloadManager::ShareRateLimit(TokenBucket& upload, TokenBucket& download)
+{
+    uploadLimit_.SetParent(&upload);
+    downloadLimit_.SetParent(&download);
+}
+
+bool DownloadManager::Run()
+{
+    if(Finished() && !listener_)
+    {
+        pieces_.CloseOutputFile();
+        return true;
+    }
+
+    bool finished = false;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for(size_t i = 0; i < loopThreads_; ++i)
+        {
+            loops_.emplace_back(std::make_unique<EventLoop>());
+        }
+        connector_ = std::make_unique<Connector>(*loops_.front(), maxHalfOpen_);
+        if(listener_)
+        {
+            // сокет регистрируется в цикле до запуска его потока
+            listener_->Start(*loops_.front(), [this](const Peer& peer, int sock) { OnAccepted(peer, sock); });
+        }
+        for(auto& loop : loops_)
+        {
+            workers_.emplace_back([loop = loop.get()] { loop->Run(); });
+        }
+        StartSessions();
+        lastRechoke_ = std::chrono::steady_clock::now();
+
+        // последняя часть сохраняется в потоке записи, а паузы пиров истекают сами по себе, поэтому проверяем
+        // периодически
+        while(!stopping_)
+        {
+            if(!finished && Finished())
+            {
+                finished = true;
+                if(!listener_) break;
+
+                std::cerr << "Logger: all pieces are saved, seeding" << std::endl;
+                // данные частей сброшены на диск, а раздача читает файлы заново
+                pieces_.CloseOutputFile();
+            }
+            StartSessions();
+            Rechoke(finished);
+            if(!finished && announcer_ && sessions_.size() + ready_.size() < maxSessions_ && !pool_.HasReady())
+            {
+                // пул иссяк: трекеры опрашиваются досрочно, как только позволит их min interval
+                announcer_->RequestAnnounce();
+            }
+            else if(!announcer_ && OutOfPeers())
+            {
+                std::cerr << "Logger: no more peers to download from" << std::endl;
+                break;
+            }
+            changed_.wait_for(lock, POLL_PERIOD);
+        }
+        stopping_ = true;
+        TerminateSessions();
+        loops_.front()->Post([this] { connector_->CancelAll(); });
+        for(auto& [peer, sock] : ready_)
+        {
+            close(sock);
+            pool_.OnDisconnected(peer, false);
+        }
+        ready_.clear();
+        // циклы останавливаем, только когда все соединения вернули свои части и удалены
+        changed_.wait(lock, [this] { return sessions_.empty() && connecting_ == 0; });
+    }
+    changed_.notify_all();
+
+    for(auto& loop : loops_)
+    {
+        loop->Stop();
+    }
+    for(auto& worker : workers_)
+    {
+        worker.join();
+    }
+    workers_.clear();
+    // сокеты подключений отписываются от цикла, поэтому `connector_` удаляется раньше циклов
+    connector_.reset();
+    if(listener_)
+    {
+        listener_->Stop();
+    }
+    loops_.clear();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = false;
+    }
+
+    if(finished)
+    {
+        std::cerr << "Logger: all pieces are saved, closing files" << std::endl;
+        pieces_.CloseOutputFile();
+    }
+    return finished;
+}
+
+void DownloadManager::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+        TerminateSessions();
+    }
+    changed_.notify_all();
+}
+
+bool DownloadManager::Finished() const
+{
+    return pieces_.PiecesSavedToDiscCount() == pieces_.TotalPiecesCount();
+}
+
+size_t DownloadManager::ActiveSessionsCount() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return sessions_.size();
+}
+
+PieceStorage& DownloadManager::Storage()
+{
+    return pieces_;
+}
+
+AnnounceStats DownloadManager::Stats() const
+{
+    return AnnounceStats{pieces_.UploadedBytes(), pieces_.DownloadedBytes(), pieces_.BytesLeft()};
+}
+
+size_t DownloadManager::PeersCount(PeerPool::State state) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pool_.Count(state);
+}
+
+void DownloadManager::StartSessions()
+{
+    while(!stopping_ && sessions_.size() < maxSessions_ && !ready_.empty())
+    {
+        auto [peer, sock] = ready_.front();
+        ready_.pop_front();
+        StartSession(peer, sock);
+    }
+
+    // подключаемся с запасом: часть подключений к пирам из пула обычно не удается. На раздаче пиры подключаются сами
+    while(!stopping_ && connector_ && !Finished() && connecting_ < maxHalfOpen_ && sessions_.size() + ready_.size() < maxSessions_)
+    {
+        std::optional<Peer> next = pool_.Next();
+        if(!next) break;
+
+        ++connecting_;
+        loops_.front()->Post([this, peer = *next] {
+            connector_->Connect(peer, [this](const Peer& peer, int sock) { OnConnected(peer, sock); });
+        });
+    }
+}
+
+void DownloadManager::OnConnected(const Peer& peer, int sock)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        --connecting_;
+        if(sock < 0)
+        {
+            pool_.OnDisconnected(peer, !stopping_);
+        }
+        else if(stopping_)
+        {
+            close(sock);
+            pool_.OnDisconnected(peer, false);
+        }
+        else
+        {
+            ready_.emplace_back(peer, sock);
+        }
+        StartSessions();
+    }
+    changed_.notify_all();
+}
+
+void DownloadManager::OnAccepted(const Peer& peer, int sock)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(stopping_ || sessions_.size() >= maxSessions_)
+    {
+        std::cerr << "Logger: rejecting connection from " << peer.ToString() << ", no free slots" << std::endl;
+        close(sock);
+        return;
+    }
+    std::cerr << "Logger: accepted connection from " << peer.ToString() << std::endl;
+    StartSession(peer, sock, true);
+}
+
+void DownloadManager::StartSession(const Peer& peer, int sock, bool inbound)
+{
+    auto connect = std::make_unique<PeerConnect>(peer, tf_, selfPeerId_, pieces_, pipelineDepth_, adaptivePipeline_);
+    connect->AdoptSocket(sock, inbound);
+    connect->LimitRate(uploadLimit_, downloadLimit_);
+    connect->SetRateLimit(peerUploadRate_, peerDownloadRate_);
+    PeerConnect* session = connect.get();
+    SessionId id = nextSession_++;
+    EventLoop* loop = loops_[nextLoop_++ % loops_.size()].get();
+    sessions_.emplace(id, Session{peer, std::move(connect), inbound, loop});
+
+    loop->Post([this, session, id, loop] {
+        session->Start(*loop, [this, id] { OnSessionFinished(id); });
+    });
+}
+
+void DownloadManager::OnSessionFinished(SessionId id)
+{
+    // соединение удаляется уже без блокировки
+    std::unique_ptr<PeerConnect> finished;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto node = sessions_.extract(id);
+        finished = std::move(node.mapped().connect);
+        if(!node.mapped().inbound)
+        {
+            pool_.OnDisconnected(node.mapped().peer, finished->Failed());
+        }
+        StartSessions();
+    }
+    changed_.notify_all();
+}
+
+void DownloadManager::Rechoke(bool seeding)
+{
+    auto now = std::chrono::steady_clock::now();
+    bool full = choker_.RechokeDue(now);
+    double elapsed = std::chrono::duration<double>(now - lastRechoke_).count();
+
+    std::vector<Choker::Candidate> candidates;
+    candidates.reserve(sessions_.size());
+    for(auto& [id, session] : sessions_)
+    {
+        PeerConnect* connect = session.connect.get();
+        if(full)
+        {
+            uint64_t downloaded = connect->DownloadedBytes();
+            uint64_t uploaded = connect->UploadedBytes();
+            session.downloadRate = elapsed > 0 ? (downloaded - session.downloaded) / elapsed : 0;
+            session.uploadRate = elapsed > 0 ? (uploaded - session.uploaded) / elapsed : 0;
+            session.downloaded = downloaded;
+            session.uploaded = uploaded;
+        }
+        candidates.push_back({id, connect->PeerInterested(), session.downloadRate, session.uploadRate,
+                              !connect->PeerChoked()});
+    }
+    if(full)
+    {
+        choker_.Rechoke(candidates, seeding, now);
+        lastRechoke_ = now;
+    }
+    else
+    {
+        choker_.FillSlots(candidates, now);
+    }
+
+    for(const auto& candidate : candidates)
+    {
+        // решение сверяется с состоянием соединения при каждом вызове, поэтому то, что соединение не успело
+        // применить, будет отправлено еще раз
+        const Session& session = sessions_.at(candidate.session);
+        if(candidate.unchoked != session.connect->PeerChoked()) continue;
+
+        EventLoop* loop = session.loop;
+        loop->Post([this, id = candidate.session, loop, choke = !candidate.unchoked] {
+            PeerConnect* connect;
+            {
+                // номера соединений не повторяются, поэтому задача, опоздавшая к своему соединению, не достанется
+                // новому соединению по тому же адресу. Соединение удаляется только в потоке своего цикла:
+                // если оно еще в `sessions_`, то живо до конца задачи
+                std::lock_guard<std::mutex> lock(mutex_);
+                auto it = sessions_.find(id);
+                if(it == sessions_.end() || it->second.loop != loop) return;
+                connect = it->second.connect.get();
+            }
+            connect->SetPeerChoked(choke);
+        });
+    }
+}
+
+void DownloadManager::TerminateSessions()
+{
+    for(auto& [id, session] : sessions_)
+    {
+        session.connect->Terminate();
+    }
+}
+
+bool DownloadManager::OutOfPeers() const
+{
+    // части, которые никто не качает, но которые еще не сохранены, сейчас пишутся на диск -- ждем их
+    return !listener_ && !pool_.HasReady() && sessions_.empty() && connecting_ == 0 && ready_.empty() && !pieces_.QueueIsEmpty();
+}
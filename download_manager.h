@@ -0,0 +1,233 @@
+#pragma once
+
+#include "peer.h"
+#include "peer_connect.h"
+#include "piece_storage.h"
+#include "torrent_file.h"
+#include "disk_writer.h"
+#include "request_pipeline.h"
+#include "event_loop.h"
+#include "peer_pool.h"
+#include "tracker_list.h"
+#include "announcer.h"
+#include "connector.h"
+#include "listener.h"
+#include "choker.h"
+#include "token_bucket.h"
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <filesystem>
+#include <chrono>
+
+/*
+ * Скачивание торрента сразу у нескольких пиров.
+ * Менеджер владеет PieceStorage и держит до `maxSessions` соединений с пирами одновременно. Соединения -- корутины
+ * (см. PeerConnect), которые распределяются по кругу между `loopThreads` потоками с циклами событий, так что
+ * тысяча соединений не требует тысячи потоков. Пока есть свободные места для соединений, подключения идут
+ * веером через Connector -- до `maxHalfOpen` одновременно, даже если свободно одно место, -- и место занимают только
+ * те пиры, к которым удалось подключиться: недоступные пиры не задерживают начало скачивания. Лишние подключенные
+ * сокеты ждут, пока освободится место. Когда соединение закончилось, на его место берется следующий пир
+ * из пула (см. PeerPool): сначала новые пиры, потом те, чья пауза после прошлого соединения истекла. Пиры,
+ * соединения с которыми раз за разом обрываются с ошибкой, блокируются.
+ * Если запущены анонсы (`StartAnnouncing`), новые пиры от трекеров приходят в пул в фоне всё время скачивания,
+ * а когда подключаться не к кому, трекеры опрашиваются досрочно.
+ * Если принимаются входящие соединения (`StartListening`), пиры подключаются и сами, а после скачивания менеджер
+ * остается на раздаче: новых подключений к пирам не начинает, но отвечает на запросы до вызова `Stop`.
+ * Данные пирам отдаются по правилам чокера (см. Choker): пока качаем -- тем, кто больше всех отдает нам, на
+ * раздаче -- тем, кто быстрее всех забирает, плюс одному оптимистичному пиру.
+ * Скорость можно ограничить (`LimitRate`) на трех уровнях: общие корзины всех торрентов -> торрент -> соединение
+ * (см. TokenBucket).
+ * Иначе, как только последняя часть сохранена на диск, все соединения завершаются, потоки пула останавливаются,
+ * а файлы закрываются. `Run` возвращается только после завершения всех соединений и остановки потоков циклов
+ */
+class DownloadManager {
+public:
+    /*
+     * maxSessions -- сколько соединений с пирами держать одновременно.
+     * loopThreads -- сколько потоков с циклами событий обслуживают соединения.
+     * diskBackend -- чем писать части на диск (см. PieceStorage).
+     * pipelineDepth, adaptivePipeline -- настройки очереди запросов каждого соединения (см. PeerConnect).
+     * peerBackoff -- пауза перед повторным подключением к пиру (см. PeerPool).
+     * maxHalfOpen -- сколько подключений к пирам может идти одновременно (см. Connector)
+     */
+    DownloadManager(const TorrentFile& tf, const std::filesystem::path& outputDirectory, std::string selfPeerId,
+                    size_t maxSessions = DEFAULT_MAX_SESSIONS, size_t loopThreads = DEFAULT_LOOP_THREADS,
+                    DiskWriter::Backend diskBackend = DiskWriter::Backend::Pwrite,
+                    size_t pipelineDepth = RequestPipeline::DEFAULT_DEPTH, bool adaptivePipeline = true,
+                    std::chrono::milliseconds peerBackoff = PeerPool::DEFAULT_BASE_BACKOFF,
+                    size_t maxHalfOpen = Connector::DEFAULT_MAX_HALF_OPEN,
+                    size_t uploadSlots = Choker::DEFAULT_SLOTS);
+
+    DownloadManager(const DownloadManager&) = delete;
+    DownloadManager& operator=(const DownloadManager&) = delete;
+
+    /*
+     * Добавить пиров в пул (например, из ответа трекера). Уже известные пиры пропускаются.
+     * Можно вызывать из другого потока во время `Run`
+     */
+    void AddPeers(const std::vector<Peer>& peers);
+
+    /*
+     * Запустить фоновые анонсы трекерам из `tiers` (см. `TorrentFile::AnnounceTiers`): трекерам сообщается
+     * настоящая статистика скачивания, а их пиры добавляются в пул. port -- порт, на котором мы принимаем соединения.
+     * Анонсы идут, пока жив менеджер
+     */
+    void StartAnnouncing(std::vector<std::vector<std::string>> tiers, int port);
+
+    /*
+     * Принимать входящие соединения от пиров на `port` (0 -- любой свободный порт) и раздавать после скачивания.
+     * Соединения принимаются, пока идет `Run`. Возвращает порт, который стоит сообщать трекерам.
+     * Бросает исключение, если порт занят
+     */
+    uint16_t StartListening(uint16_t port);
+
+    /*
+     * Ограничить скорость отдачи и скачивания торрента и каждого его соединения, байт/с (0 -- без ограничения).
+     * Можно вызывать из другого потока во время `Run`: новые ограничения действуют и на активные соединения
+     */
+    void LimitRate(uint64_t upload, uint64_t download, uint64_t peerUpload = 0, uint64_t peerDownload = 0);
+
+    /*
+     * Делить скорость с другими торрентами: ограничения торрента вкладываются в общие корзины `upload` и `download`,
+     * которые должны пережить менеджер. Вызывается до `Run`
+     */
+    void ShareRateLimit(TokenBucket& upload, TokenBucket& download);
+
+    /*
+     * Качать, пока все части не будут сохранены на диск или пока не закончатся пиры. Пока идут анонсы или
+     * принимаются входящие соединения, пиры не заканчиваются: `Run` ждет новых пиров. Если запущена раздача,
+     * после скачивания `Run` продолжает раздавать, пока не вызван `Stop`.
+     * Возвращает true, если торрент скачан целиком (тогда файлы уже закрыты). Если вернулось false, можно добавить
+     * новых пиров через `AddPeers` и вызвать `Run` еще раз
+     */
+    bool Run();
+
+    /*
+     * Прервать `Run` из другого потока: завершить все соединения, не дожидаясь конца скачивания
+     */
+    void Stop();
+
+    /*
+     * Все части сохранены на диск
+     */
+    bool Finished() const;
+
+    /*
+     * Сколько соединений с пирами активно прямо сейчас
+     */
+    size_t ActiveSessionsCount() const;
+
+    PieceStorage& Storage();
+
+    /*
+     * Статистика для анонса трекеру
+     */
+    AnnounceStats Stats() const;
+
+    /*
+     * Сколько известно пиров в состоянии `state`
+     */
+    size_t PeersCount(PeerPool::State state) const;
+
+    static constexpr size_t DEFAULT_MAX_SESSIONS = 50;
+    static constexpr size_t DEFAULT_LOOP_THREADS = 2;
+    static constexpr std::chrono::milliseconds POLL_PERIOD{100};  // как часто проверять, не сохранена ли последняя часть и не истекли ли паузы пиров
+private:
+    const TorrentFile& tf_;
+    const std::string selfPeerId_;
+    const size_t maxSessions_;
+    const size_t loopThreads_;
+    const size_t pipelineDepth_;
+    const bool adaptivePipeline_;
+    const size_t maxHalfOpen_;
+    PieceStorage pieces_;
+
+    using SessionId = Choker::SessionId;
+
+    /*
+     * Соединение с пиром
+     */
+    struct Session {
+        Peer peer;
+        std::unique_ptr<PeerConnect> connect;
+        bool inbound;  // пир подключился сам, его адреса нет в пуле
+        EventLoop* loop;  // цикл, в котором работает соединение
+        uint64_t downloaded = 0;  // счетчики соединения на момент прошлого пересчета чокера
+        uint64_t uploaded = 0;
+        double downloadRate = 0;  // скорости за время между двумя последними пересчетами, байт/с
+        double uploadRate = 0;
+    };
+
+    mutable std::mutex mutex_;
+    std::condition_variable changed_;  // в пуле появились пиры, завершилось соединение или пора остановиться
+    PeerPool pool_;  // все известные пиры
+    std::unordered_map<SessionId, Session> sessions_;  // активные соединения по номерам
+    std::vector<std::unique_ptr<EventLoop>> loops_;  // циклы событий, пока идет `Run`
+    std::vector<std::thread> workers_;  // потоки, в которых крутятся `loops_`
+    std::unique_ptr<Connector> connector_;  // подключения к пирам, пока идет `Run`; работает в первом из `loops_`
+    size_t connecting_;  // сколько пиров отдано `connector_` и еще не подключено
+    std::deque<std::pair<Peer, int>> ready_;  // подключенные сокеты, которым еще не нашлось места среди соединений
+    size_t nextLoop_;  // в какой цикл отдать следующее соединение
+    SessionId nextSession_;  // номер следующего соединения; номера не повторяются, в отличие от адресов PeerConnect
+    bool stopping_;
+    Choker choker_;
+    TokenBucket uploadLimit_;  // ограничения скорости торрента
+    TokenBucket downloadLimit_;
+    uint64_t peerUploadRate_;  // ограничения скорости каждого соединения
+    uint64_t peerDownloadRate_;
+    std::chrono::steady_clock::time_point lastRechoke_;  // когда чокер последний раз пересчитывал скорости
+    std::unique_ptr<Listener> listener_;  // входящие соединения, если запущена раздача; работает в первом из `loops_`
+    std::unique_ptr<TrackerList> trackers_;
+    std::unique_ptr<Announcer> announcer_;  // объявлен последним: его поток останавливается первым
+
+    /*
+     * Начать соединения с уже подключенными пирами из `ready_`, пока их меньше `maxSessions_`, и подключения
+     * к пирам из пула, если места еще остались. Вызывается под `mutex_`
+     */
+    void StartSessions();
+
+    /*
+     * Начать соединение по подключенному сокету. Вызывается под `mutex_`
+     */
+    void StartSession(const Peer& peer, int sock, bool inbound = false);
+
+    /*
+     * Пир подключился к нам (вызывается из потока `listener_`): начать с ним соединение, если есть место
+     */
+    void OnAccepted(const Peer& peer, int sock);
+
+    /*
+     * Подключение к пиру завершилось (вызывается из потока `connector_`): начать с ним соединение, когда будет место.
+     * sock -- подключенный сокет или -1
+     */
+    void OnConnected(const Peer& peer, int sock);
+
+    /*
+     * Соединение завершилось (вызывается из потока его цикла): удалить его и взять на его место следующего пира
+     */
+    void OnSessionFinished(SessionId id);
+
+    /*
+     * Отдать решения чокера соединениям: раз в `Choker::REGULAR_PERIOD` -- полный пересчет по скоростям,
+     * в остальное время -- только занять свободные места. seeding -- все части скачаны. Вызывается под `mutex_`
+     */
+    void Rechoke(bool seeding);
+
+    /*
+     * Завершить все активные соединения. Вызывается под `mutex_`
+     */
+    void TerminateSessions();
+
+    /*
+     * Подключиться сейчас не к кому, активных соединений и подключений нет, а части еще остались.
+     * С входящими соединениями пиры не кончаются никогда.
+     * Вызывается под `mutex_`
+     */
+    bool OutOfPeers() const;
+};
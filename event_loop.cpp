@@ -0,0 +1,204 @@
+#include "event_loop.h"
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <algorithm>
+
+namespace {
+constexpr size_t MAX_EVENTS_PER_ITERATION = 256;
+constexpr uint64_t WAKEUP_TOKEN = 0;
+}
+
+EventLoop::EventLoop()
+: epoll_(epoll_create1(EPOLL_CLOEXEC))
+, wakeup_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+, stopped_(false)
+, nextToken_(WAKEUP_TOKEN + 1)
+, nextTimer_(1)
+, events_(MAX_EVENTS_PER_ITERATION)
+{
+    if(epoll_ == -1 || wakeup_ == -1)
+    {
+        throw std::runtime_error(std::string("Error: cannot create event loop: ") + strerror(errno));
+    }
+
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.u64 = WAKEUP_TOKEN;
+    if(epoll_ctl(epoll_, EPOLL_CTL_ADD, wakeup_, &event) == -1)
+    {
+        throw std::runtime_error(std::string("Error: cannot watch eventfd: ") + strerror(errno));
+    }
+}
+
+EventLoop::~EventLoop()
+{
+    close(wakeup_);
+    close(epoll_);
+}
+
+void EventLoop::Add(int fd, uint32_t events, Callback callback)
+{
+    uint64_t token = nextToken_++;
+
+    epoll_event event{};
+    event.events = events;
+    event.data.u64 = token;
+    if(epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &event) == -1)
+    {
+        throw std::runtime_error(std::string("Error: cannot add fd to epoll: ") + strerror(errno));
+    }
+
+    tokens_[fd] = token;
+    watches_[token] = Watch{fd, std::make_shared<Callback>(std::move(callback))};
+}
+
+void EventLoop::Modify(int fd, uint32_t events)
+{
+    auto it = tokens_.find(fd);
+    if(it == tokens_.end())
+    {
+        throw std::runtime_error("Error: fd is not registered in event loop");
+    }
+
+    epoll_event event{};
+    event.events = events;
+    event.data.u64 = it->second;
+    if(epoll_ctl(epoll_, EPOLL_CTL_MOD, fd, &event) == -1)
+    {
+        throw std::runtime_error(std::string("Error: cannot modify fd in epoll: ") + strerror(errno));
+    }
+}
+
+void EventLoop::Remove(int fd)
+{
+    auto it = tokens_.find(fd);
+    if(it == tokens_.end()) return;
+
+    epoll_ctl(epoll_, EPOLL_CTL_DEL, fd, nullptr);
+    watches_.erase(it->second);
+    tokens_.erase(it);
+}
+
+EventLoop::TimerId EventLoop::RunAfter(std::chrono::milliseconds delay, Task task)
+{
+    TimerId id = nextTimer_++;
+    auto deadline = Clock::now() + delay;
+    timers_.emplace(TimerKey{deadline, id}, std::move(task));
+    timerDeadlines_.emplace(id, deadline);
+    return id;
+}
+
+void EventLoop::CancelTimer(TimerId id)
+{
+    auto it = timerDeadlines_.find(id);
+    if(it == timerDeadlines_.end()) return;
+
+    timers_.erase(TimerKey{it->second, id});
+    timerDeadlines_.erase(it);
+}
+
+void EventLoop::Post(Task task)
+{
+    {
+        std::lock_guard<std::mutex> lock(postedMutex_);
+        posted_.emplace_back(std::move(task));
+    }
+    uint64_t one = 1;
+    [[maybe_unused]] auto written = write(wakeup_, &one, sizeof(one));
+}
+
+void EventLoop::RunOnce(std::chrono::milliseconds timeout)
+{
+    int ready = epoll_wait(epoll_, events_.data(), events_.size(), NextTimeout(timeout));
+
+    if(ready == -1 && errno != EINTR)
+    {
+        throw std::runtime_error(std::string("Error: epoll_wait failed: ") + strerror(errno));
+    }
+
+    for(int i = 0; i < ready; ++i)
+    {
+        uint64_t token = events_[i].data.u64;
+
+        if(token == WAKEUP_TOKEN)
+        {
+            uint64_t counter;
+            [[maybe_unused]] auto read_bytes = read(wakeup_, &counter, sizeof(counter));
+            continue;
+        }
+
+        // подписка могла быть снята callback'ом другого дескриптора на этой же итерации
+        auto it = watches_.find(token);
+        if(it == watches_.end()) continue;
+
+        auto callback = it->second.callback;
+        (*callback)(events_[i].events);
+    }
+
+    RunTimers();
+    RunPosted();
+}
+
+void EventLoop::Run()
+{
+    while(!stopped_)
+    {
+        RunOnce(std::chrono::milliseconds(1000));
+    }
+}
+
+void EventLoop::Stop()
+{
+    stopped_ = true;
+    Post([]{});
+}
+
+size_t EventLoop::WatchedCount() const
+{
+    return watches_.size();
+}
+
+int EventLoop::NextTimeout(std::chrono::milliseconds limit) const
+{
+    {
+        std::lock_guard<std::mutex> lock(postedMutex_);
+        if(!posted_.empty()) return 0;
+    }
+
+    if(timers_.empty()) return limit.count();
+
+    auto left = std::chrono::ceil<std::chrono::milliseconds>(timers_.begin()->first.first - Clock::now());
+    if(left.count() < 0) return 0;
+    return std::min(left, limit).count();
+}
+
+void EventLoop::RunTimers()
+{
+    auto now = Clock::now();
+    while(!timers_.empty() && timers_.begin()->first.first <= now)
+    {
+        auto it = timers_.begin();
+        auto task = std::move(it->second);
+        timerDeadlines_.erase(it->first.second);
+        timers_.erase(it);
+        // задача может завести новые таймеры или отменить еще не сработавшие, поэтому итератор не храним
+        task();
+    }
+}
+
+void EventLoop::RunPosted()
+{
+    std::vector<Task> tasks;
+    {
+        std::lock_guard<std::mutex> lock(postedMutex_);
+        tasks.swap(posted_);
+    }
+    for(auto& task : tasks)
+    {
+        task();
+    }
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <sys/epoll.h>
+#include <cstdint>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <map>
+#include <vector>
+#include <unordered_map>
+#include <utility>
+
+/*
+ * Цикл событий на основе epoll.
+ * Один поток, вызывающий `Run()`, обслуживает произвольное количество неблокирующих сокетов: для каждого
+ * зарегистрированного файлового дескриптора вызывается callback, когда дескриптор готов к чтению или записи.
+ * Кроме того, цикл умеет выполнять отложенные задачи (таймеры) и задачи, переданные из других потоков.
+ * Полезная информация:
+ * - https://man7.org/linux/man-pages/man7/epoll.7.html
+ * - https://man7.org/linux/man-pages/man2/eventfd.2.html
+ */
+class EventLoop {
+public:
+    using Clock = std::chrono::steady_clock;
+    using Callback = std::function<void(uint32_t events)>;  // events -- маска EPOLLIN / EPOLLOUT / EPOLLERR / ...
+    using Task = std::function<void()>;
+    using TimerId = uint64_t;
+
+    EventLoop();
+    ~EventLoop();
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    /*
+     * Зарегистрировать дескриптор `fd` с маской событий `events`.
+     * Все методы, кроме `Post` и `Stop`, должны вызываться из потока цикла (или до его запуска)
+     */
+    void Add(int fd, uint32_t events, Callback callback);
+
+    /*
+     * Поменять маску событий, на которые подписан дескриптор
+     */
+    void Modify(int fd, uint32_t events);
+
+    /*
+     * Отписать дескриптор. Безопасно вызывать из callback'а этого же дескриптора
+     */
+    void Remove(int fd);
+
+    /*
+     * Выполнить `task` в потоке цикла не раньше, чем через `delay`
+     */
+    TimerId RunAfter(std::chrono::milliseconds delay, Task task);
+
+    /*
+     * Отменить таймер. Если таймер уже сработал, ничего не происходит
+     */
+    void CancelTimer(TimerId id);
+
+    /*
+     * Передать задачу на выполнение в поток цикла. Можно вызывать из любого потока
+     */
+    void Post(Task task);
+
+    /*
+     * Одна итерация: дождаться событий не дольше `timeout` и обработать их
+     */
+    void RunOnce(std::chrono::milliseconds timeout);
+
+    /*
+     * Крутить цикл, пока не будет вызван `Stop()`
+     */
+    void Run();
+
+    /*
+     * Остановить `Run()`. Можно вызывать из любого потока
+     */
+    void Stop();
+
+    /*
+     * Сколько дескрипторов сейчас зарегистрировано
+     */
+    size_t WatchedCount() const;
+private:
+    struct Watch {
+        int fd;
+        std::shared_ptr<Callback> callback;  // копируется перед вызовом, чтобы callback мог отписать сам себя
+    };
+    using TimerKey = std::pair<Clock::time_point, TimerId>;  // упорядочены по сроку, при равном сроке -- по порядку создания
+
+    int epoll_;
+    int wakeup_;  // eventfd, которым будим цикл из других потоков
+    std::atomic_bool stopped_;
+    uint64_t nextToken_;
+    std::unordered_map<int, uint64_t> tokens_;  // fd -> токен текущей регистрации
+    std::unordered_map<uint64_t, Watch> watches_;  // токен -> подписка
+    TimerId nextTimer_;
+    // отмененный таймер удаляется сразу, чтобы его срок больше не будил epoll_wait
+    std::map<TimerKey, Task> timers_;
+    std::unordered_map<TimerId, Clock::time_point> timerDeadlines_;  // id -> срок, для отмены
+    mutable std::mutex postedMutex_;
+    std::vector<Task> posted_;
+    std::vector<epoll_event> events_;
+
+    /*
+     * Через сколько миллисекунд сработает ближайший таймер (но не больше `limit`)
+     */
+    int NextTimeout(std::chrono::milliseconds limit) const;
+
+    void RunTimers();
+    void RunPosted();
+};
@@ -0,0 +1,219 @@
+#include "file_storage.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+FileStorage::FileHandle::FileHandle(FileStorage* storage, size_t file, int fd)
+: storage_(storage)
+, file_(file)
+, fd_(fd)
+{}
+
+FileStorage::FileHandle::FileHandle(FileHandle&& other) noexcept
+: storage_(std::exchange(other.storage_, nullptr))
+, file_(other.file_)
+, fd_(std::exchange(other.fd_, -1))
+{}
+
+FileStorage::FileHandle::~FileHandle()
+{
+    if(storage_) storage_->Unpin(file_);
+}
+
+int FileStorage::FileHandle::Fd() const
+{
+    return fd_;
+}
+
+FileStorage::FileStorage(const std::filesystem::path& root, std::vector<TorrentFileEntry> files, size_t maxOpenFiles)
+: root_(root)
+, files_(std::move(files))
+, maxOpenFiles_(std::max<size_t>(maxOpenFiles, 1))
+{
+    starts_.reserve(files_.size());
+    for(const auto& file : files_)
+    {
+        starts_.push_back(file.offset);
+    }
+    if(!std::is_sorted(starts_.begin(), starts_.end()))
+    {
+        throw std::runtime_error("Error: torrent files table is not ordered by offset");
+    }
+}
+
+FileStorage::~FileStorage()
+{
+    for(auto& [file, openFile] : open_)
+    {
+        close(openFile.fd);
+    }
+}
+
+void FileStorage::Prepare()
+{
+    for(const auto& file : files_)
+    {
+        auto path = root_ / file.path;
+        std::filesystem::create_directories(path.parent_path());
+
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        if(fd == -1)
+        {
+            throw std::runtime_error("Error: cannot create file " + path.string() + ": " + strerror(errno));
+        }
+        struct stat info{};
+        bool ok = fstat(fd, &info) == 0 && (static_cast<uint64_t>(info.st_size) == file.length || ftruncate(fd, file.length) == 0);
+        close(fd);
+        if(!ok)
+        {
+            throw std::runtime_error("Error: cannot resize file " + path.string());
+        }
+    }
+}
+
+bool FileStorage::HasExistingData() const
+{
+    return std::any_of(files_.begin(), files_.end(), [this](const TorrentFileEntry& file) {
+        std::error_code error;
+        auto size = std::filesystem::file_size(root_ / file.path, error);
+        return !error && size > 0;
+    });
+}
+
+std::vector<FileStamp> FileStorage::Stamps() const
+{
+    std::vector<FileStamp> stamps;
+    stamps.reserve(files_.size());
+    for(const auto& file : files_)
+    {
+        auto path = root_ / file.path;
+        stamps.push_back(std::filesystem::exists(path) ? FileStamp::Of(path) : FileStamp{});
+        stamps.back().path = file.path;
+    }
+    return stamps;
+}
+
+void FileStorage::MapRange(uint64_t offset, size_t length, std::vector<Segment>& segments) const
+{
+    if(length == 0) return;
+    if(offset + length > TotalLength())
+    {
+        throw std::runtime_error("Error: range is out of torrent data");
+    }
+
+    // последний файл, который начинается не позже `offset` (пустые файлы при этом пропускаются сами собой)
+    size_t file = std::upper_bound(starts_.begin(), starts_.end(), offset) - starts_.begin() - 1;
+    while(length > 0)
+    {
+        const auto& entry = files_[file];
+        uint64_t inFile = offset - entry.offset;
+        size_t chunk = std::min<uint64_t>(length, entry.length - inFile);
+        if(chunk > 0)
+        {
+            segments.push_back({file, inFile, chunk});
+        }
+        offset += chunk;
+        length -= chunk;
+        ++file;
+    }
+}
+
+FileStorage::FileHandle FileStorage::Open(size_t file)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto it = open_.find(file);
+    if(it != open_.end())
+    {
+        lru_.splice(lru_.begin(), lru_, it->second.lru);
+        ++it->second.pins;
+        return FileHandle(this, file, it->second.fd);
+    }
+
+    auto path = root_ / files_[file].path;
+    int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if(fd == -1)
+    {
+        throw std::runtime_error("Error: cannot open file " + path.string() + ": " + strerror(errno));
+    }
+    lru_.push_front(file);
+    open_.emplace(file, OpenFile{fd, 1, lru_.begin()});
+    Evict();
+    return FileHandle(this, file, fd);
+}
+
+bool FileStorage::Read(uint64_t offset, char* data, size_t length)
+{
+    std::vector<Segment> segments;
+    MapRange(offset, length, segments);
+    for(const auto& segment : segments)
+    {
+        auto handle = Open(segment.file);
+        size_t done = 0;
+        while(done < segment.length)
+        {
+            ssize_t got = pread(handle.Fd(), data + done, segment.length - done, segment.offset + done);
+            if(got < 0 && errno == EINTR) continue;
+            if(got <= 0) return false;
+            done += got;
+        }
+        data += segment.length;
+    }
+    return true;
+}
+
+void FileStorage::CloseAll()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for(auto it = open_.begin(); it != open_.end();)
+    {
+        if(it->second.pins > 0)
+        {
+            ++it;
+            continue;
+        }
+        close(it->second.fd);
+        lru_.erase(it->second.lru);
+        it = open_.erase(it);
+    }
+}
+
+const std::vector<TorrentFileEntry>& FileStorage::Files() const
+{
+    return files_;
+}
+
+uint64_t FileStorage::TotalLength() const
+{
+    return files_.empty() ? 0 : files_.back().offset + files_.back().length;
+}
+
+void FileStorage::Unpin(size_t file)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = open_.find(file);
+    if(it != open_.end() && --it->second.pins == 0)
+    {
+        Evict();
+    }
+}
+
+void FileStorage::Evict()
+{
+    // файлы, которыми кто-то пользуется, не закрываем, даже если лимит превышен
+    for(auto it = lru_.end(); open_.size() > maxOpenFiles_ && it != lru_.begin();)
+    {
+        --it;
+        auto openFile = open_.find(*it);
+        if(openFile->second.pins > 0) continue;
+
+        close(openFile->second.fd);
+        open_.erase(openFile);
+        it = lru_.erase(it);
+    }
+}
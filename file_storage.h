@@ -0,0 +1,126 @@
+#pragma once
+
+#include "torrent_file.h"
+#include "resume_data.h"
+#include <sys/uio.h>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <list>
+#include <mutex>
+#include <filesystem>
+#include <unordered_map>
+
+/*
+ * Файлы торрента на диске.
+ * Все файлы торрента идут друг за другом в одном сплошном пространстве смещений, а части нарезаются из этого
+ * пространства без учета границ файлов, так что одна часть может захватывать несколько файлов.
+ * `MapRange` переводит диапазон смещений в список кусков (файл, смещение в файле, длина) двоичным поиском
+ * по началам файлов.
+ * Открытые дескрипторы хранятся в LRU-кеше ограниченного размера: в торренте могут быть десятки тысяч файлов,
+ * и держать открытыми их все нельзя
+ */
+class FileStorage {
+public:
+    /*
+     * Кусок диапазона смещений, попавший в один файл
+     */
+    struct Segment {
+        size_t file;  // номер файла в таблице
+        uint64_t offset;  // смещение внутри файла
+        size_t length;
+    };
+
+    /*
+     * Открытый файл. Пока объект жив, дескриптор не будет закрыт кешем
+     */
+    class FileHandle {
+    public:
+        FileHandle(FileHandle&& other) noexcept;
+        FileHandle(const FileHandle&) = delete;
+        FileHandle& operator=(const FileHandle&) = delete;
+        FileHandle& operator=(FileHandle&&) = delete;
+        ~FileHandle();
+
+        int Fd() const;
+    private:
+        friend class FileStorage;
+        FileHandle(FileStorage* storage, size_t file, int fd);
+
+        FileStorage* storage_;
+        size_t file_;
+        int fd_;
+    };
+
+    /*
+     * root -- каталог, в котором лежат файлы. files -- таблица файлов торрента
+     */
+    FileStorage(const std::filesystem::path& root, std::vector<TorrentFileEntry> files,
+                size_t maxOpenFiles = DEFAULT_MAX_OPEN_FILES);
+    ~FileStorage();
+
+    FileStorage(const FileStorage&) = delete;
+    FileStorage& operator=(const FileStorage&) = delete;
+
+    /*
+     * Создать недостающие файлы и каталоги и выставить файлам их размер. Уже записанные данные не трогаются
+     */
+    void Prepare();
+
+    /*
+     * Есть ли на диске хотя бы один непустой файл торрента
+     */
+    bool HasExistingData() const;
+
+    /*
+     * Отметки о файлах для данных возобновления. Для отсутствующих файлов размер и время равны нулю
+     */
+    std::vector<FileStamp> Stamps() const;
+
+    /*
+     * Разбить диапазон [offset, offset + length) на куски по файлам. Куски добавляются в конец `segments`
+     */
+    void MapRange(uint64_t offset, size_t length, std::vector<Segment>& segments) const;
+
+    /*
+     * Открыть файл (или взять его дескриптор из кеша)
+     */
+    FileHandle Open(size_t file);
+
+    /*
+     * Прочитать диапазон смещений, возможно захватывающий несколько файлов. Возвращает false при ошибке
+     */
+    bool Read(uint64_t offset, char* data, size_t length);
+
+    /*
+     * Закрыть все дескрипторы, которыми сейчас никто не пользуется
+     */
+    void CloseAll();
+
+    const std::vector<TorrentFileEntry>& Files() const;
+    uint64_t TotalLength() const;
+
+    static constexpr size_t DEFAULT_MAX_OPEN_FILES = 128;
+private:
+    struct OpenFile {
+        int fd;
+        size_t pins;  // сколько FileHandle сейчас пользуются дескриптором
+        std::list<size_t>::iterator lru;
+    };
+
+    const std::filesystem::path root_;
+    const std::vector<TorrentFileEntry> files_;
+    std::vector<uint64_t> starts_;  // смещения начал файлов, по возрастанию
+    const size_t maxOpenFiles_;
+    std::mutex mutex_;
+    std::unordered_map<size_t, OpenFile> open_;
+    std::list<size_t> lru_;  // открытые файлы, от недавно использованных к давно не использованным
+
+    void Unpin(size_t file);
+
+    /*
+     * Закрыть давно не использованные дескрипторы, если их больше лимита. Вызывается под `mutex_`
+     */
+    void Evict();
+};
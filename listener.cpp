@@ -0,0 +1,130 @@
+#include "listener.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+namespace {
+/*
+ * Слушающий сокет семейства `family` на порту `port`. -1, если такие сокеты система не поддерживает
+ */
+int OpenListeningSocket(int family, uint16_t port)
+{
+    int sock = socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(sock == -1)
+    {
+        if(errno == EAFNOSUPPORT) return -1;
+        throw std::runtime_error(std::string("Error: cannot create listening socket: ") + strerror(errno));
+    }
+
+    int on = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    sockaddr_storage address{};
+    socklen_t length;
+    if(family == AF_INET6)
+    {
+        // один сокет на оба семейства: IPv4 пиры приходят как ::ffff:a.b.c.d
+        int off = 0;
+        setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+        auto& v6 = reinterpret_cast<sockaddr_in6&>(address);
+        v6.sin6_family = AF_INET6;
+        v6.sin6_addr = in6addr_any;
+        v6.sin6_port = htons(port);
+        length = sizeof(sockaddr_in6);
+    }
+    else
+    {
+        auto& v4 = reinterpret_cast<sockaddr_in&>(address);
+        v4.sin_family = AF_INET;
+        v4.sin_addr.s_addr = htonl(INADDR_ANY);
+        v4.sin_port = htons(port);
+        length = sizeof(sockaddr_in);
+    }
+
+    if(bind(sock, reinterpret_cast<sockaddr*>(&address), length) == -1 || listen(sock, Listener::BACKLOG) == -1)
+    {
+        int error = errno;
+        close(sock);
+        if(family == AF_INET6 && error == EADDRNOTAVAIL) return -1;
+        throw std::runtime_error("Error: cannot listen on port " + std::to_string(port) + ": " + strerror(error));
+    }
+    return sock;
+}
+}
+
+Listener::Listener(uint16_t port)
+: sock_(OpenListeningSocket(AF_INET6, port))
+, port_(port)
+, loop_(nullptr)
+{
+    if(sock_ == -1)
+    {
+        sock_ = OpenListeningSocket(AF_INET, port);
+    }
+    if(sock_ == -1)
+    {
+        throw std::runtime_error("Error: cannot listen on port " + std::to_string(port));
+    }
+
+    sockaddr_storage address{};
+    socklen_t length = sizeof(address);
+    if(getsockname(sock_, reinterpret_cast<sockaddr*>(&address), &length) == 0)
+    {
+        port_ = Peer::FromSockaddr(address).port;
+    }
+    std::cerr << "Logger: listening for peers on port " << port_ << std::endl;
+}
+
+Listener::~Listener()
+{
+    Stop();
+    close(sock_);
+}
+
+void Listener::Start(EventLoop& loop, Callback onAccepted)
+{
+    Stop();
+    onAccepted_ = std::move(onAccepted);
+    loop.Add(sock_, EPOLLIN, [this](uint32_t) { AcceptAll(); });
+    loop_ = &loop;
+}
+
+void Listener::Stop()
+{
+    if(loop_)
+    {
+        loop_->Remove(sock_);
+        loop_ = nullptr;
+    }
+}
+
+uint16_t Listener::Port() const
+{
+    return port_;
+}
+
+void Listener::AcceptAll()
+{
+    while(loop_)
+    {
+        sockaddr_storage address{};
+        socklen_t length = sizeof(address);
+        int sock = accept4(sock_, reinterpret_cast<sockaddr*>(&address), &length, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(sock == -1)
+        {
+            if(errno == EINTR || errno == ECONNABORTED) continue;
+            if(errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                // например, кончились дескрипторы: соединение остается в очереди ядра до следующего события
+                std::cerr << "Logger: cannot accept connection -- " << strerror(errno) << std::endl;
+            }
+            return;
+        }
+        onAccepted_(Peer::FromSockaddr(address), sock);
+    }
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "peer.h"
+#include "event_loop.h"
+#include <cstdint>
+#include <functional>
+
+/*
+ * Прием входящих соединений от пиров.
+ * Слушающий сокет неблокирующий и обслуживается циклом событий: за одно событие принимаются все ожидающие
+ * соединения. Принятый сокет сразу отдается владельцу, который передает его соединению с пиром (PeerConnect)
+ */
+class Listener {
+public:
+    /*
+     * sock -- принятый неблокирующий сокет, которым теперь владеет callback
+     */
+    using Callback = std::function<void(const Peer& peer, int sock)>;
+
+    /*
+     * Открыть сокет и слушать `port` на всех адресах: IPv6 вместе с IPv4, если система это позволяет, иначе только IPv4.
+     * port = 0 -- выбрать свободный порт (см. `Port`). Бросает исключение, если порт занят
+     */
+    explicit Listener(uint16_t port);
+
+    /*
+     * Закрывает сокет. Удалять из потока цикла или после его остановки
+     */
+    ~Listener();
+
+    Listener(const Listener&) = delete;
+    Listener& operator=(const Listener&) = delete;
+
+    /*
+     * Принимать соединения в цикле `loop`. `onAccepted` вызывается из потока цикла.
+     * Вызывается из потока цикла или до его запуска
+     */
+    void Start(EventLoop& loop, Callback onAccepted);
+
+    /*
+     * Перестать принимать соединения: новые ждут в очереди ядра до следующего `Start`.
+     * Вызывается из потока цикла или после его остановки
+     */
+    void Stop();
+
+    /*
+     * Порт, на котором принимаются соединения
+     */
+    uint16_t Port() const;
+
+    static constexpr int BACKLOG = 128;
+private:
+    int sock_;
+    uint16_t port_;
+    EventLoop* loop_;  // цикл, в котором зарегистрирован сокет, если есть
+    Callback onAccepted_;
+
+    /*
+     * Принять все соединения, ожидающие в очереди
+     */
+    void AcceptAll();
+};
@@ -0,0 +1,50 @@
+#include "mapped_file.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+MappedFile::MappedFile(const std::string& path)
+: data_(nullptr)
+, size_(0)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd == -1)
+    {
+        throw std::runtime_error("Error: cannot open " + path + ": " + strerror(errno));
+    }
+
+    struct stat info{};
+    if(fstat(fd, &info) == -1)
+    {
+        close(fd);
+        throw std::runtime_error("Error: cannot stat " + path + ": " + strerror(errno));
+    }
+    size_ = info.st_size;
+
+    // пустой файл отобразить нельзя, он просто дает пустой буфер
+    if(size_ > 0)
+    {
+        data_ = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+        if(data_ == MAP_FAILED)
+        {
+            data_ = nullptr;
+            close(fd);
+            throw std::runtime_error("Error: cannot map " + path + ": " + strerror(errno));
+        }
+    }
+    close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+    if(data_) munmap(data_, size_);
+}
+
+std::string_view MappedFile::Data() const
+{
+    return std::string_view(static_cast<const char*>(data_), size_);
+}
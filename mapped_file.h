@@ -0,0 +1,27 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <cstddef>
+
+/*
+ * Файл, целиком отображенный в память только для чтения. Данные доступны как один непрерывный буфер,
+ * без копирования в кучу
+ * https://man7.org/linux/man-pages/man2/mmap.2.html
+ */
+class MappedFile {
+public:
+    /*
+     * Бросает исключение, если файл не удалось открыть или отобразить
+     */
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    std::string_view Data() const;
+private:
+    void* data_;
+    size_t size_;
+};
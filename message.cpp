@@ -20,4 +20,14 @@ Message Message::Init(MessageId id, const std::string& payload)
 std::string Message::ToString() const
 {
     return IntToBytes(messageLength) + std::string(1, (char) id) + payload;
-}
\ No newline at end of file
+}
+MessageView MessageView::Parse(std::string_view messageString)
+{
+    if(messageString.empty())
+    {
+        return {MessageId::KeepAlive, 0, {}};
+    }
+    return {static_cast<MessageId>(messageString.front()),
+            messageString.size(),
+            messageString.substr(1)};
+}
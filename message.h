@@ -3,6 +3,7 @@
 #include "byte_tools.h"
 #include <cstdint>
 #include <string>
+#include <string_view>
 #include <arpa/inet.h>
 
 /*
@@ -47,3 +48,19 @@ struct Message {
      */
     std::string ToString() const;
 };
+
+/*
+ * Сообщение, не владеющее своими данными: `payload` указывает прямо в буфер приема соединения.
+ * Используется при разборе входящих сообщений, чтобы не копировать их содержимое.
+ * Действительно, пока не изменился буфер, из которого оно разобрано
+ */
+struct MessageView {
+    MessageId id;
+    size_t messageLength;
+    std::string_view payload;
+
+    /*
+     * То же, что `Message::Parse`, но без копирования
+     */
+    static MessageView Parse(std::string_view messageString);
+};
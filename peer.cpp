@@ -0,0 +1,197 @@
+#include "peer.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+constexpr size_t MIN_SET_CAPACITY = 16;
+
+uint64_t Mix(uint64_t x)
+{
+    // splitmix64: соседние адреса и порты расходятся по всему массиву
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+}
+
+Peer::Peer(std::string_view ip, uint16_t port)
+: port(port)
+{
+    char text[INET6_ADDRSTRLEN] = {};
+    if(ip.size() >= sizeof(text))
+    {
+        throw std::runtime_error("Error: invalid peer address " + std::string(ip));
+    }
+    std::copy(ip.begin(), ip.end(), text);
+
+    if(inet_pton(AF_INET, text, address.data()) == 1)
+    {
+        family = Family::V4;
+    }
+    else if(inet_pton(AF_INET6, text, address.data()) == 1)
+    {
+        family = Family::V6;
+    }
+    else
+    {
+        throw std::runtime_error("Error: invalid peer address " + std::string(ip));
+    }
+}
+
+Peer Peer::FromCompact(const char* data, Family family)
+{
+    Peer peer;
+    peer.family = family;
+    size_t length = CompactLength(family) - 2;
+    std::memcpy(peer.address.data(), data, length);
+    peer.port = (uint16_t(static_cast<unsigned char>(data[length])) << 8) | static_cast<unsigned char>(data[length + 1]);
+    return peer;
+}
+
+Peer Peer::FromSockaddr(const sockaddr_storage& storage)
+{
+    Peer peer;
+    if(storage.ss_family == AF_INET)
+    {
+        const auto& v4 = reinterpret_cast<const sockaddr_in&>(storage);
+        std::memcpy(peer.address.data(), &v4.sin_addr, 4);
+        peer.port = ntohs(v4.sin_port);
+        return peer;
+    }
+
+    const auto& v6 = reinterpret_cast<const sockaddr_in6&>(storage);
+    peer.port = ntohs(v6.sin6_port);
+    if(IN6_IS_ADDR_V4MAPPED(&v6.sin6_addr))
+    {
+        std::memcpy(peer.address.data(), reinterpret_cast<const uint8_t*>(&v6.sin6_addr) + 12, 4);
+        return peer;
+    }
+    peer.family = Family::V6;
+    std::memcpy(peer.address.data(), &v6.sin6_addr, 16);
+    return peer;
+}
+
+socklen_t Peer::ToSockaddr(sockaddr_storage& storage) const
+{
+    std::memset(&storage, 0, sizeof(storage));
+    if(family == Family::V4)
+    {
+        auto& v4 = reinterpret_cast<sockaddr_in&>(storage);
+        v4.sin_family = AF_INET;
+        v4.sin_port = htons(port);
+        std::memcpy(&v4.sin_addr, address.data(), 4);
+        return sizeof(sockaddr_in);
+    }
+    auto& v6 = reinterpret_cast<sockaddr_in6&>(storage);
+    v6.sin6_family = AF_INET6;
+    v6.sin6_port = htons(port);
+    std::memcpy(&v6.sin6_addr, address.data(), 16);
+    return sizeof(sockaddr_in6);
+}
+
+std::string Peer::Ip() const
+{
+    char text[INET6_ADDRSTRLEN] = {};
+    inet_ntop(family == Family::V4 ? AF_INET : AF_INET6, address.data(), text, sizeof(text));
+    return text;
+}
+
+std::string Peer::ToString() const
+{
+    if(family == Family::V4)
+    {
+        return Ip() + ":" + std::to_string(port);
+    }
+    return "[" + Ip() + "]:" + std::to_string(port);
+}
+
+bool Peer::operator==(const Peer& other) const
+{
+    return port == other.port && family == other.family && address == other.address;
+}
+
+size_t PeerHash::operator()(const Peer& peer) const
+{
+    uint64_t high;
+    uint64_t low;
+    std::memcpy(&high, peer.address.data(), 8);
+    std::memcpy(&low, peer.address.data() + 8, 8);
+    uint64_t tail = (uint64_t(peer.port) << 8) | static_cast<uint8_t>(peer.family);
+    return Mix(high ^ Mix(low ^ Mix(tail)));
+}
+
+PeerSet::PeerSet(size_t expected)
+: size_(0)
+{
+    size_t capacity = MIN_SET_CAPACITY;
+    while(capacity < 2 * expected)
+    {
+        capacity *= 2;
+    }
+    slots_.resize(capacity);
+    used_.resize(capacity, false);
+}
+
+bool PeerSet::Insert(const Peer& peer)
+{
+    // заполняем не больше чем наполовину, чтобы цепочки пробирования оставались короткими
+    if(2 * (size_ + 1) > slots_.size())
+    {
+        Grow();
+    }
+    size_t slot = Find(peer);
+    if(used_[slot]) return false;
+
+    slots_[slot] = peer;
+    used_[slot] = true;
+    ++size_;
+    return true;
+}
+
+bool PeerSet::Contains(const Peer& peer) const
+{
+    return used_[Find(peer)];
+}
+
+size_t PeerSet::Size() const
+{
+    return size_;
+}
+
+void PeerSet::Clear()
+{
+    std::fill(used_.begin(), used_.end(), false);
+    size_ = 0;
+}
+
+size_t PeerSet::Find(const Peer& peer) const
+{
+    size_t mask = slots_.size() - 1;
+    size_t slot = PeerHash()(peer) & mask;
+    while(used_[slot] && !(slots_[slot] == peer))
+    {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+void PeerSet::Grow()
+{
+    std::vector<Peer> slots(slots_.size() * 2);
+    std::vector<uint8_t> used(slots.size(), false);
+    std::swap(slots, slots_);
+    std::swap(used, used_);
+    for(size_t i = 0; i < slots.size(); ++i)
+    {
+        if(used[i])
+        {
+            size_t slot = Find(slots[i]);
+            slots_[slot] = slots[i];
+            used_[slot] = true;
+        }
+    }
+}
@@ -1,8 +1,106 @@
 #pragma once
 
+#include <array>
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <string_view>
+#include <vector>
+#include <sys/socket.h>
 
+/*
+ * Адрес пира в двоичном виде: IPv4 или IPv6 и порт.
+ * Пиры от трекеров приходят тысячами, поэтому адрес хранится как есть, без строки: разбор компактного ответа
+ * трекера -- это копирование байт, а для подключения sockaddr строится прямо из них
+ */
 struct Peer {
-    std::string ip;
-    int port;
-};
\ No newline at end of file
+    enum class Family : uint8_t {
+        V4,
+        V6
+    };
+
+    std::array<uint8_t, 16> address{};  // в сетевом порядке; у IPv4 заняты первые 4 байта, остальные нули
+    uint16_t port = 0;
+    Family family = Family::V4;
+
+    Peer() = default;
+
+    /*
+     * Адрес в текстовом виде ("1.2.3.4" или "::1"). Бросает исключение, если это не IP адрес
+     */
+    Peer(std::string_view ip, uint16_t port);
+
+    /*
+     * Пир из компактной записи трекера: 4 (IPv4) или 16 (IPv6) байт адреса и 2 байта порта, все в сетевом порядке
+     * http://www.bittorrent.org/beps/bep_0023.html, http://www.bittorrent.org/beps/bep_0007.html
+     */
+    static Peer FromCompact(const char* data, Family family);
+
+    /*
+     * Пир по адресу из accept. IPv4, пришедший через IPv6 сокет (::ffff:1.2.3.4), становится обычным IPv4
+     */
+    static Peer FromSockaddr(const sockaddr_storage& storage);
+
+    /*
+     * Длина компактной записи пира
+     */
+    static constexpr size_t CompactLength(Family family)
+    {
+        return family == Family::V4 ? 6 : 18;
+    }
+
+    /*
+     * Заполнить `storage` адресом для connect/bind, возвращает длину адреса
+     */
+    socklen_t ToSockaddr(sockaddr_storage& storage) const;
+
+    /*
+     * Адрес без порта в текстовом виде
+     */
+    std::string Ip() const;
+
+    /*
+     * "1.2.3.4:6881" или "[::1]:6881", для логов
+     */
+    std::string ToString() const;
+
+    bool operator==(const Peer& other) const;
+};
+
+struct PeerHash {
+    size_t operator()(const Peer& peer) const;
+};
+
+/*
+ * Множество пиров для отсева повторов: открытая адресация с линейным пробированием по массиву размером в степень
+ * двойки. Пиры лежат прямо в массиве, поэтому вставка не выделяет память, пока массив не приходится увеличивать
+ */
+class PeerSet {
+public:
+    /*
+     * expected -- сколько пиров ожидается, чтобы сразу выделить массив нужного размера
+     */
+    explicit PeerSet(size_t expected = 0);
+
+    /*
+     * Добавить пира. Возвращает false, если он уже есть
+     */
+    bool Insert(const Peer& peer);
+
+    bool Contains(const Peer& peer) const;
+
+    size_t Size() const;
+
+    void Clear();
+private:
+    std::vector<Peer> slots_;
+    std::vector<uint8_t> used_;  // занят ли слот
+    size_t size_;
+
+    /*
+     * Слот, в котором лежит `peer`, или первый свободный слот на его пути
+     */
+    size_t Find(const Peer& peer) const;
+
+    void Grow();
+};
@@ -3,134 +3,165 @@
 #include "message.h"
 #include <iostream>
 #include <utility>
+#include <algorithm>
+#include <cstring>
 
 using namespace std::chrono_literals;
 
-PeerPiecesAvailability::PeerPiecesAvailability(std::string bitfield) : bitfield_(bitfield){}
-
-bool PeerPiecesAvailability::IsPieceAvailable(size_t pieceIndex) const
-{
-    return bitfield_[pieceIndex >> 3] & (1 << (7 - pieceIndex % (1 << 3)));
+namespace {
+constexpr size_t HANDSHAKE_LENGTH = 68;
+constexpr size_t PIECE_HEADER_LENGTH = 9;  // id сообщения, номер части и смещение блока
+constexpr size_t MAX_MESSAGE_LENGTH = 1 << 22;
+constexpr size_t READ_BUDGET = 1 << 20;  // сколько байт читаем за одно событие, чтобы не задерживать другие сокеты
+constexpr auto IDLE_TIMEOUT = 60s;  // сколько ждем сообщений от пира
+constexpr auto WATCHDOG_PERIOD = 1s;  // как часто цикл общения с пиром просыпается сам, без событий сокета
+constexpr auto INTEREST_TIMEOUT = 10s;  // сколько ждем Interested от пира, когда нам самим от него ничего не нужно
+constexpr size_t MAX_UPLOAD_BLOCK = 1 << 17;  // запросы блоков длиннее этого отбрасываются
+constexpr size_t MAX_UPLOAD_QUEUE = 256;  // сколько запросов пира держим в очереди, лишние отбрасываются
+constexpr size_t BLOCK_SIZE = 1 << 14;  // по столько байт запрашиваются блоки (см. Piece)
+constexpr size_t RATE_QUANTUM = 1 << 16;  // сколько байт соединение берет из ограниченной корзины за раз, не уступая другим
+constexpr size_t MIN_SEND = 1 << 12;  // меньше этого при ограничении скорости не отправляем, чтобы не дробить пакеты
 }
-void PeerPiecesAvailability::SetPieceAvailability(size_t pieceIndex)
-{
-    bitfield_[pieceIndex >> 3] |= (1 << (7 - pieceIndex % (1 << 3)));
-}
-size_t PeerPiecesAvailability::Size() const
-{
-    size_t cnt = 0;
-    for(auto&& byte : bitfield_)
-    {
-        cnt += std::__popcount(byte);
-    }
-    return cnt;
-}
-PeerConnect::PeerConnect(const Peer& peer, const TorrentFile& tf, std::string selfPeerId, PieceStorage& pieceStorage)
+
+PeerConnect::PeerConnect(const Peer& peer, const TorrentFile& tf, std::string selfPeerId, PieceStorage& pieceStorage,
+                         size_t pipelineDepth, bool adaptivePipeline)
         : tf_(tf)
-        , socket_(peer.ip, peer.port, 500ms, 500ms)
+        , socket_(peer, 500ms, 500ms)
         , selfPeerId_(std::move(selfPeerId))
+        , piecesAvailability_(pieceStorage.TotalPiecesCount())
         , terminated_(false)
         , choked_(true)
+        , peerChoked_(true)
+        , peerInterested_(false)
+        , inbound_(false)
         , pieceStorage_(pieceStorage)
-        , pendingBlock_(false)
-        , failed_(false) {}
+        , pipeline_(pipelineDepth, adaptivePipeline)
+        , availabilityRegistered_(false)
+        , failed_(false)
+        , loop_(nullptr)
+        , seenEndgameBlocks_(0)
+        , announcedPieces_(0)
+        , downloadedBytes_(0)
+        , uploadedBytes_(0)
+        , flushedBytes_(0) {}
 
 void PeerConnect::Run()
 {
     std::cerr << "###CONNECTION STARTED###" << std::endl;
-    while (!terminated_) {
-        if (EstablishConnection()) {
-            std::cerr << "Connection established to peer" << std::endl;
-            try
-            {
-                MainLoop();
-            } catch(const std::exception& e)
-            {
-                failed_ = true;
-                std::cerr << "Ooops... something wrong in MAIN LOOP: " << e.what() << std::endl;
-                Terminate();
-            }
-        }
-        else
-        {
-            failed_ = true;
-            std::cerr << "Cannot establish connection to peer" << std::endl;
-            Terminate();
-        }
+    EventLoop loop;
+    Start(loop, [&loop] { loop.Stop(); });
+    loop.Run();
+}
+
+std::string PeerConnect::HandshakeMessage() const
+{
+    return std::string(1, (char) 19) + "BitTorrent protocol00000000"
+           + tf_.infoHash
+           + selfPeerId_;
+}
+
+void PeerConnect::CheckHandshake(std::string_view reply) const
+{
+    if(reply.front() != ((char) 19) || reply.substr(1, 19) != "BitTorrent protocol" || tf_.infoHash != reply.substr(28, 20))
+    {
+        throw std::runtime_error("Error: handshake failed");
     }
-    std::cerr << "###CONNECTION ENDED###" << std::endl;
 }
 
-void PeerConnect::PerformHandshake()
+Task<> PeerConnect::Session()
 {
-    socket_.EstablishConnection();
+    AsyncSocket socket(socket_, *loop_);
+    try
+    {
+        co_await socket.Connect();
+        std::cerr << "Connection established to peer" << std::endl;
 
-    socket_.SendData(std::string(1, (char) 19) + "BitTorrent protocol00000000"
-                     + tf_.infoHash
-                     + selfPeerId_);
+        std::string handshake = HandshakeMessage();
+        char reply[HANDSHAKE_LENGTH];
+        if(!inbound_)
+        {
+            co_await socket.Write(handshake, socket_.GetConnectTimeout());
+        }
+        co_await socket.ReadExact(reply, HANDSHAKE_LENGTH, socket_.GetConnectTimeout());
+        CheckHandshake(std::string_view(reply, HANDSHAKE_LENGTH));
+        if(inbound_)
+        {
+            co_await socket.Write(handshake, socket_.GetConnectTimeout());
+        }
 
-    std::string get = socket_.ReceiveData(68);
+        // пока пир не прислал bitfield, считаем, что у него ничего нет
+        pieceStorage_.AddPeer(piecesAvailability_);
+        availabilityRegistered_ = true;
+        SendBitField();
+        if(pieceStorage_.PiecesSavedToDiscCount() < pieceStorage_.TotalPiecesCount())
+        {
+            SendInterested();
+        }
+        lastActivity_ = connectedAt_ = EventLoop::Clock::now();
 
-    if(get.front() != ((char) 19) || get.substr(1, 19) != "BitTorrent protocol" || tf_.infoHash != get.substr(28, 20))
+        co_await MainLoop(socket);
+    } catch(const std::exception& e)
     {
-        throw std::runtime_error("Error: handshake failed");
+        failed_ = true;
+        std::cerr << "Ooops... something wrong with peer " << socket_.GetPeer().ToString()
+                  << " -- " << e.what() << std::endl;
+        Terminate();
     }
+    Finish();
 }
 
-bool PeerConnect::EstablishConnection()
+void PeerConnect::SendInterested()
 {
-    try {
-        PerformHandshake();
-    } catch (const std::exception& e){
-        std::cerr << "Fail in function PerformHandshake(), peer " << socket_.GetIp() << ":" <<
-                  socket_.GetPort() << " -- " << e.what() << std::endl;
-        return false;
-    }
-    try {
-        ReceiveBitfield();
-    } catch (const std::exception& e) {
-        std::cerr << "Fail in function RecieveBitfield(), peer " << socket_.GetIp() << ":" <<
-                  socket_.GetPort() << " -- " << e.what() << std::endl;
-        return false;
-    }
-    try {
-        SendInterested();
-        return true;
-    } catch (const std::exception& e) {
-        std::cerr << "Fail in function SendInterested(), peer " << socket_.GetIp() << ":" <<
-                  socket_.GetPort() << " -- " << e.what() << std::endl;
-        return false;
-    }
+    Send(IntToBytes(1) + std::string(1, (char) MessageId::Interested));
 }
 
-void PeerConnect::ReceiveBitfield()
+void PeerConnect::SendBitField()
 {
-    std::string data = socket_.ReceiveData();
+    // сначала счетчик, потом набор: часть, сохраненная между ними, будет анонсирована еще и через Have, что не страшно
+    announcedPieces_ = pieceStorage_.PiecesSavedToDiscCount();
+    if(announcedPieces_ == 0) return;
 
-    if((int) data.front() == 20)
-    {
-        data = socket_.ReceiveData();
-    }
+    Send(Message::Init(MessageId::BitField, pieceStorage_.SavedPieces().ToBytes()).ToString());
+}
 
-    MessageId ID = (MessageId) (uint8_t) data.front();
+void PeerConnect::SendHaves()
+{
+    auto pieces = pieceStorage_.SavedPiecesSince(announcedPieces_);
+    if(pieces.empty()) return;
+    announcedPieces_ += pieces.size();
 
-    if(ID == MessageId::BitField)
+    std::string haves;
+    for(size_t pieceIndex : pieces)
     {
-        piecesAvailability_ = PeerPiecesAvailability(data.substr(1));
+        // пиру, у которого часть уже есть, Have ничего не скажет
+        if(piecesAvailability_.IsPieceAvailable(pieceIndex)) continue;
+        haves += Message::Init(MessageId::Have, IntToBytes(pieceIndex)).ToString();
     }
-    else if(ID == MessageId::Unchoke)
+    if(!haves.empty())
     {
-        choked_ = false;
-    }
-    else
-    {
-        throw std::runtime_error("Error: cannot get bitfield");
+        Send(haves);
     }
 }
 
-void PeerConnect::SendInterested()
+void PeerConnect::ChokePeer()
 {
-    socket_.SendData(IntToBytes(1) + std::string(1, (char) MessageId::Interested));
+    if(peerChoked_) return;
+    peerChoked_ = true;
+    uploads_.clear();
+    Send(IntToBytes(1) + std::string(1, (char) MessageId::Choke));
+}
+
+void PeerConnect::UnchokePeer()
+{
+    if(!peerChoked_) return;
+    peerChoked_ = false;
+    Send(IntToBytes(1) + std::string(1, (char) MessageId::Unchoke));
+}
+
+void PeerConnect::AdoptSocket(int sock, bool inbound)
+{
+    socket_.Adopt(sock);
+    inbound_ = inbound;
 }
 
 void PeerConnect::Terminate()
@@ -139,101 +170,617 @@ void PeerConnect::Terminate()
     terminated_ = true;
 }
 
-void PeerConnect::RequestPiece()
+uint64_t PeerConnect::DownloadedBytes() const
+{
+    return downloadedBytes_;
+}
+
+uint64_t PeerConnect::UploadedBytes() const
+{
+    return uploadedBytes_;
+}
+
+bool PeerConnect::PeerInterested() const
+{
+    return peerInterested_;
+}
+
+bool PeerConnect::PeerChoked() const
+{
+    return peerChoked_;
+}
+
+void PeerConnect::LimitRate(TokenBucket& upload, TokenBucket& download)
+{
+    uploadLimit_.SetParent(&upload);
+    downloadLimit_.SetParent(&download);
+}
+
+void PeerConnect::SetRateLimit(uint64_t upload, uint64_t download)
 {
-    if(!pieceInProgress_)
+    uploadLimit_.SetRate(upload);
+    downloadLimit_.SetRate(download);
+}
+
+void PeerConnect::SetPeerChoked(bool choked)
+{
+    // сокет уже закрыт или вот-вот закроется
+    if(terminated_) return;
+    try
     {
-        pieceInProgress_ = pieceStorage_.GetNextPieceToDownload();
-        int loop_size = pieceStorage_.TotalPiecesCount();
-        while(pieceInProgress_ && loop_size-- && !piecesAvailability_.IsPieceAvailable(pieceInProgress_->GetIndex()))
+        if(choked)
         {
-            pieceStorage_.PushPiece(pieceInProgress_);
-            pieceInProgress_ = pieceStorage_.GetNextPieceToDownload();
+            ChokePeer();
         }
+        else
+        {
+            UnchokePeer();
+        }
+    } catch(const std::exception& e)
+    {
+        // вызов идет не из корутины: соединение она завершит сама, когда проснется
+        std::cerr << e.what() << std::endl;
+        failed_ = true;
+        Terminate();
     }
+}
+
+void PeerConnect::RequestPiece()
+{
+    std::string requests;
+    size_t requestsCount = 0;
+    size_t current = 0;  // все части до `current` уже полностью запрошены
+    bool endgame = pieceStorage_.InEndgame();
+    auto requestedByUs = [this](const Block& block) {
+        return pipeline_.Contains(block.piece, block.offset);
+    };
+    // при ограничении скорости запрос блока оплачивается заранее: пир пришлет ровно столько, сколько запрошено,
+    // поэтому чтение из сокета не тормозим, а лишнего просто не запрашиваем
+    bool limited = downloadLimit_.Limited();
+    size_t budget = 0;  // взято из корзины, но еще не потрачено на запросы
+    size_t taken = 0;
 
-    if(pieceInProgress_)
+    while(!pipeline_.Full())
     {
-        if(!pendingBlock_)
+        if(limited && budget < BLOCK_SIZE)
         {
-            auto block = pieceInProgress_->FirstMissingBlock();
-
-            if(block)
+            // остальным соединениям тоже нужны байты, поэтому за раз берем не больше кванта
+            if(taken >= RATE_QUANTUM || !downloadLimit_.TakeExactly(BLOCK_SIZE))
             {
-                std::cerr << "Logger: trying to send Request" << std::endl;
-                auto message = Message::Init(MessageId::Request,
-                                             IntToBytes(pieceInProgress_->GetIndex())
-                                             + IntToBytes(block->offset)
-                                             + IntToBytes(block->length));
-                socket_.SendData(message.ToString());
-                pendingBlock_ = true;
-                pieceInProgress_->SetPended(block->offset);
-                std::cerr << "Logger: Request was sent" << std::endl;
+                requestResumeAt_ = EventLoop::Clock::now() + downloadLimit_.TimeUntil(BLOCK_SIZE);
+                break;
             }
-            else
+            budget += BLOCK_SIZE;
+            taken += BLOCK_SIZE;
+        }
+
+        std::optional<Block> block;
+        while(current < piecesInProgress_.size()
+              && !(block = piecesInProgress_[current]->RequestBlock(endgame, requestedByUs)))
+        {
+            ++current;
+        }
+
+        if(!block)
+        {
+            auto piece = pieceStorage_.GetNextPieceToDownload(piecesAvailability_);
+            if(!piece && endgame)
             {
-                pieceInProgress_ = nullptr;
+                piece = pieceStorage_.GetEndgamePiece(piecesAvailability_, piecesInProgress_);
             }
+            if(!piece) break;
+            piecesInProgress_.push_back(piece);
+            continue;
+        }
+
+        requests += Message::Init(MessageId::Request,
+                                  IntToBytes(block->piece)
+                                  + IntToBytes(block->offset)
+                                  + IntToBytes(block->length)).ToString();
+        ++requestsCount;
+        pipeline_.Push(block->piece, block->offset, block->length);
+        if(limited)
+        {
+            budget -= std::min<size_t>(budget, block->length);
         }
     }
+    downloadLimit_.Refund(budget);
+
+    if(requestsCount)
+    {
+        std::cerr << "Logger: trying to send " << requestsCount << " Request(s), pipeline depth = "
+                  << pipeline_.Depth() << std::endl;
+        Send(requests);
+    }
 }
 
-void PeerConnect::MainLoop() {
+Task<> PeerConnect::MainLoop(AsyncSocket& socket)
+{
     while (!terminated_) {
+        CancelReceivedBlocks();
+        SendHaves();
 
-        if(pieceStorage_.QueueIsEmpty())
+        requestResumeAt_ = {};
+        if (!choked_) {
+            RequestPiece();
+        }
+
+        // в endgame пустая очередь еще не повод уходить: `RequestPiece` мог взять чужую недокачанную часть.
+        // Пира, которому нужны наши части, не бросаем, а тому, кто еще не сказал, нужны ли, даем время
+        bool peerIsSeed = piecesAvailability_.Size() == pieceStorage_.TotalPiecesCount();
+        if(pieceStorage_.QueueIsEmpty() && piecesInProgress_.empty() && !peerInterested_ && !HasPendingOutput()
+           && (peerIsSeed || EventLoop::Clock::now() - connectedAt_ > INTEREST_TIMEOUT))
         {
             std::cerr << "Logger: pieces queue is empty -> terminating..." << std::endl;
             Terminate();
-            return;
+            co_return;
         }
 
-        auto message = Message::Parse(socket_.ReceiveData());
+        uint32_t events = co_await socket.Wait(CanWrite() ? EPOLLIN | EPOLLOUT : EPOLLIN, WaitTimeout());
+        if(events & EPOLLOUT)
+        {
+            FlushOutbox();
+        }
+        if(events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+        {
+            size_t budget = READ_BUDGET;
+            size_t received;
+            while(!terminated_ && budget > 0 && (received = ReadFromSocket()) > 0)
+            {
+                ProcessInbox();
+                budget -= std::min(budget, received);
+            }
+            lastActivity_ = EventLoop::Clock::now();
+        }
+        else if(EventLoop::Clock::now() - lastActivity_ > IDLE_TIMEOUT)
+        {
+            throw std::runtime_error("Error: peer timed out");
+        }
+    }
+}
 
-        if(message.id == MessageId::Choke)
+void PeerConnect::HandleMessage(const MessageView& message)
+{
+    if(message.id == MessageId::Choke)
+    {
+        std::cerr << "Logger: got message Choke" << std::endl;
+        choked_ = true;
+        // пир отбросил наши запросы: части возвращаются в очередь, чтобы их докачали другие, а после Unchoke
+        // запрашиваются заново
+        pipeline_.Clear();
+        for(auto& piece : piecesInProgress_)
         {
-            std::cerr << "Logger: got message Choke" << std::endl;
-            choked_ = true;
-            Terminate();
+            pieceStorage_.PushPiece(piece);
+        }
+        piecesInProgress_.clear();
+    }
+    else if(message.id == MessageId::Unchoke)
+    {
+        std::cerr << "Logger: got message Unchoke" << std::endl;
+        choked_ = false;
+    }
+    else if(message.id == MessageId::KeepAlive)
+    {
+        std::cerr << "Logger: got meassage Keep Alive" << std::endl;
+    }
+    else if(message.id == MessageId::Have)
+    {
+        std::cerr << "Logger: got message Have" << std::endl;
+        size_t idx = BytesToInt(message.payload);
+        if(!piecesAvailability_.IsPieceAvailable(idx) && piecesAvailability_.SetPieceAvailability(idx))
+        {
+            if(availabilityRegistered_)
+            {
+                pieceStorage_.PeerHasPiece(idx);
+            }
+        }
+    }
+    else if(message.id == MessageId::BitField)
+    {
+        std::cerr << "Logger: got message BitField" << std::endl;
+        pieceStorage_.RemovePeer(piecesAvailability_);
+        piecesAvailability_ = PeerPiecesAvailability(message.payload, pieceStorage_.TotalPiecesCount());
+        pieceStorage_.AddPeer(piecesAvailability_);
+    }
+    else if(message.id == MessageId::Interested)
+    {
+        std::cerr << "Logger: got message Interested" << std::endl;
+        // разчокнет ли его, решает чокер
+        peerInterested_ = true;
+    }
+    else if(message.id == MessageId::NotInterested)
+    {
+        std::cerr << "Logger: got message Not Interested" << std::endl;
+        peerInterested_ = false;
+    }
+    else if(message.id == MessageId::Request)
+    {
+        QueueUpload(message.payload);
+    }
+    else if(message.id == MessageId::Cancel)
+    {
+        CancelUpload(message.payload);
+    }
+    else if(message.id == MessageId::Piece)
+    {
+        // запрошенные блоки разбираются в `ProcessInbox`, сюда попадают только те, которые мы не запрашивали
+        std::cerr << "Logger: got unrequested Piece, ignoring it" << std::endl;
+    }
+}
+
+void PeerConnect::QueueUpload(std::string_view payload)
+{
+    if(payload.size() < 12)
+    {
+        throw std::runtime_error("Error: malformed request");
+    }
+    BlockRequest request{};
+    request.piece = BytesToInt(payload.substr(0, 4));
+    request.offset = BytesToInt(payload.substr(4, 4));
+    request.length = BytesToInt(payload.substr(8, 4));
+
+    // запросы, пришедшие до Unchoke или после Choke, по протоколу игнорируются
+    if(peerChoked_) return;
+    std::vector<FileStorage::Segment> segments;
+    if(request.length > MAX_UPLOAD_BLOCK || uploads_.size() >= MAX_UPLOAD_QUEUE
+       || !pieceStorage_.MapBlock(request.piece, request.offset, request.length, segments))
+    {
+        std::cerr << "Logger: ignoring request for piece " << request.piece << ", offset " << request.offset
+                  << ", length " << request.length << std::endl;
+        return;
+    }
+    uploads_.push_back(request);
+    FlushOutbox();
+}
+
+void PeerConnect::CancelUpload(std::string_view payload)
+{
+    if(payload.size() < 12)
+    {
+        throw std::runtime_error("Error: malformed cancel");
+    }
+    uint32_t piece = BytesToInt(payload.substr(0, 4));
+    uint32_t offset = BytesToInt(payload.substr(4, 4));
+    auto it = std::find_if(uploads_.begin(), uploads_.end(), [piece, offset](const BlockRequest& request) {
+        return request.piece == piece && request.offset == offset;
+    });
+    if(it != uploads_.end())
+    {
+        uploads_.erase(it);
+    }
+}
+
+size_t PeerConnect::ReadFromSocket()
+{
+    if(incoming_.target)
+    {
+        size_t received = socket_.ReceiveSome(incoming_.target + incoming_.received,
+                                              incoming_.length - incoming_.received);
+        incoming_.received += received;
+        if(incoming_.received == incoming_.length)
+        {
+            FinishBlock();
         }
-        else if(message.id == MessageId::Unchoke)
+        return received;
+    }
+
+    char* begin = recvBuffer_.WriteBegin();
+    size_t received = socket_.ReceiveSome(begin, recvBuffer_.WriteCapacity());
+    recvBuffer_.Commit(received);
+    return received;
+}
+
+void PeerConnect::ProcessInbox()
+{
+    while(!terminated_ && !incoming_.target && recvBuffer_.Size() >= 4)
+    {
+        auto data = recvBuffer_.Data();
+        size_t length = BytesToInt(data.substr(0, 4));
+        if(length > MAX_MESSAGE_LENGTH)
         {
-            std::cerr << "Logger: got message Unchoke" << std::endl;
-            choked_ = false;
+            throw std::runtime_error("Error: message is too long");
         }
-        else if(message.id == MessageId::KeepAlive)
+
+        if(length > PIECE_HEADER_LENGTH && data.size() >= 4 + PIECE_HEADER_LENGTH
+           && (MessageId) data[4] == MessageId::Piece
+           && BeginBlock(data.substr(5, PIECE_HEADER_LENGTH - 1), length - PIECE_HEADER_LENGTH))
         {
-            std::cerr << "Logger: got meassage Keep Alive" << std::endl;
+            // то, что уже прочитано, переносим в часть файла, остальное будет читаться из сокета прямо туда
+            size_t available = std::min(data.size() - 4 - PIECE_HEADER_LENGTH, incoming_.length);
+            memcpy(incoming_.target, data.data() + 4 + PIECE_HEADER_LENGTH, available);
+            incoming_.received = available;
+            recvBuffer_.Consume(4 + PIECE_HEADER_LENGTH + available);
+            if(incoming_.received == incoming_.length)
+            {
+                FinishBlock();
+            }
             continue;
         }
-        else if(message.id == MessageId::Have)
+
+        if(data.size() - 4 < length)
+        {
+            recvBuffer_.Reserve(4 + length);
+            break;
+        }
+
+        HandleMessage(MessageView::Parse(data.substr(4, length)));
+        recvBuffer_.Consume(4 + length);
+    }
+}
+
+bool PeerConnect::BeginBlock(std::string_view header, size_t length)
+{
+    uint32_t idx = BytesToInt(header.substr(0, 4));
+    uint32_t begin = BytesToInt(header.substr(4, 4));
+
+    auto piece = FindPiece(idx);
+    if(!piece || !pipeline_.Complete(idx, begin))
+    {
+        return false;  // этот блок мы не запрашивали
+    }
+    if(!piece->IsValidBlock(begin, length))
+    {
+        throw std::runtime_error("Error: peer sent block of unexpected length");
+    }
+
+    char* target = piece->BlockTarget(begin, length);
+    if(!target)
+    {
+        // блок уже получен от другого пира (endgame), его данные читаем в никуда
+        discard_.resize(length);
+        incoming_ = {nullptr, begin, discard_.data(), length, 0};
+        return true;
+    }
+
+    incoming_ = {piece, begin, target, length, 0};
+    return true;
+}
+
+void PeerConnect::FinishBlock()
+{
+    auto piece = std::move(incoming_.piece);
+    size_t offset = incoming_.offset;
+    downloadedBytes_ += incoming_.length;
+    incoming_ = {};
+    if(!piece) return;
+
+    bool completed = piece->CommitBlock(offset);
+    pieceStorage_.BlockReceived();
+
+    if(completed)
+    {
+        piecesInProgress_.erase(std::find(piecesInProgress_.begin(), piecesInProgress_.end(), piece));
+        pieceStorage_.PieceProcessed(piece);
+    }
+}
+
+PiecePtr PeerConnect::FindPiece(size_t pieceIndex) const
+{
+    auto it = std::find_if(piecesInProgress_.begin(), piecesInProgress_.end(), [pieceIndex](const PiecePtr& piece) {
+        return piece->GetIndex() == pieceIndex;
+    });
+    return it != piecesInProgress_.end() ? *it : nullptr;
+}
+
+void PeerConnect::CancelReceivedBlocks()
+{
+    uint64_t received = pieceStorage_.EndgameBlocksReceived();
+    if(received == seenEndgameBlocks_) return;
+    seenEndgameBlocks_ = received;
+
+    std::string cancels;
+    std::vector<BlockRequest> requests(pipeline_.Requests().begin(), pipeline_.Requests().end());
+    for(const auto& request : requests)
+    {
+        auto piece = FindPiece(request.piece);
+        if(piece && !piece->IsBlockRetrieved(request.offset)) continue;
+
+        cancels += Message::Init(MessageId::Cancel,
+                                 IntToBytes(request.piece)
+                                 + IntToBytes(request.offset)
+                                 + IntToBytes(request.length)).ToString();
+        pipeline_.Cancel(request.piece, request.offset);
+    }
+
+    for(auto it = piecesInProgress_.begin(); it != piecesInProgress_.end();)
+    {
+        if(*it != incoming_.piece && (*it)->AllBlocksRetrieved())
         {
-            std::cerr << "Logger: got message Have" << std::endl;
-            piecesAvailability_.SetPieceAvailability(BytesToInt(message.payload));
+            pieceStorage_.PushPiece(*it);
+            it = piecesInProgress_.erase(it);
         }
-        else if(message.id == MessageId::Piece)
+        else
         {
-            std::cerr << "Logger: got message Piece" << std::endl;
-            size_t idx = BytesToInt(message.payload.substr(0, 4));
-            auto begin = BytesToInt(message.payload.substr(4, 4));
-            auto block = message.payload.substr(8);
+            ++it;
+        }
+    }
 
-            if(pieceInProgress_ && idx == pieceInProgress_->GetIndex())
+    if(!cancels.empty())
+    {
+        std::cerr << "Logger: endgame, cancelling " << cancels.size() / 17 << " duplicate request(s)" << std::endl;
+        Send(cancels);
+    }
+}
+
+void PeerConnect::Send(const std::string& data)
+{
+    outbox_ += data;
+    FlushOutbox();
+}
+
+void PeerConnect::ReleasePieces()
+{
+    if(incoming_.piece)
+    {
+        incoming_.piece->AbortBlock(incoming_.offset);
+    }
+    incoming_ = {};
+    for(auto& piece : piecesInProgress_)
+    {
+        pieceStorage_.PushPiece(piece);
+    }
+    piecesInProgress_.clear();
+    pipeline_.Clear();
+
+    if(availabilityRegistered_)
+    {
+        pieceStorage_.RemovePeer(piecesAvailability_);
+        availabilityRegistered_ = false;
+    }
+}
+
+void PeerConnect::Start(EventLoop& loop, std::function<void()> onFinished)
+{
+    loop_ = &loop;
+    onFinished_ = std::move(onFinished);
+    lastActivity_ = EventLoop::Clock::now();
+
+    session_ = Session();
+    session_.Start();
+}
+
+void PeerConnect::FlushOutbox()
+{
+    flushedBytes_ = 0;
+    while(true)
+    {
+        // данные блока должны идти сразу за его заголовком, поэтому начатый блок досылается первым
+        if(outgoing_.active)
+        {
+            if(!SendOutgoingBlock()) return;
+            continue;
+        }
+
+        size_t sent = 0;
+        while(sent < outbox_.size())
+        {
+            size_t curSession = socket_.SendSome(outbox_.data() + sent, outbox_.size() - sent);
+            if(curSession == 0) break;
+            sent += curSession;
+        }
+        outbox_.erase(0, sent);
+        if(!outbox_.empty()) return;
+
+        // блок начинается, только когда `outbox_` отправлен целиком
+        if(!StartUpload()) return;
+    }
+}
+
+bool PeerConnect::StartUpload()
+{
+    while(!uploads_.empty())
+    {
+        BlockRequest request = uploads_.front();
+        uploads_.pop_front();
+
+        outgoing_.segments.clear();
+        if(!pieceStorage_.MapBlock(request.piece, request.offset, request.length, outgoing_.segments)) continue;
+
+        outgoing_.header = IntToBytes(PIECE_HEADER_LENGTH + request.length)
+                           + std::string(1, (char) MessageId::Piece)
+                           + IntToBytes(request.piece)
+                           + IntToBytes(request.offset);
+        outgoing_.segment = 0;
+        outgoing_.length = request.length;
+        outgoing_.active = true;
+        return true;
+    }
+    return false;
+}
+
+bool PeerConnect::SendOutgoingBlock()
+{
+    while(!outgoing_.header.empty())
+    {
+        // MSG_MORE: заголовок уйдет в одном пакете с началом данных
+        size_t sent = socket_.SendSome(outgoing_.header.data(), outgoing_.header.size(), true);
+        if(sent == 0) return false;
+        outgoing_.header.erase(0, sent);
+    }
+
+    while(outgoing_.segment < outgoing_.segments.size())
+    {
+        auto& segment = outgoing_.segments[outgoing_.segment];
+        size_t allowed = segment.length;
+        bool limited = uploadLimit_.Limited();
+        if(limited)
+        {
+            // за раз берем не больше кванта, а квант, отправленный за этот вызов, уступаем другим соединениям
+            size_t chunk = std::min(segment.length, RATE_QUANTUM);
+            allowed = flushedBytes_ < RATE_QUANTUM ? uploadLimit_.Take(chunk) : 0;
+            if(allowed < std::min(chunk, MIN_SEND))
             {
-                pieceInProgress_->SaveBlock(begin, block);
-                if(pieceInProgress_->AllBlocksRetrieved())
-                {
-                    pieceStorage_.PieceProcessed(pieceInProgress_);
-                    pieceInProgress_ = nullptr;
-                }
+                uploadLimit_.Refund(allowed);
+                uploadResumeAt_ = EventLoop::Clock::now() + uploadLimit_.TimeUntil(std::min(chunk, MIN_SEND));
+                return false;
             }
-            pendingBlock_ = false;
         }
 
-        if (!choked_ && !pendingBlock_) {
-            RequestPiece();
+        auto file = pieceStorage_.OpenFile(segment.file);
+        size_t sent = socket_.SendFile(file.Fd(), segment.offset, allowed);
+        if(limited)
+        {
+            uploadLimit_.Refund(allowed - sent);
+        }
+        flushedBytes_ += sent;
+        if(sent == 0) return false;
+        segment.offset += sent;
+        segment.length -= sent;
+        if(segment.length == 0)
+        {
+            ++outgoing_.segment;
         }
     }
+
+    pieceStorage_.BlockUploaded(outgoing_.length);
+    uploadedBytes_ += outgoing_.length;
+    outgoing_.active = false;
+    return true;
+}
+
+bool PeerConnect::HasPendingOutput() const
+{
+    return !outbox_.empty() || outgoing_.active || (!uploads_.empty() && !peerChoked_);
+}
+
+bool PeerConnect::CanWrite() const
+{
+    // пока ограничение скорости не дает слать блоки, ждать готовности сокета к записи бессмысленно. Исключение --
+    // сообщения в `outbox_`, которые не ждут посреди блока
+    if(EventLoop::Clock::now() < uploadResumeAt_ && (outgoing_.active || outbox_.empty())) return false;
+    return HasPendingOutput();
+}
+
+std::chrono::milliseconds PeerConnect::WaitTimeout() const
+{
+    auto now = EventLoop::Clock::now();
+    auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(WATCHDOG_PERIOD);
+    auto until = [now](EventLoop::Clock::time_point at) {
+        return std::chrono::ceil<std::chrono::milliseconds>(std::max(at - now, EventLoop::Clock::duration::zero()));
+    };
+    if(requestResumeAt_ != EventLoop::Clock::time_point{})
+    {
+        timeout = std::min(timeout, until(requestResumeAt_));
+    }
+    if(uploadResumeAt_ > now && HasPendingOutput())
+    {
+        timeout = std::min(timeout, until(uploadResumeAt_));
+    }
+    return timeout;
+}
+
+void PeerConnect::Finish()
+{
+    socket_.CloseConnection();
+    ReleasePieces();
+    std::cerr << "###CONNECTION ENDED###" << std::endl;
+
+    // `Finish` выполняется внутри корутины `Session`, а объект можно удалять только после того, как она завершится
+    if(onFinished_)
+    {
+        loop_->Post(std::move(onFinished_));
+        onFinished_ = nullptr;
+    }
 }
 
 bool PeerConnect::Failed() const
@@ -4,53 +4,87 @@
 #include "peer.h"
 #include "torrent_file.h"
 #include "piece_storage.h"
+#include "peer_pieces_availability.h"
+#include "event_loop.h"
+#include "message.h"
+#include "request_pipeline.h"
+#include "recv_buffer.h"
+#include "async_socket.h"
+#include "task.h"
+#include "file_storage.h"
+#include "token_bucket.h"
+#include <deque>
+#include <functional>
 
 /*
- * Структура, хранящая информацию о доступности частей скачиваемого файла у данного пира
+ * Класс, представляющий соединение с одним пиром.
+ * С помощью него можно подключиться к пиру и обмениваться с ним сообщениями.
+ * Весь обмен (подключение, handshake, bitfield, interested, цикл запросов) -- одна корутина `Session`, которая
+ * приостанавливается на ожидании сокета в цикле событий. Поэтому одно соединение занимает только фрейм корутины,
+ * а не поток, и много соединений обслуживаются несколькими потоками циклов событий.
+ * Соединение и раздает: сообщает пиру о сохраненных частях (bitfield, затем Have) и отвечает на его запросы блоков.
+ * Данные блоков отправляются прямо из файлов через sendfile, минуя память процесса. Отвечать ли на запросы пира,
+ * решает владелец соединения (см. Choker): до его решения пир зачокан
  */
-class PeerPiecesAvailability {
+class PeerConnect {
 public:
-    PeerPiecesAvailability() = default;
+    /*
+     * pipelineDepth -- сколько запросов блоков держать в полете одновременно.
+     * adaptivePipeline -- подстраивать ли это число под скорость и время отклика пира
+     */
+    PeerConnect(const Peer& peer, const TorrentFile& tf, std::string selfPeerId, PieceStorage& pieceStorage,
+                size_t pipelineDepth = RequestPipeline::DEFAULT_DEPTH, bool adaptivePipeline = true);
 
     /*
-     * bitfield -- массив байтов, в котором i-й бит означает наличие или отсутствие i-й части файла у пира
-     * https://wiki.theory.org/BitTorrentSpecification#bitfield:_.3Clen.3D0001.2BX.3E.3Cid.3D5.3E.3Cbitfield.3E
+     * Основная функция, в которой будет происходить цикл общения с пиром.
+     * Блокирующий вариант `Start`: крутит собственный цикл событий, пока общение с пиром не завершится
+     * https://wiki.theory.org/BitTorrentSpecification#Messages
      */
-    explicit PeerPiecesAvailability(std::string bitfield);
+    void Run();
 
     /*
-     * Если ли часть под номером `pieceIndex` у пира?
+     * Подключиться к пиру и дальше обслуживать соединение из цикла событий `loop`, не занимая отдельный поток.
+     * Вызывается из потока цикла. `onFinished` вызывается из потока цикла, когда общение с пиром завершено;
+     * после этого объект можно удалять
      */
-    bool IsPieceAvailable(size_t pieceIndex) const;
+    void Start(EventLoop& loop, std::function<void()> onFinished);
 
     /*
-     * Пометить часть под номером `pieceIndex` как доступную
+     * Соединение с пиром уже установлено (см. Connector): `Start` не будет подключаться заново. Вызывается до `Start`.
+     * inbound -- пир подключился к нам сам (см. Listener), тогда он первым присылает handshake
      */
-    void SetPieceAvailability(size_t pieceIndex);
+    void AdoptSocket(int sock, bool inbound = false);
+
+    void Terminate();
 
     /*
-     * Сколько бит хранится в bitfield'е
+     * Сколько байт данных блоков пир отдал нам и сколько мы отдали ему за время соединения.
+     * Можно вызывать из любого потока
      */
-    size_t Size() const;
-private:
-    std::string bitfield_;
-};
+    uint64_t DownloadedBytes() const;
+    uint64_t UploadedBytes() const;
 
-/*
- * Класс, представляющий соединение с одним пиром.
- * С помощью него можно подключиться к пиру и обмениваться с ним сообщениями
- */
-class PeerConnect {
-public:
-    PeerConnect(const Peer& peer, const TorrentFile& tf, std::string selfPeerId, PieceStorage& pieceStorage);
+    /*
+     * Пиру нужны наши части / мы не отвечаем на его запросы. Можно вызывать из любого потока
+     */
+    bool PeerInterested() const;
+    bool PeerChoked() const;
 
     /*
-     * Основная функция, в которой будет происходить цикл общения с пиром.
-     * https://wiki.theory.org/BitTorrentSpecification#Messages
+     * Ограничивать скорость соединения вместе с корзинами `upload` и `download` (торрента, см. TokenBucket): собственные
+     * корзины соединения вкладываются в них. Вызывается до `Start`
      */
-    void Run();
+    void LimitRate(TokenBucket& upload, TokenBucket& download);
 
-    void Terminate();
+    /*
+     * Ограничение скорости самого соединения, байт/с (0 -- без ограничения). Можно вызывать из любого потока
+     */
+    void SetRateLimit(uint64_t upload, uint64_t download);
+
+    /*
+     * Чокнуть или разчокнуть пира (решение чокера, см. Choker). Вызывается из потока цикла соединения
+     */
+    void SetPeerChoked(bool choked);
 
     /*
      * Соединение не удалось установить или оно было разорвано в результате ошибки.
@@ -64,36 +98,70 @@ private:
     PeerPiecesAvailability piecesAvailability_;
     std::atomic_bool terminated_;  // флаг, необходимый для завершения цикла общения с пиром
     bool choked_;  // https://wiki.theory.org/BitTorrentSpecification#Overview
-    PiecePtr pieceInProgress_;
+    std::atomic_bool peerChoked_;  // мы не отвечаем на запросы пира
+    std::atomic_bool peerInterested_;  // пиру нужны наши части
+    bool inbound_;  // пир подключился к нам сам
+    std::vector<PiecePtr> piecesInProgress_;  // части файла, блоки которых мы запрашиваем у этого пира
     PieceStorage& pieceStorage_;
-    bool pendingBlock_;  // уже послали запрос на скачивание части файла и ждем ответ
+    RequestPipeline pipeline_;  // запросы блоков, на которые мы еще ждем ответ
+    bool availabilityRegistered_;  // набор частей пира учтен в PieceStorage
     bool failed_;  // соединение не удалось установить или оно было разорвано в результате ошибки
 
+    EventLoop* loop_;  // цикл событий, в котором работает соединение
+    RecvBuffer recvBuffer_;  // принятые, но еще не разобранные байты
+
     /*
-     * Функция производит handshake.
-     * - Подключиться к пиру по протоколу TCP
-     * - Отправить пиру сообщение handshake
-     * - Проверить правильность ответа пира
-     * https://wiki.theory.org/BitTorrentSpecification#Handshake
+     * Блок, данные которого сейчас читаются из сокета прямо на свое место в части файла
      */
-    void PerformHandshake();
+    struct IncomingBlock {
+        PiecePtr piece;
+        uint32_t offset = 0;
+        char* target = nullptr;
+        size_t length = 0;
+        size_t received = 0;
+    };
+    IncomingBlock incoming_;
+    std::vector<char> discard_;  // сюда читаются блоки, которые уже получены от другого пира (endgame)
+    uint64_t seenEndgameBlocks_;  // значение `PieceStorage::EndgameBlocksReceived` при последней проверке запросов
+    std::string outbox_;  // данные, которые не удалось сразу отправить в сокет
 
     /*
-     * - Провести handshake
-     * - Получить bitfield с информацией о наличии у пира различных частей файла
-     * - Сообщить пиру, что мы готовы получать от него данные (отправить interested)
-     * Возвращает true, если все три этапа прошли без ошибок
+     * Блок, который сейчас отдается пиру: заголовок сообщения Piece идет из памяти, данные -- прямо из файлов
      */
-    bool EstablishConnection();
+    struct OutgoingBlock {
+        std::string header;  // еще не отправленная часть заголовка
+        std::vector<FileStorage::Segment> segments;  // еще не отправленные куски данных
+        size_t segment = 0;  // текущий кусок
+        size_t length = 0;
+        bool active = false;
+    };
+    OutgoingBlock outgoing_;
+    std::deque<BlockRequest> uploads_;  // запросы пира, которые ждут отправки
+    size_t announcedPieces_;  // о скольких сохраненных частях (по порядку сохранения) пир уже знает
+    std::atomic<uint64_t> downloadedBytes_;  // данные блоков, полученные от пира
+    std::atomic<uint64_t> uploadedBytes_;  // данные блоков, отправленные пиру
+    TokenBucket uploadLimit_;  // ограничение скорости отдачи этому пиру
+    TokenBucket downloadLimit_;  // ограничение скорости скачивания у этого пира: сколько блоков можно запросить
+    EventLoop::Clock::time_point uploadResumeAt_;  // раньше этого ограничение скорости не даст отправить блок
+    EventLoop::Clock::time_point requestResumeAt_;  // когда запрашивать блоки дальше, если запросы уперлись в ограничение
+    size_t flushedBytes_;  // сколько данных блоков отправлено за текущий вызов `FlushOutbox`
+    std::function<void()> onFinished_;
+    EventLoop::Clock::time_point lastActivity_;
+    EventLoop::Clock::time_point connectedAt_;
+    Task<> session_;  // корутина `Session`, пока соединение живо
 
     /*
-     * Функция читает из сокета bitfield с информацией о наличии у пира различных частей файла.
-     * Полученную информацию надо сохранить в поле `piecesAvailability_`.
-     * Также надо учесть, что сообщение тип Bitfield является опциональным, то есть пиры необязательно будут слать его.
-     * Вместо этого они могут сразу прислать сообщение Unchoke, поэтому надо быть готовым обработать его в этой функции.
-     * Обработка сообщения Unchoke заключается в выставлении флага `choked_` в значение `false`
+     * Все общение с пиром:
+     * - Подключиться к пиру по протоколу TCP
+     * - Отправить пиру сообщение handshake и проверить правильность ответа (для входящего соединения -- наоборот)
+     * - Сообщить пиру, какие части есть у нас (bitfield), если такие есть
+     * - Сообщить пиру, что мы готовы получать от него данные (отправить interested), если нам еще что-то нужно
+     * - Запрашивать и принимать блоки, а также отвечать на запросы пира в `MainLoop`. Bitfield пира опционален
+     *   и обрабатывается там же
+     * Ошибка на любом этапе завершает соединение с флагом `failed_`. В конце вызывается `Finish`
+     * https://wiki.theory.org/BitTorrentSpecification#Handshake
      */
-    void ReceiveBitfield();
+    Task<> Session();
 
     /*
      * Функция посылает пиру сообщение типа interested
@@ -101,17 +169,135 @@ private:
     void SendInterested();
 
     /*
-     * Функция отправляет пиру сообщение типа request. Это сообщение обозначает запрос части файла у пира.
+     * Сообщить пиру о частях, сохраненных на диск: сразу после handshake -- одним bitfield, потом -- сообщениями Have
+     * о частях, сохраненных с прошлого раза
+     */
+    void SendBitField();
+    void SendHaves();
+
+    /*
+     * Перестать / начать отвечать на запросы пира (Choke / Unchoke). При Choke очередь его запросов отбрасывается
+     */
+    void ChokePeer();
+    void UnchokePeer();
+
+    /*
+     * Функция отправляет пиру сообщения типа request. Это сообщение обозначает запрос части файла у пира.
      * За одно сообщение запрашивается не часть целиком, а блок данных размером 2^14 байт или меньше.
-     * Если в данный момент мы не знаем, какую часть файла надо запросить у пира, то надо получить эту информацию у
-     * PieceStorage
+     * Запросы отправляются, пока в полете не окажется `pipeline_.Depth()` блоков. Если блоки уже начатых частей
+     * закончились, то следующую часть файла, которая есть у пира, надо получить у PieceStorage
      */
     void RequestPiece();
 
+
     /*
      * Основной цикл общения с пиром. Здесь мы ждем следующее сообщение от пира и обрабатываем его.
-     * Также, если мы не ждем в данный момент от пира содержимого части файла, то надо отправить соответствующий запрос
+     * Также, если мы не ждем в данный момент от пира содержимого части файла, то надо отправить соответствующий запрос.
+     * Между сообщениями корутина ждет готовности сокета не дольше `WATCHDOG_PERIOD`, чтобы замечать `Terminate`
+     * и блоки, которые в endgame пришли от других пиров
+     */
+    Task<> MainLoop(AsyncSocket& socket);
+
+    /*
+     * Обработать одно сообщение от пира
+     */
+    void HandleMessage(const MessageView& message);
+
+    /*
+     * Запрос блока от пира (Request): проверить его и поставить в очередь на отправку
+     */
+    void QueueUpload(std::string_view payload);
+
+    /*
+     * Пир отменил запрос блока (Cancel). Блок, который уже начали отправлять, досылается
+     */
+    void CancelUpload(std::string_view payload);
+
+    /*
+     * Сообщение handshake и проверка ответа пира на него
+     */
+    std::string HandshakeMessage() const;
+    void CheckHandshake(std::string_view reply) const;
+
+    /*
+     * Прочитать из сокета то, что есть, не блокируясь: либо прямо в блок `incoming_`, либо в `recvBuffer_`.
+     * Возвращает количество прочитанных байт
+     */
+    size_t ReadFromSocket();
+
+    /*
+     * Разобрать все целые сообщения из `recvBuffer_`. Данные блоков сразу переносятся в буферы частей файла,
+     * а если блок пришел не целиком, то его остаток будет читаться из сокета прямо на свое место
+     */
+    void ProcessInbox();
+
+    /*
+     * Начало сообщения Piece: `header` -- номер части и смещение, `length` -- длина блока.
+     * Если мы запрашивали этот блок, то готовит `incoming_` и возвращает true
+     */
+    bool BeginBlock(std::string_view header, size_t length);
+
+    /*
+     * Блок `incoming_` получен целиком
+     */
+    void FinishBlock();
+
+    /*
+     * Часть файла из `piecesInProgress_` с номером `pieceIndex` или nullptr
+     */
+    PiecePtr FindPiece(size_t pieceIndex) const;
+
+    /*
+     * Режим endgame: отправить Cancel на запросы блоков, которые уже получены от других пиров,
+     * и отпустить части, которые другие пиры докачали
+     */
+    void CancelReceivedBlocks();
+
+    /*
+     * Послать данные пиру. То, что не поместилось в сокет, откладывается в `outbox_` и досылается из `MainLoop`
+     */
+    void Send(const std::string& data);
+
+    /*
+     * Вернуть в PieceStorage части файла, которые мы не докачали, и убрать части пира из подсчета доступности
+     */
+    void ReleasePieces();
+
+    /*
+     * Отправить из `outbox_` и из очереди запросов пира столько, сколько сокет готов принять.
+     * Сообщения и блоки идут в сокет целиком, не перемешиваясь: начатый блок досылается раньше новых сообщений
+     */
+    void FlushOutbox();
+
+    /*
+     * Начать отправку следующего блока из `uploads_`. Возвращает false, если отправлять нечего
+     */
+    bool StartUpload();
+
+    /*
+     * Досылать `outgoing_`, пока сокет принимает данные. Возвращает true, если блок отправлен целиком
+     */
+    bool SendOutgoingBlock();
+
+    /*
+     * Есть данные, которые ждут, пока сокет будет готов к записи
+     */
+    bool HasPendingOutput() const;
+
+    /*
+     * Есть данные, которые можно отправить, как только сокет будет готов (ограничение скорости их не держит)
+     */
+    bool CanWrite() const;
+
+    /*
+     * Сколько ждать событий сокета: до проверки таймаутов или до момента, когда ограничение скорости снова
+     * позволит запрашивать или отправлять блоки
+     */
+    std::chrono::milliseconds WaitTimeout() const;
+
+    /*
+     * Закрыть соединение, вернуть части и сообщить владельцу через `onFinished_`
      */
-    void MainLoop();
+    void Finish();
 };
 
@@ -0,0 +1,23 @@
+#include "peer_pieces_availability.h"
+
+PeerPiecesAvailability::PeerPiecesAvailability(size_t piecesCount) : bitfield_(piecesCount) {}
+
+PeerPiecesAvailability::PeerPiecesAvailability(std::string_view bitfield, size_t piecesCount)
+: bitfield_(Bitfield::FromBytes(bitfield, piecesCount)) {}
+
+bool PeerPiecesAvailability::IsPieceAvailable(size_t pieceIndex) const
+{
+    return bitfield_.Test(pieceIndex);
+}
+bool PeerPiecesAvailability::SetPieceAvailability(size_t pieceIndex)
+{
+    return bitfield_.Set(pieceIndex);
+}
+size_t PeerPiecesAvailability::Size() const
+{
+    return bitfield_.Count();
+}
+const Bitfield& PeerPiecesAvailability::Pieces() const
+{
+    return bitfield_;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "bitfield.h"
+#include <string>
+#include <string_view>
+
+/*
+ * Структура, хранящая информацию о доступности частей скачиваемого файла у данного пира
+ */
+class PeerPiecesAvailability {
+public:
+    PeerPiecesAvailability() = default;
+
+    /*
+     * Пир пока не сообщил ни об одной части. piecesCount -- число частей в торренте
+     */
+    explicit PeerPiecesAvailability(size_t piecesCount);
+
+    /*
+     * bitfield -- массив байтов, в котором i-й бит означает наличие или отсутствие i-й части файла у пира
+     * https://wiki.theory.org/BitTorrentSpecification#bitfield:_.3Clen.3D0001.2BX.3E.3Cid.3D5.3E.3Cbitfield.3E
+     * Биты за пределами `piecesCount` отбрасываются
+     */
+    PeerPiecesAvailability(std::string_view bitfield, size_t piecesCount);
+
+    /*
+     * Если ли часть под номером `pieceIndex` у пира?
+     */
+    bool IsPieceAvailable(size_t pieceIndex) const;
+
+    /*
+     * Пометить часть под номером `pieceIndex` как доступную.
+     * Возвращает false, если такой части в торренте нет (пир прислал Have с неверным номером)
+     */
+    bool SetPieceAvailability(size_t pieceIndex);
+
+    /*
+     * Сколько частей есть у пира
+     */
+    size_t Size() const;
+
+    /*
+     * Части пира в виде битового множества
+     */
+    const Bitfield& Pieces() const;
+private:
+    Bitfield bitfield_;
+};
@@ -0,0 +1,147 @@
+#include "peer_pool.h"
+#include <algorithm>
+#include <iostream>
+
+PeerPool::PeerPool(std::chrono::milliseconds baseBackoff, size_t maxFailures)
+: baseBackoff_(baseBackoff)
+, maxFailures_(std::max<size_t>(maxFailures, 1))
+{
+}
+
+size_t PeerPool::Add(const std::vector<Peer>& peers)
+{
+    size_t added = 0;
+    for(const Peer& peer : peers)
+    {
+        if(peers_.try_emplace(peer, Entry{State::NeverTried, 0, {}}).second)
+        {
+            ++counts_[static_cast<size_t>(State::NeverTried)];
+            fresh_.push_back(peer);
+            ++added;
+        }
+    }
+    return added;
+}
+
+std::optional<Peer> PeerPool::Next(Clock::time_point now)
+{
+    Peer peer;
+    if(!fresh_.empty())
+    {
+        peer = fresh_.front();
+        fresh_.pop_front();
+    }
+    else if(!retries_.empty() && retries_.begin()->first <= now)
+    {
+        peer = retries_.begin()->second;
+        retries_.erase(retries_.begin());
+    }
+    else
+    {
+        return std::nullopt;
+    }
+
+    SetState(peers_.at(peer), State::Connected);
+    return peer;
+}
+
+void PeerPool::OnDisconnected(const Peer& peer, bool failed, Clock::time_point now)
+{
+    auto it = peers_.find(peer);
+    if(it == peers_.end() || it->second.state != State::Connected) return;
+
+    Entry& entry = it->second;
+    if(!failed)
+    {
+        entry.failures = 0;
+        entry.retryAt = now + baseBackoff_;
+        SetState(entry, State::Disconnected);
+    }
+    else if(++entry.failures >= maxFailures_)
+    {
+        std::cerr << "Logger: peer " << peer.ToString() << " failed " << entry.failures << " times in a row, banned" << std::endl;
+        SetState(entry, State::Banned);
+        return;
+    }
+    else
+    {
+        // 2^(n-1) считаем сдвигом, пока он не упрется в потолок
+        auto backoff = baseBackoff_;
+        for(size_t i = 1; i < entry.failures && backoff < MAX_BACKOFF; ++i)
+        {
+            backoff *= 2;
+        }
+        entry.retryAt = now + std::min(backoff, MAX_BACKOFF);
+        SetState(entry, State::Failed);
+    }
+    retries_.emplace(entry.retryAt, it->first);
+}
+
+void PeerPool::Ban(const Peer& peer)
+{
+    auto it = peers_.find(peer);
+    if(it == peers_.end())
+    {
+        it = peers_.emplace(peer, Entry{State::NeverTried, 0, {}}).first;
+        ++counts_[static_cast<size_t>(State::NeverTried)];
+    }
+    else
+    {
+        CancelRetry(it->first, it->second);
+    }
+    SetState(it->second, State::Banned);
+}
+
+bool PeerPool::HasReady(Clock::time_point now) const
+{
+    return !fresh_.empty() || (!retries_.empty() && retries_.begin()->first <= now);
+}
+
+std::optional<PeerPool::Clock::time_point> PeerPool::NextRetry() const
+{
+    if(retries_.empty()) return std::nullopt;
+    return retries_.begin()->first;
+}
+
+PeerPool::State PeerPool::GetState(const Peer& peer) const
+{
+    auto it = peers_.find(peer);
+    return it == peers_.end() ? State::NeverTried : it->second.state;
+}
+
+size_t PeerPool::Count(State state) const
+{
+    return counts_[static_cast<size_t>(state)];
+}
+
+size_t PeerPool::Size() const
+{
+    return peers_.size();
+}
+
+void PeerPool::SetState(Entry& entry, State state)
+{
+    --counts_[static_cast<size_t>(entry.state)];
+    ++counts_[static_cast<size_t>(state)];
+    entry.state = state;
+}
+
+void PeerPool::CancelRetry(const Peer& peer, const Entry& entry)
+{
+    if(entry.state == State::NeverTried)
+    {
+        fresh_.erase(std::find(fresh_.begin(), fresh_.end(), peer));
+        return;
+    }
+    if(entry.state != State::Disconnected && entry.state != State::Failed) return;
+
+    auto [begin, end] = retries_.equal_range(entry.retryAt);
+    for(auto it = begin; it != end; ++it)
+    {
+        if(it->second == peer)
+        {
+            retries_.erase(it);
+            return;
+        }
+    }
+}
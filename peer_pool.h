@@ -0,0 +1,108 @@
+#pragma once
+
+#include "peer.h"
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <map>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * Все известные пиры торрента и их состояние.
+ * Пиры приходят от трекеров многократно и вперемешку, пул хранит каждый адрес один раз.
+ * Пир, к которому еще не подключались, выдается первым. Пир, соединение с которым завершилось, снова выдается
+ * только через паузу: после обычного завершения -- `baseBackoff`, после ошибки -- `baseBackoff * 2^(n-1)`,
+ * где n -- сколько раз подряд соединение с ним завершилось ошибкой (но не больше `MAX_BACKOFF`).
+ * После `maxFailures` ошибок подряд пир блокируется и больше не выдается, даже если трекер пришлет его снова.
+ * Пул не потокобезопасен: его владелец (DownloadManager) обращается к нему под своей блокировкой
+ */
+class PeerPool {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    enum class State {
+        NeverTried,  // еще не подключались
+        Connected,  // выдан и сейчас с ним идет соединение
+        Disconnected,  // соединение завершилось без ошибки
+        Failed,  // соединение завершилось ошибкой, ждем повтора
+        Banned  // больше не подключаемся
+    };
+
+    /*
+     * baseBackoff -- пауза перед повторным подключением к пиру.
+     * maxFailures -- после скольких ошибок подряд блокировать пира
+     */
+    explicit PeerPool(std::chrono::milliseconds baseBackoff = DEFAULT_BASE_BACKOFF, size_t maxFailures = DEFAULT_MAX_FAILURES);
+
+    /*
+     * Добавить пиров, уже известные пропускаются. Возвращает, сколько пиров оказались новыми
+     */
+    size_t Add(const std::vector<Peer>& peers);
+
+    /*
+     * Выдать пира, к которому можно подключиться прямо сейчас, и перевести его в состояние Connected.
+     * Сначала выдаются пиры, к которым еще не подключались, потом -- те, чья пауза истекла раньше всех
+     */
+    std::optional<Peer> Next(Clock::time_point now = Clock::now());
+
+    /*
+     * Соединение с выданным пиром завершилось, `failed` -- с ошибкой
+     */
+    void OnDisconnected(const Peer& peer, bool failed, Clock::time_point now = Clock::now());
+
+    /*
+     * Больше никогда не подключаться к пиру (например, он прислал испорченные данные)
+     */
+    void Ban(const Peer& peer);
+
+    /*
+     * Есть пир, которого `Next` выдаст прямо сейчас
+     */
+    bool HasReady(Clock::time_point now = Clock::now()) const;
+
+    /*
+     * Когда истечет ближайшая пауза. Пусто, если пиров, ждущих повтора, нет
+     */
+    std::optional<Clock::time_point> NextRetry() const;
+
+    State GetState(const Peer& peer) const;
+
+    /*
+     * Сколько пиров в состоянии `state`
+     */
+    size_t Count(State state) const;
+
+    /*
+     * Сколько пиров известно всего, включая заблокированных
+     */
+    size_t Size() const;
+
+    static constexpr std::chrono::milliseconds DEFAULT_BASE_BACKOFF{15000};
+    static constexpr std::chrono::milliseconds MAX_BACKOFF{30 * 60 * 1000};
+    static constexpr size_t DEFAULT_MAX_FAILURES = 5;
+private:
+    /*
+     * Состояние одного пира
+     */
+    struct Entry {
+        State state = State::NeverTried;
+        size_t failures = 0;  // ошибок подряд
+        Clock::time_point retryAt;  // когда можно подключаться снова, для Disconnected и Failed
+    };
+
+    const std::chrono::milliseconds baseBackoff_;
+    const size_t maxFailures_;
+    std::unordered_map<Peer, Entry, PeerHash> peers_;
+    std::deque<Peer> fresh_;  // пиры в состоянии NeverTried в порядке добавления
+    std::multimap<Clock::time_point, Peer> retries_;  // пиры, ждущие повтора, по времени окончания паузы
+    size_t counts_[5] = {};  // число пиров в каждом состоянии
+
+    void SetState(Entry& entry, State state);
+
+    /*
+     * Убрать пира из `retries_`
+     */
+    void CancelRetry(const Peer& peer, const Entry& entry);
+};
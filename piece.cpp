@@ -1,18 +1,22 @@
 #include "byte_tools.h"
 #include "piece.h"
+#include <cstring>
 namespace {
 constexpr size_t BLOCK_SIZE = 1 << 14;
 }
 Block::Block()
-: status(Status::Missing) {}
+: status(Status::Missing)
+, receiving(false) {}
 
 
-Piece::Piece(size_t index, size_t length, std::string hash)
+Piece::Piece(size_t index, size_t length, std::string hash, BufferPool& pool)
 : index_(index)
 , length_(length)
 , hash_(std::move(hash))
 , blocks_(length / BLOCK_SIZE + bool(length % BLOCK_SIZE), Block())
 , retrieved_counter(0)
+, pool_(pool)
+, hashedBlocks_(0)
 {
     SplitIntoBlocks();
 }
@@ -34,30 +38,133 @@ size_t Piece::GetIndex() const
 
 void Piece::SaveBlock(size_t blockOffset, std::string data)
 {
-    int block_index = blockOffset / BLOCK_SIZE;
+    char* target = BlockTarget(blockOffset, data.size());
 
-    if(blocks_[block_index].status == Block::Status::Pending)
+    if(target)
+    {
+        memcpy(target, data.data(), data.size());
+        CommitBlock(blockOffset);
+    }
+}
+
+Block* Piece::FindBlock(size_t blockOffset)
+{
+    size_t block_index = blockOffset / BLOCK_SIZE;
+
+    if(blockOffset % BLOCK_SIZE || block_index >= blocks_.size())
+    {
+        return nullptr;
+    }
+    return &blocks_[block_index];
+}
+
+bool Piece::IsValidBlock(size_t blockOffset, size_t length) const
+{
+    size_t block_index = blockOffset / BLOCK_SIZE;
+    return blockOffset % BLOCK_SIZE == 0 && block_index < blocks_.size() && blocks_[block_index].length == length;
+}
+
+char* Piece::BlockTarget(size_t blockOffset, size_t length)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto block = FindBlock(blockOffset);
+    if(!block || block->length != length || block->status == Block::Status::Retrieved || block->receiving)
+    {
+        return nullptr;
+    }
+
+    if(!buffer_)
+    {
+        buffer_ = pool_.Acquire(length_);
+    }
+    block->receiving = true;
+    return buffer_.Data() + blockOffset;
+}
+
+bool Piece::CommitBlock(size_t blockOffset)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto& block = blocks_[blockOffset / BLOCK_SIZE];
+    block.receiving = false;
+
+    if(block.status != Block::Status::Retrieved)
     {
         ++retrieved_counter;
-        blocks_[block_index].data = std::move(data);
-        blocks_[block_index].status = Block::Status::Retrieved;
+        block.status = Block::Status::Retrieved;
+        HashReadyBlocks();
+        return retrieved_counter == blocks_.size();
+    }
+    return false;
+}
+
+void Piece::AbortBlock(size_t blockOffset)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    blocks_[blockOffset / BLOCK_SIZE].receiving = false;
+}
+
+bool Piece::IsBlockRetrieved(size_t blockOffset) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return blocks_[blockOffset / BLOCK_SIZE].status == Block::Status::Retrieved;
+}
+
+std::optional<Block> Piece::RequestBlock(bool duplicate, const std::function<bool(const Block&)>& skip)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    for(auto& block : blocks_)
+    {
+        if(block.status == Block::Status::Missing)
+        {
+            block.status = Block::Status::Pending;
+            return block;
+        }
     }
 
+    if(duplicate)
+    {
+        for(auto& block : blocks_)
+        {
+            if(block.status == Block::Status::Pending && !block.receiving && !(skip && skip(block)))
+            {
+                return block;
+            }
+        }
+    }
+    return std::nullopt;
+}
+
+void Piece::HashReadyBlocks()
+{
+    while(hashedBlocks_ < blocks_.size() && blocks_[hashedBlocks_].status == Block::Status::Retrieved)
+    {
+        const auto& block = blocks_[hashedBlocks_];
+        hasher_.Update(std::string_view(buffer_.Data() + block.offset, block.length));
+        ++hashedBlocks_;
+    }
+
+    if(hashedBlocks_ == blocks_.size() && dataHash_.empty())
+    {
+        dataHash_ = hasher_.Final();
+    }
 }
 
 bool Piece::AllBlocksRetrieved() const
 {
+    std::lock_guard<std::mutex> lock(mutex_);
     return retrieved_counter == blocks_.size();
 }
 
-std::string Piece::GetData() const
+std::string_view Piece::GetData() const
 {
-    std::string data;
-    for(const auto& block : blocks_)
+    if(!buffer_)
     {
-        data += block.data;
+        return {};
     }
-    return data;
+    return {buffer_.Data(), length_};
 }
 
 const std::string& Piece::GetHash() const
@@ -67,17 +174,51 @@ const std::string& Piece::GetHash() const
 
 std::string Piece::GetDataHash() const
 {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(!dataHash_.empty())
+    {
+        return dataHash_;
+    }
     return CalculateSHA1(GetData());
 }
 
 void Piece::Reset()
 {
+    std::lock_guard<std::mutex> lock(mutex_);
     retrieved_counter = 0;
     for(auto& block : blocks_)
     {
         block.status = Block::Status::Missing;
-        block.data.clear();
+        block.receiving = false;
     }
+    buffer_.Release();
+    hasher_.Reset();
+    hashedBlocks_ = 0;
+    dataHash_.clear();
+}
+
+void Piece::ResetPending()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for(auto& block : blocks_)
+    {
+        if(block.status == Block::Status::Pending)
+        {
+            block.status = Block::Status::Missing;
+        }
+    }
+}
+
+bool Piece::HasRetrievedBlocks() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return retrieved_counter > 0;
+}
+
+void Piece::ReleaseData()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    buffer_.Release();
 }
 
 bool Piece::HashMatches() const
@@ -87,6 +228,7 @@ bool Piece::HashMatches() const
 
 Block* Piece::FirstMissingBlock()
 {
+    std::lock_guard<std::mutex> lock(mutex_);
     for(auto& block : blocks_)
     {
         if(block.status == Block::Status::Missing) return &block;
@@ -97,6 +239,7 @@ Block* Piece::FirstMissingBlock()
 
 void Piece::SetPended(size_t offset)
 {
+    std::lock_guard<std::mutex> lock(mutex_);
     int block_index = offset / BLOCK_SIZE;
 
     blocks_[block_index].status = Block::Status::Pending;
@@ -4,7 +4,10 @@
 #include <vector>
 #include <optional>
 #include <memory>
+#include <mutex>
+#include <functional>
 #include "byte_tools.h"
+#include "buffer_pool.h"
 
 /*
  * Части файла скачиваются не за одно сообщение, а блоками размером 2^14 байт или меньше (последний блок обычно меньше)
@@ -21,11 +24,13 @@ struct Block {
     uint32_t offset;  // смещение начала блока относительно начала части файла в байтах
     uint32_t length;  // длина блока в байтах
     Status status;  // статус загрузки данного блока
-    std::string data;  // бинарные данные
+    bool receiving;  // данные блока прямо сейчас записываются в буфер части одним из пиров
 };
 
 /*
- * Часть скачиваемого файла
+ * Часть скачиваемого файла.
+ * Обычно часть качается одним пиром, но в режиме endgame ее блоки запрашиваются у нескольких пиров сразу,
+ * поэтому все методы, меняющие состояние блоков, потокобезопасны
  */
 class Piece {
 public:
@@ -33,13 +38,15 @@ public:
      * index -- номер части файла, нумерация начинается с 0
      * length -- длина части файла. Все части, кроме последней, имеют длину, равную `torrentFile.pieceLength`
      * hash -- хеш-сумма части файла, взятая из `torrentFile.pieceHashes`
+     * pool -- пул, из которого берется буфер под данные части
      * +
      */
-    Piece(size_t index, size_t length, std::string hash);
+    Piece(size_t index, size_t length, std::string hash, BufferPool& pool = BufferPool::Instance());
 
     void SetPended(size_t offset);
     /*
-     * Совпадает ли хеш скачанных данных с ожидаемым
+     * Совпадает ли хеш скачанных данных с ожидаемым.
+     * Хеш считается по мере получения блоков, поэтому после получения последнего блока проверка почти бесплатна
      */
     bool HashMatches() const;
 
@@ -48,6 +55,18 @@ public:
      */
     Block* FirstMissingBlock();
 
+    /*
+     * Выбрать следующий блок для запроса и сразу отметить его как Pending.
+     * Обычно подходят только Missing блоки. В режиме endgame (`duplicate` = true) подходят и блоки, уже запрошенные
+     * у других пиров, кроме тех, для которых `skip` вернет true (например, уже запрошенных у этого же пира)
+     */
+    std::optional<Block> RequestBlock(bool duplicate = false, const std::function<bool(const Block&)>& skip = {});
+
+    /*
+     * Получен ли уже блок со смещением `blockOffset`
+     */
+    bool IsBlockRetrieved(size_t blockOffset) const;
+
     /*
      * Получить порядковый номер части файла +
      */
@@ -58,6 +77,31 @@ public:
      */
     void SaveBlock(size_t blockOffset, std::string data);
 
+    /*
+     * Есть ли в части блок со смещением `blockOffset` и длиной `length`
+     */
+    bool IsValidBlock(size_t blockOffset, size_t length) const;
+
+    /*
+     * Место, куда надо записать данные блока со смещением `blockOffset` и длиной `length`,
+     * чтобы они сразу оказались на своем месте и их не пришлось копировать еще раз.
+     * Возвращает nullptr, если блок не нужен: он неверный, уже получен или прямо сейчас записывается другим пиром
+     * (в режиме endgame один блок может прийти от нескольких пиров).
+     * После записи данных надо вызвать `CommitBlock`
+     */
+    char* BlockTarget(size_t blockOffset, size_t length);
+
+    /*
+     * Данные блока, полученного через `BlockTarget`, записаны полностью.
+     * Возвращает true, если этот блок был последним недостающим, то есть часть скачана целиком
+     */
+    bool CommitBlock(size_t blockOffset);
+
+    /*
+     * Запись блока, начатая через `BlockTarget`, прервана (например, соединение с пиром разорвано)
+     */
+    void AbortBlock(size_t blockOffset);
+
     /*
      * Скачали ли уже все блоки +
      */
@@ -65,8 +109,9 @@ public:
 
     /*
      * Получить скачанные данные для части файла +
+     * Данные лежат в одном непрерывном буфере, блоки записываются в него по своим смещениям
      */
-    std::string GetData() const;
+    std::string_view GetData() const;
 
     /*
      * Посчитать хеш по скачанным данным +
@@ -80,9 +125,25 @@ public:
 
     /*
      * Удалить все скачанные данные и отметить все блоки как Missing +
+     * Буфер с данными возвращается в пул
      */
     void Reset();
 
+    /*
+     * Отметить запрошенные, но еще не полученные блоки как Missing. Полученные блоки сохраняются
+     */
+    void ResetPending();
+
+    /*
+     * Получен ли хотя бы один блок
+     */
+    bool HasRetrievedBlocks() const;
+
+    /*
+     * Вернуть буфер с данными в пул, не меняя статусы блоков (например, после сохранения части на диск)
+     */
+    void ReleaseData();
+
     /*
      * Вернуть длину куска
      */
@@ -92,7 +153,24 @@ private:
     const size_t index_, length_;
     const std::string hash_;
     std::vector<Block> blocks_;
-    int retrieved_counter;
+    size_t retrieved_counter;  // сколько блоков уже получено
+    BufferPool& pool_;
+    mutable std::mutex mutex_;  // защищает состояние блоков, буфер и хеш
+    BufferPool::Buffer buffer_;  // данные части, берется из пула при получении первого блока
+    Sha1Context hasher_;  // хеш уже полученного непрерывного начала части
+    size_t hashedBlocks_;  // сколько первых блоков учтено в `hasher_`
+    std::string dataHash_;  // хеш всех данных, когда он посчитан
+
+    /*
+     * Учесть в хеше блоки, которые продолжают уже посчитанное начало части.
+     * Блоки, пришедшие не по порядку, ждут в буфере, пока перед ними не появятся все предыдущие
+     */
+    void HashReadyBlocks();
+
+    /*
+     * Блок, в который попадает смещение `blockOffset`, или nullptr, если смещение неверное
+     */
+    Block* FindBlock(size_t blockOffset);
 
     void SplitIntoBlocks(); // +
 };
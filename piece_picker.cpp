@@ -0,0 +1,198 @@
+#include "piece_picker.h"
+#include <algorithm>
+#include <utility>
+
+PiecePicker::PiecePicker(size_t piecesCount)
+: availability_(piecesCount, 0)
+, position_(piecesCount, NONE)
+, bucketStart_(1, 0)
+, wanted_(piecesCount)
+{
+    order_.reserve(piecesCount);
+}
+
+void PiecePicker::AddPeer(const PeerPiecesAvailability& peer)
+{
+    const Bitfield& pieces = peer.Pieces();
+    for(size_t i = pieces.FindNext(); i != Bitfield::npos && i < availability_.size(); i = pieces.FindNext(i + 1))
+    {
+        IncrementAvailability(i);
+    }
+}
+
+void PiecePicker::RemovePeer(const PeerPiecesAvailability& peer)
+{
+    const Bitfield& pieces = peer.Pieces();
+    for(size_t i = pieces.FindNext(); i != Bitfield::npos && i < availability_.size(); i = pieces.FindNext(i + 1))
+    {
+        DecrementAvailability(i);
+    }
+}
+
+void PiecePicker::IncrementAvailability(size_t pieceIndex)
+{
+    uint32_t bucket = availability_[pieceIndex];
+
+    if(position_[pieceIndex] != NONE)
+    {
+        if(bucketStart_.size() <= bucket + 1)
+        {
+            bucketStart_.resize(bucket + 2, order_.size());
+        }
+        // переставляем часть в конец ее корзины и сдвигаем границу: теперь она первая в следующей корзине
+        Swap(position_[pieceIndex], BucketEnd(bucket) - 1);
+        --bucketStart_[bucket + 1];
+    }
+    ++availability_[pieceIndex];
+}
+
+void PiecePicker::DecrementAvailability(size_t pieceIndex)
+{
+    uint32_t bucket = availability_[pieceIndex];
+    if(bucket == 0) return;
+
+    if(position_[pieceIndex] != NONE)
+    {
+        // переставляем часть в начало ее корзины и сдвигаем границу: теперь она последняя в предыдущей корзине
+        Swap(position_[pieceIndex], bucketStart_[bucket]);
+        ++bucketStart_[bucket];
+    }
+    --availability_[pieceIndex];
+}
+
+size_t PiecePicker::Availability(size_t pieceIndex) const
+{
+    return availability_[pieceIndex];
+}
+
+std::optional<size_t> PiecePicker::Pick(const PeerPiecesAvailability& peer)
+{
+    // сколько кандидатов есть у пира: если ни одного, то и искать нечего
+    const Bitfield& pieces = peer.Pieces();
+    size_t common = wanted_.CountAnd(pieces);
+    if(common == 0)
+    {
+        return std::nullopt;
+    }
+
+    uint32_t best = NONE;
+
+    for(uint32_t pieceIndex : partial_)
+    {
+        if(peer.IsPieceAvailable(pieceIndex) && (best == NONE || availability_[pieceIndex] < availability_[best]))
+        {
+            best = pieceIndex;
+        }
+    }
+
+    // если общих частей мало, дешевле перебрать их по словам пересечения, чем искать в порядке редкости:
+    // проход по `order_` в среднем проверяет order_.size() / common частей
+    if(best == NONE && common <= wanted_.Words().size())
+    {
+        for(size_t i = wanted_.FindNextAnd(pieces); i != Bitfield::npos; i = wanted_.FindNextAnd(pieces, i + 1))
+        {
+            if(availability_[i] > 0 && (best == NONE || availability_[i] < availability_[best]))
+            {
+                best = i;
+            }
+        }
+    }
+
+    // части с нулевой доступностью пропускаем: раз пир учтен в доступности, у него их точно нет
+    for(uint32_t i = BucketEnd(0); best == NONE && i < order_.size(); ++i)
+    {
+        if(peer.IsPieceAvailable(order_[i]))
+        {
+            best = order_[i];
+        }
+    }
+
+    if(best == NONE)
+    {
+        return std::nullopt;
+    }
+
+    Remove(best);
+    return best;
+}
+
+void PiecePicker::Add(size_t pieceIndex, bool partial)
+{
+    if(position_[pieceIndex] != NONE) return;
+
+    uint32_t bucket = availability_[pieceIndex];
+    if(bucketStart_.size() <= bucket)
+    {
+        bucketStart_.resize(bucket + 1, order_.size());
+    }
+
+    // добавляем часть в конец последней корзины и опускаем до своей, переставляя с первым элементом каждой корзины
+    order_.push_back(pieceIndex);
+    wanted_.Set(pieceIndex);
+    uint32_t i = order_.size() - 1;
+    position_[pieceIndex] = i;
+    for(size_t b = bucketStart_.size() - 1; b > bucket; --b)
+    {
+        Swap(i, bucketStart_[b]);
+        i = bucketStart_[b]++;
+    }
+
+    if(partial)
+    {
+        partial_.push_back(pieceIndex);
+    }
+}
+
+void PiecePicker::Remove(size_t pieceIndex)
+{
+    uint32_t i = position_[pieceIndex];
+    if(i == NONE) return;
+
+    // поднимаем часть в конец массива, переставляя с последним элементом каждой корзины
+    for(size_t b = availability_[pieceIndex]; ; ++b)
+    {
+        uint32_t last = BucketEnd(b) - 1;
+        Swap(i, last);
+        i = last;
+        if(b + 1 >= bucketStart_.size()) break;
+        --bucketStart_[b + 1];
+    }
+    order_.pop_back();
+    position_[pieceIndex] = NONE;
+    wanted_.Reset(pieceIndex);
+
+    auto it = std::find(partial_.begin(), partial_.end(), pieceIndex);
+    if(it != partial_.end())
+    {
+        *it = partial_.back();
+        partial_.pop_back();
+    }
+}
+
+bool PiecePicker::Contains(size_t pieceIndex) const
+{
+    return position_[pieceIndex] != NONE;
+}
+
+size_t PiecePicker::Size() const
+{
+    return order_.size();
+}
+
+bool PiecePicker::Empty() const
+{
+    return order_.empty();
+}
+
+uint32_t PiecePicker::BucketEnd(size_t bucket) const
+{
+    return bucket + 1 < bucketStart_.size() ? bucketStart_[bucket + 1] : order_.size();
+}
+
+void PiecePicker::Swap(uint32_t i, uint32_t j)
+{
+    if(i == j) return;
+    std::swap(order_[i], order_[j]);
+    position_[order_[i]] = i;
+    position_[order_[j]] = j;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "peer_pieces_availability.h"
+#include "bitfield.h"
+#include <cstdint>
+#include <cstddef>
+#include <optional>
+#include <vector>
+
+/*
+ * Выбор следующей части файла для скачивания по стратегии rarest first.
+ * Для каждой части хранится, у скольких подключенных пиров она есть (доступность в рое).
+ * Части-кандидаты (которые еще надо скачать и которые сейчас никто не качает) лежат в массиве, упорядоченном
+ * по доступности и разбитом на корзины с одинаковой доступностью. Изменение доступности части на единицу --
+ * это один обмен с границей соседней корзины, то есть O(1), поэтому Have от любого пира обрабатывается за
+ * константу даже при сотнях тысяч частей.
+ * Части, которые уже начали качать и вернули недокачанными, выдаются в первую очередь, чтобы не держать в памяти
+ * много полускачанных частей.
+ * Кандидаты дублируются в битовом множестве, так что есть ли у пира нужные нам части и сколько их, узнается одним
+ * проходом по словам его bitfield'а
+ * https://www.bittorrent.org/beps/bep_0003.html, раздел "piece downloading strategy"
+ */
+class PiecePicker {
+public:
+    explicit PiecePicker(size_t piecesCount);
+
+    /*
+     * Учесть появление и уход пира с набором частей `peer`
+     */
+    void AddPeer(const PeerPiecesAvailability& peer);
+    void RemovePeer(const PeerPiecesAvailability& peer);
+
+    /*
+     * У одного из пиров появилась (Have) или пропала часть `pieceIndex`
+     */
+    void IncrementAvailability(size_t pieceIndex);
+    void DecrementAvailability(size_t pieceIndex);
+
+    /*
+     * У скольких пиров есть часть `pieceIndex`
+     */
+    size_t Availability(size_t pieceIndex) const;
+
+    /*
+     * Выбрать самую редкую из частей-кандидатов, которая есть у пира `peer`, предпочитая уже начатые части.
+     * Выбранная часть перестает быть кандидатом, пока ее не вернут через `Add`
+     */
+    std::optional<size_t> Pick(const PeerPiecesAvailability& peer);
+
+    /*
+     * Сделать часть кандидатом. `partial` -- часть уже частично скачана
+     */
+    void Add(size_t pieceIndex, bool partial = false);
+
+    /*
+     * Убрать часть из кандидатов
+     */
+    void Remove(size_t pieceIndex);
+
+    /*
+     * Является ли часть кандидатом
+     */
+    bool Contains(size_t pieceIndex) const;
+
+    /*
+     * Сколько частей-кандидатов осталось
+     */
+    size_t Size() const;
+    bool Empty() const;
+private:
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    std::vector<uint32_t> availability_;  // доступность каждой части
+    std::vector<uint32_t> order_;  // кандидаты, упорядоченные по доступности
+    std::vector<uint32_t> position_;  // позиция части в `order_` или NONE
+    std::vector<uint32_t> bucketStart_;  // bucketStart_[a] -- индекс в `order_`, с которого начинаются части с доступностью a
+    std::vector<uint32_t> partial_;  // начатые части-кандидаты
+    Bitfield wanted_;  // те же кандидаты, что и в `order_`
+
+    /*
+     * Индекс в `order_`, на котором заканчивается корзина `bucket`
+     */
+    uint32_t BucketEnd(size_t bucket) const;
+
+    void Swap(uint32_t i, uint32_t j);
+};
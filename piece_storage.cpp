@@ -1,50 +1,180 @@
 #include "piece_storage.h"
+#include "byte_tools.h"
+#include "sha1_batch.h"
 #include <iostream>
 #include <cassert>
+#include <algorithm>
+#include <thread>
+
+namespace {
+constexpr size_t RESUME_SAVE_INTERVAL = 64;  // через сколько сохраненных частей обновлять данные для возобновления
+constexpr size_t HASH_LENGTH = 20;
+constexpr size_t DISK_WRITER_THREADS = 1;  // один поток записи лучше склеивает соседние части
+}
 
 using shared_lock = std::shared_lock<std::shared_mutex>;
 using unique_lock = std::unique_lock<std::shared_mutex>;
 using lock_guard = std::lock_guard<std::shared_mutex>;
 
-PieceStorage::PieceStorage(const TorrentFile &tf, const std::filesystem::path& outputDirectory)
-: TotalPiecesCounter_(tf.pieceHashes.size())
+PieceStorage::PieceStorage(const TorrentFile &tf, const std::filesystem::path& outputDirectory,
+                           DiskWriter::Backend diskBackend)
+: pieceHashes_(tf.pieceHashes)
+, length_(tf.length)
+, picker_(tf.PiecesCount())
+, saved_(tf.PiecesCount())
+, endgame_(false)
+, endgameBlocks_(0)
+, savedBytes_(0)
+, downloadedBytes_(0)
+, uploadedBytes_(0)
+, TotalPiecesCounter_(tf.PiecesCount())
 , OFFSET_(tf.pieceLength)
-, stream_(outputDirectory / tf.name, std::ios::binary | std::ios::out)
+, resumePath_(outputDirectory / (tf.name + ".resume"))
+, files_(outputDirectory, tf.files.empty() ? std::vector<TorrentFileEntry>{{tf.name, tf.length, 0}} : tf.files)
+, piecesSinceResumeSave_(0)
 {
-    if(!stream_.is_open())
-    {
-        throw std::runtime_error("Error: cannot create or find file");
-    }
+    // существующие файлы не обрезаем: в них могут быть уже скачанные части
+    bool existed = files_.HasExistingData();
 
-    std::cerr << "Logger: Piece Storage was created, OFFSET_ = " << OFFSET_ << std::endl;
+    auto resume = ResumeData::Load(resumePath_);
+    bool resumeValid = resume && resume->infoHash == tf.infoHash
+            && resume->FitsPieces(TotalPiecesCounter_)
+            && resume->files == files_.Stamps();
 
-    stream_.seekp(tf.length - 1);
-    stream_.write("\0", 1);
+    files_.Prepare();
+    // регион под части, которые качаются и ждут записи (нужен только io_uring)
+    size_t regionPieces = 2 * DiskWriter::DEFAULT_MAX_QUEUED_BYTES / tf.pieceLength + 1;
+    writer_ = std::make_unique<DiskWriter>(files_, DISK_WRITER_THREADS, DiskWriter::DEFAULT_MAX_QUEUED_BYTES, true, diskBackend,
+                                           BufferPool::Instance(), tf.pieceLength, std::min(regionPieces, TotalPiecesCounter_));
 
-    assert(tf.pieceHashes.size() == tf.length / tf.pieceLength + bool(tf.length % tf.pieceLength)
+    std::cerr << "Logger: Piece Storage was created, OFFSET_ = " << OFFSET_ << std::endl;
+
+    assert(TotalPiecesCounter_ == tf.length / tf.pieceLength + bool(tf.length % tf.pieceLength)
             && OFFSET_ == tf.pieceLength);
 
-    for(int cur_piece_index = 0; cur_piece_index < tf.pieceHashes.size(); ++cur_piece_index)
+    std::vector<char> verified(TotalPiecesCounter_, false);
+    if(resumeValid)
+    {
+        for(size_t i = 0; i < TotalPiecesCounter_; ++i)
+        {
+            verified[i] = resume->HasPiece(i);
+        }
+        std::cerr << "Logger: resume data loaded from " << resumePath_ << std::endl;
+    }
+    else if(existed)
     {
-        PushPiece(std::make_shared<Piece>(
-                cur_piece_index,
-                (cur_piece_index != tf.pieceHashes.size() - 1) ? tf.pieceLength : (tf.length % tf.pieceLength) ? tf.length % tf.pieceLength : tf.pieceLength,
-                tf.pieceHashes[cur_piece_index]));
+        std::cerr << "Logger: resume data is missing or stale, rechecking existing data" << std::endl;
+        verified = RecheckExistingData();
     }
+
+    resume_.infoHash = tf.infoHash;
+    resume_.ResetPieces(TotalPiecesCounter_);
+    for(size_t cur_piece_index = 0; cur_piece_index < TotalPiecesCounter_; ++cur_piece_index)
+    {
+        if(verified[cur_piece_index])
+        {
+            saved_.Set(cur_piece_index);
+            PiecesSavedToDisk_.emplace_back(cur_piece_index);
+            savedBytes_ += PieceLength(cur_piece_index);
+            resume_.SetPiece(cur_piece_index);
+        }
+        else
+        {
+            picker_.Add(cur_piece_index);
+        }
+    }
+
+    std::cerr << "Logger: " << PiecesSavedToDisk_.size() << " of " << TotalPiecesCounter_
+              << " pieces are already on disk" << std::endl;
+
+    std::lock_guard<std::mutex> lock(resume_mutex_);
+    SaveResumeData();
 }
 PieceStorage::~PieceStorage()
 {
     CloseOutputFile();
 }
-PiecePtr PieceStorage::GetNextPieceToDownload()
+PiecePtr PieceStorage::GetNextPieceToDownload(const PeerPiecesAvailability& peer)
+{
+    lock_guard lock(queue_mutex_);
+
+    auto pieceIndex = picker_.Pick(peer);
+    if(!pieceIndex) return nullptr;
+
+    ++holders_[*pieceIndex];
+    UpdateEndgame();
+    return ActivePiece(*pieceIndex);
+}
+
+bool PieceStorage::InEndgame() const
+{
+    return endgame_;
+}
+
+PiecePtr PieceStorage::GetEndgamePiece(const PeerPiecesAvailability& peer, const std::vector<PiecePtr>& exclude)
 {
     lock_guard lock(queue_mutex_);
-    
-    if(remainPieces_.empty()) return nullptr;
 
-    auto to_return = remainPieces_.front();
-    remainPieces_.pop();
-    return to_return;
+    if(!picker_.Empty()) return nullptr;
+
+    size_t best = TotalPiecesCounter_;
+    size_t bestHolders = 0;
+    for(const auto& [pieceIndex, holders] : holders_)
+    {
+        if(!peer.IsPieceAvailable(pieceIndex) || (best != TotalPiecesCounter_ && bestHolders <= holders))
+        {
+            continue;
+        }
+        bool excluded = std::any_of(exclude.begin(), exclude.end(), [index = pieceIndex](const PiecePtr& piece) {
+            return piece->GetIndex() == index;
+        });
+        if(!excluded && !ActivePiece(pieceIndex)->AllBlocksRetrieved())
+        {
+            best = pieceIndex;
+            bestHolders = holders;
+        }
+    }
+
+    if(best == TotalPiecesCounter_) return nullptr;
+
+    ++holders_[best];
+    return ActivePiece(best);
+}
+
+void PieceStorage::BlockReceived()
+{
+    if(endgame_)
+    {
+        ++endgameBlocks_;
+    }
+}
+
+uint64_t PieceStorage::EndgameBlocksReceived() const
+{
+    return endgameBlocks_;
+}
+
+void PieceStorage::UpdateEndgame()
+{
+    endgame_ = picker_.Empty() && !holders_.empty();
+}
+
+void PieceStorage::AddPeer(const PeerPiecesAvailability& peer)
+{
+    lock_guard lock(queue_mutex_);
+    picker_.AddPeer(peer);
+}
+
+void PieceStorage::RemovePeer(const PeerPiecesAvailability& peer)
+{
+    lock_guard lock(queue_mutex_);
+    picker_.RemovePeer(peer);
+}
+
+void PieceStorage::PeerHasPiece(size_t pieceIndex)
+{
+    lock_guard lock(queue_mutex_);
+    picker_.IncrementAvailability(pieceIndex);
 }
 
 void PieceStorage::PieceProcessed(const PiecePtr& piece)
@@ -54,18 +184,30 @@ void PieceStorage::PieceProcessed(const PiecePtr& piece)
         piece->Reset();
 
         lock_guard lock(queue_mutex_);
-        remainPieces_.push(piece);
+        auto it = holders_.find(piece->GetIndex());
+        if(it == holders_.end() || --it->second == 0)
+        {
+            // если часть качают и другие пиры (endgame), они докачают ее заново
+            holders_.erase(piece->GetIndex());
+            active_.erase(piece->GetIndex());
+            picker_.Add(piece->GetIndex());
+        }
+        UpdateEndgame();
     }
     else
     {
         SavePieceToDisk(piece);
+
+        lock_guard lock(queue_mutex_);
+        holders_.erase(piece->GetIndex());
+        UpdateEndgame();
     }
 }
 
 bool PieceStorage::QueueIsEmpty() const
 {
     shared_lock lock(queue_mutex_);
-    return remainPieces_.empty();
+    return picker_.Empty();
 }
 
 const std::vector<size_t>& PieceStorage::GetPiecesSavedToDiscIndices() const
@@ -73,6 +215,50 @@ const std::vector<size_t>& PieceStorage::GetPiecesSavedToDiscIndices() const
     return PiecesSavedToDisk_;
 }
 
+std::vector<size_t> PieceStorage::SavedPiecesSince(size_t from) const
+{
+    shared_lock lock(queue_mutex_);
+    if(from >= PiecesSavedToDisk_.size()) return {};
+    return std::vector<size_t>(PiecesSavedToDisk_.begin() + from, PiecesSavedToDisk_.end());
+}
+
+Bitfield PieceStorage::SavedPieces() const
+{
+    shared_lock lock(queue_mutex_);
+    return saved_;
+}
+
+bool PieceStorage::MapBlock(size_t pieceIndex, uint32_t offset, uint32_t length,
+                            std::vector<FileStorage::Segment>& segments) const
+{
+    if(pieceIndex >= TotalPiecesCounter_ || length == 0 || uint64_t(offset) + length > PieceLength(pieceIndex))
+    {
+        return false;
+    }
+    {
+        shared_lock lock(queue_mutex_);
+        if(!saved_.Test(pieceIndex)) return false;
+    }
+    // сохраненная часть уже не меняется, поэтому отображать ее на файлы можно без блокировки
+    files_.MapRange(pieceIndex * OFFSET_ + offset, length, segments);
+    return true;
+}
+
+FileStorage::FileHandle PieceStorage::OpenFile(size_t file)
+{
+    return files_.Open(file);
+}
+
+void PieceStorage::BlockUploaded(size_t length)
+{
+    uploadedBytes_ += length;
+}
+
+uint64_t PieceStorage::UploadedBytes() const
+{
+    return uploadedBytes_;
+}
+
 size_t PieceStorage::TotalPiecesCount() const
 {
     return TotalPiecesCounter_;
@@ -80,8 +266,16 @@ size_t PieceStorage::TotalPiecesCount() const
 
 void PieceStorage::CloseOutputFile()
 {
-    std::lock_guard<std::mutex> lock(stream_mutex_);
-    if(stream_.is_open()) stream_.close();
+    // завершение записи берет `resume_mutex_`, поэтому ждем его без блокировки
+    if(writer_) writer_->Drain();
+
+    std::lock_guard<std::mutex> lock(resume_mutex_);
+    if(writer_)
+    {
+        writer_.reset();
+        SaveResumeData();
+        files_.CloseAll();
+    }
 }
 
 size_t PieceStorage::PiecesSavedToDiscCount() const
@@ -90,47 +284,181 @@ size_t PieceStorage::PiecesSavedToDiscCount() const
     return PiecesSavedToDisk_.size();
 }
 
-void PieceStorage::PushPiece(PiecePtr piece)
+uint64_t PieceStorage::BytesLeft() const
 {
-    lock_guard lock(queue_mutex_);
-    remainPieces_.push(piece);
+    shared_lock lock(queue_mutex_);
+    return length_ - savedBytes_;
 }
 
-void PieceStorage::ClearQueue()
+uint64_t PieceStorage::DownloadedBytes() const
+{
+    return downloadedBytes_;
+}
+
+void PieceStorage::PushPiece(PiecePtr piece)
 {
     lock_guard lock(queue_mutex_);
-    while(!remainPieces_.empty())
+
+    auto it = holders_.find(piece->GetIndex());
+    if(it != holders_.end())
     {
-        remainPieces_.pop();
+        if(--it->second > 0) return;  // часть еще качают другие пиры
+        holders_.erase(it);
     }
+
+    if(!saved_.Test(piece->GetIndex()) && !piece->AllBlocksRetrieved())
+    {
+        piece->ResetPending();
+        bool partial = piece->HasRetrievedBlocks();
+        if(!partial)
+        {
+            // не начатой части состояние не нужно, оно создастся заново, когда ее выдадут
+            active_.erase(piece->GetIndex());
+        }
+        picker_.Add(piece->GetIndex(), partial);
+    }
+    UpdateEndgame();
 }
 
 size_t PieceStorage::PiecesInProgressCount() const
 {
     shared_lock lock(queue_mutex_);
-    return TotalPiecesCounter_ - remainPieces_.size() - PiecesSavedToDisk_.size();
+    return TotalPiecesCounter_ - picker_.Size() - PiecesSavedToDisk_.size();
 }
 
 void PieceStorage::SavePieceToDisk(const PiecePtr& piece)
 {
-    std::lock_guard<std::mutex> lock(stream_mutex_);
-
     std::cerr << "Logger: trying to save piece with idx = " << piece->GetIndex() << std::endl;
 
-    if(!stream_.is_open())
+    if(!writer_)
     {
         throw std::runtime_error("Error: cannot save piece");
     }
 
+    auto data = piece->GetData();
+    assert(data.size() == piece->Length());
+
+    // буфер части живет до завершения записи: его держит `piece`, захваченный в callback
+    writer_->Write(piece->GetIndex() * OFFSET_, data, [this, piece](bool ok) {
+        OnPieceWritten(piece, ok);
+    });
+}
+
+void PieceStorage::OnPieceWritten(const PiecePtr& piece, bool ok)
+{
+    if(!ok)
+    {
+        std::cerr << "Logger: piece with idx = " << piece->GetIndex() << " was not saved, it will be downloaded again" << std::endl;
+        piece->Reset();
+
+        lock_guard lock(queue_mutex_);
+        picker_.Add(piece->GetIndex());
+        UpdateEndgame();
+        return;
+    }
+
+    piece->ReleaseData();
+    downloadedBytes_ += piece->Length();
     {
-        lock_guard q_lock(queue_mutex_);
+        lock_guard lock(queue_mutex_);
         PiecesSavedToDisk_.emplace_back(piece->GetIndex());
+        saved_.Set(piece->GetIndex());
+        savedBytes_ += piece->Length();
+        // пиры, которые еще держат указатель на часть, увидят, что она скачана
+        active_.erase(piece->GetIndex());
     }
 
-    assert(piece->GetData().size() == piece->Length());
+    std::cerr << "Logger: piece with idx = " << piece->GetIndex() << " was successfully saved, its length = " << piece->Length() << std::endl;
 
-    stream_.seekp(piece->GetIndex() * OFFSET_, std::ios::beg);
-    stream_.write(piece->GetData().data(), piece->Length());
+    std::lock_guard<std::mutex> lock(resume_mutex_);
+    resume_.SetPiece(piece->GetIndex());
+    if(++piecesSinceResumeSave_ >= RESUME_SAVE_INTERVAL)
+    {
+        SaveResumeData();
+    }
+}
 
-    std::cerr << "Logger: piece with idx = " << piece->GetIndex() << " was successfully saved, its length = " << piece->Length() << std::endl;
+void PieceStorage::SaveResumeData()
+{
+    piecesSinceResumeSave_ = 0;
+    try
+    {
+        // в `resume_` попадают только части, запись которых уже завершена
+        resume_.files = files_.Stamps();
+        resume_.Save(resumePath_);
+    } catch(const std::exception& e)
+    {
+        std::cerr << "Logger: cannot save resume data -- " << e.what() << std::endl;
+    }
+}
+
+std::vector<char> PieceStorage::RecheckExistingData()
+{
+    std::vector<char> verified(TotalPiecesCounter_, false);
+    std::atomic<size_t> nextPiece = 0;
+
+    // части хешируются пакетами: соседние части одной длины считаются одновременно на дорожках SIMD
+    size_t batchSize = Sha1BatchWidth();
+    auto worker = [&] {
+        std::vector<std::string> buffers(batchSize);
+        std::vector<std::string_view> messages;
+        std::vector<size_t> indices;
+        for(size_t first; (first = nextPiece.fetch_add(batchSize)) < TotalPiecesCounter_;)
+        {
+            messages.clear();
+            indices.clear();
+            for(size_t pieceIndex = first; pieceIndex < std::min(first + batchSize, TotalPiecesCounter_); ++pieceIndex)
+            {
+                auto& buffer = buffers[pieceIndex - first];
+                buffer.resize(PieceLength(pieceIndex));
+                if(files_.Read(pieceIndex * OFFSET_, buffer.data(), buffer.size()))
+                {
+                    messages.emplace_back(buffer);
+                    indices.push_back(pieceIndex);
+                }
+            }
+
+            auto hashes = CalculateSHA1Batch(messages);
+            for(size_t i = 0; i < indices.size(); ++i)
+            {
+                verified[indices[i]] = hashes[i] == std::string_view(pieceHashes_).substr(indices[i] * HASH_LENGTH, HASH_LENGTH);
+            }
+        }
+    };
+
+    size_t threadsCount = std::clamp<size_t>(std::thread::hardware_concurrency(), 1, std::max<size_t>(TotalPiecesCounter_, 1));
+    std::vector<std::thread> threads;
+    for(size_t i = 1; i < threadsCount; ++i)
+    {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for(auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    std::cerr << "Logger: recheck found " << std::count(verified.begin(), verified.end(), true)
+              << " valid pieces using " << threadsCount << " thread(s)" << std::endl;
+    return verified;
+}
+
+size_t PieceStorage::PieceLength(size_t pieceIndex) const
+{
+    if(pieceIndex != TotalPiecesCounter_ - 1 || length_ % OFFSET_ == 0)
+    {
+        return OFFSET_;
+    }
+    return length_ % OFFSET_;
+}
+
+const PiecePtr& PieceStorage::ActivePiece(size_t pieceIndex)
+{
+    auto& piece = active_[pieceIndex];
+    if(!piece)
+    {
+        piece = std::make_shared<Piece>(pieceIndex, PieceLength(pieceIndex),
+                                        pieceHashes_.substr(pieceIndex * HASH_LENGTH, HASH_LENGTH));
+    }
+    return piece;
 }
\ No newline at end of file
@@ -2,28 +2,80 @@
 
 #include "torrent_file.h"
 #include "piece.h"
-#include <queue>
+#include "piece_picker.h"
+#include "peer_pieces_availability.h"
+#include "bitfield.h"
+#include "resume_data.h"
+#include "disk_writer.h"
+#include "file_storage.h"
 #include <string>
 #include <unordered_set>
 #include <shared_mutex>
 #include <mutex>
-#include <fstream>
+#include <memory>
 #include <filesystem>
 #include <atomic>
+#include <unordered_map>
 
 /*
  * Хранилище информации о частях скачиваемого файла.
- * В этом классе отслеживается информация о том, какие части файла осталось скачать
+ * В этом классе отслеживается информация о том, какие части файла осталось скачать.
+ * Части выдаются пирам по стратегии rarest first (см. PiecePicker), для этого каждый пир сообщает сюда,
+ * какие части у него есть.
+ * Когда все оставшиеся части уже кому-то выданы, начинается режим endgame: те же части выдаются и другим пирам,
+ * у которых они есть, чтобы последние блоки не ждали одного медленного пира. Дубликаты запросов отменяются
+ * сообщением Cancel, как только блок пришел от кого-нибудь одного
+ * https://wiki.theory.org/BitTorrentSpecification#End_Game
+ * Торрент может состоять из нескольких файлов, части нарезаются из их общего потока данных (см. FileStorage).
+ * Проверенные части пишутся на диск асинхронно (см. DiskWriter), и сетевые потоки не ждут диска.
+ * Рядом с файлом хранятся данные для возобновления (см. ResumeData), так что после перезапуска уже сохраненные части
+ * не скачиваются заново. Если этих данных нет или файл с тех пор менялся, существующий файл перепроверяется по хешам
  */
 class PieceStorage {
 public:
-    PieceStorage(const TorrentFile& tf, const std::filesystem::path& outputDirectory);
+    /*
+     * diskBackend -- чем писать части на диск. Для io_uring под буферы частей заранее выделяется регион пула,
+     * чтобы данные писались из зарегистрированных в ядре буферов
+     */
+    PieceStorage(const TorrentFile& tf, const std::filesystem::path& outputDirectory,
+                 DiskWriter::Backend diskBackend = DiskWriter::Backend::Pwrite);
     ~PieceStorage();
 
     /*
-     * Отдает указатель на следующую часть файла, которую надо скачать
+     * Отдает указатель на следующую часть файла, которую надо скачать у пира с набором частей `peer`:
+     * самую редкую в рое из тех, что у него есть, причем уже начатые части выдаются в первую очередь.
+     * Возвращает nullptr, если у пира нет нужных нам частей
+     */
+    PiecePtr GetNextPieceToDownload(const PeerPiecesAvailability& peer);
+
+    /*
+     * Режим endgame: все оставшиеся части уже качаются, но еще не докачаны
+     */
+    bool InEndgame() const;
+
+    /*
+     * В режиме endgame отдает часть, которую уже качают другие пиры, но которая есть и у пира `peer`
+     * (ту, которую качает меньше всего пиров). Части из `exclude` (уже выданные этому пиру) не выдаются
+     */
+    PiecePtr GetEndgamePiece(const PeerPiecesAvailability& peer, const std::vector<PiecePtr>& exclude);
+
+    /*
+     * В режиме endgame пир получил очередной блок. Остальные пиры по счетчику `EndgameBlocksReceived`
+     * узнают, что пора проверить свои запросы и отменить ставшие ненужными
+     */
+    void BlockReceived();
+    uint64_t EndgameBlocksReceived() const;
+
+    /*
+     * Пир с набором частей `peer` подключился / отключился. Нужно для подсчета доступности частей в рое
      */
-    PiecePtr GetNextPieceToDownload();
+    void AddPeer(const PeerPiecesAvailability& peer);
+    void RemovePeer(const PeerPiecesAvailability& peer);
+
+    /*
+     * У одного из подключенных пиров появилась часть `pieceIndex` (сообщение Have)
+     */
+    void PeerHasPiece(size_t pieceIndex);
 
     /*
      * Эта функция вызывается из PeerConnect, когда скачивание одной части файла завершено.
@@ -40,6 +92,39 @@ public:
      * Отдает список номеров частей файла, которые были сохранены на диск
      */
     const std::vector<size_t>& GetPiecesSavedToDiscIndices() const;
+
+    /*
+     * Номера частей, сохраненных на диск, начиная с `from`-й по порядку сохранения.
+     * Соединения запоминают, сколько частей уже анонсировали, и рассылают Have только о новых
+     */
+    std::vector<size_t> SavedPiecesSince(size_t from) const;
+
+    /*
+     * Части, сохраненные на диск, в виде битового множества (например, для сообщения bitfield)
+     */
+    Bitfield SavedPieces() const;
+
+    /*
+     * Раздача: где на диске лежит блок [offset, offset + length) части `pieceIndex`. Куски по файлам добавляются
+     * в `segments`. Возвращает false, если части еще нет на диске или блок выходит за ее границы
+     */
+    bool MapBlock(size_t pieceIndex, uint32_t offset, uint32_t length, std::vector<FileStorage::Segment>& segments) const;
+
+    /*
+     * Открыть файл торрента, чтобы отправить из него блок (см. `MapBlock`)
+     */
+    FileStorage::FileHandle OpenFile(size_t file);
+
+    /*
+     * Пиру отправлен блок длиной `length`
+     */
+    void BlockUploaded(size_t length);
+
+    /*
+     * Сколько байт отдано пирам за время работы (поле uploaded анонса трекеру)
+     */
+    uint64_t UploadedBytes() const;
+
     /*
      * Сколько частей файла всего
      */
@@ -51,12 +136,24 @@ public:
     size_t PiecesSavedToDiscCount() const;
 
     /*
-     * Закрыть поток вывода в файл
+     * Сколько байт файла еще не сохранено на диск (поле left анонса трекеру)
+     */
+    uint64_t BytesLeft() const;
+
+    /*
+     * Сколько байт скачано и сохранено за время работы, без частей, найденных на диске при запуске
+     * (поле downloaded анонса трекеру)
+     */
+    uint64_t DownloadedBytes() const;
+
+    /*
+     * Дождаться записи всех частей, сохранить данные для возобновления и закрыть файлы
      */
     void CloseOutputFile();
 
     /*
-     * Запушить кусок в очередь
+     * Пир больше не качает часть. Если ее не качает никто другой и она не докачана, то она вернется в число
+     * кандидатов, чтобы ее выдали другому пиру. Уже полученные блоки сохраняются
      */
     void PushPiece(PiecePtr piece);
 
@@ -65,21 +162,58 @@ public:
      */
     size_t PiecesInProgressCount() const;
 private:
-    std::queue<PiecePtr> remainPieces_;  // очередь частей файла, которые осталось скачать
+    const std::string pieceHashes_;  // хеши частей подряд, по 20 байт на часть
+    const size_t length_;
+    std::unordered_map<size_t, PiecePtr> active_;  // части, которые качаются или начаты; остальные -- только биты в `saved_`
+    PiecePicker picker_;  // части файла, которые осталось скачать и которые сейчас никто не качает
+    std::unordered_map<size_t, size_t> holders_;  // части, которые сейчас качаются -> сколько пиров их качает
+    Bitfield saved_;  // части, сохраненные на диск
+    std::atomic_bool endgame_;
+    std::atomic<uint64_t> endgameBlocks_;
     std::vector<size_t> PiecesSavedToDisk_;
+    uint64_t savedBytes_;  // суммарная длина частей в `saved_`
+    std::atomic<uint64_t> downloadedBytes_;
+    std::atomic<uint64_t> uploadedBytes_;
     const size_t TotalPiecesCounter_;
     const size_t OFFSET_;
-    std::ofstream stream_;
+    const std::filesystem::path resumePath_;
+    FileStorage files_;
+    std::unique_ptr<DiskWriter> writer_;
+    ResumeData resume_;  // защищен `resume_mutex_`
+    size_t piecesSinceResumeSave_;
     mutable std::shared_mutex queue_mutex_;
-    mutable std::mutex stream_mutex_;
+    mutable std::mutex resume_mutex_;
 
     /*
-     * Сохранить piece на диск
+     * Поставить piece в очередь на запись на диск. Сама запись идет в потоке `writer_`
      */
     void SavePieceToDisk(const PiecePtr& piece);
 
     /*
-     * Почистить очередь
+     * Запись piece завершена (вызывается из потока записи). Если записать не удалось, часть качается заново
+     */
+    void OnPieceWritten(const PiecePtr& piece, bool ok);
+
+    /*
+     * Записать данные для возобновления. Вызывается под `resume_mutex_`
+     */
+    void SaveResumeData();
+
+    /*
+     * Проверить хеши частей, уже лежащих в файле. Файл читается в несколько потоков
+     */
+    std::vector<char> RecheckExistingData();
+
+    size_t PieceLength(size_t pieceIndex) const;
+
+    /*
+     * Состояние части `pieceIndex`. Оно создается, только когда часть выдается пиру, и удаляется после записи части
+     * на диск, так что в памяти живут только качающиеся части. Вызывается под `queue_mutex_`
+     */
+    const PiecePtr& ActivePiece(size_t pieceIndex);
+
+    /*
+     * Пересчитать флаг `endgame_`. Вызывается под `queue_mutex_`
      */
-    void ClearQueue();
+    void UpdateEndgame();
 };
@@ -0,0 +1,62 @@
+#include "recv_buffer.h"
+#include <cstring>
+
+RecvBuffer::RecvBuffer(size_t capacity)
+: buffer_(new char[capacity])
+, capacity_(capacity)
+, head_(0)
+, tail_(0)
+{}
+
+std::string_view RecvBuffer::Data() const
+{
+    return {buffer_.get() + head_, tail_ - head_};
+}
+
+size_t RecvBuffer::Size() const
+{
+    return tail_ - head_;
+}
+
+void RecvBuffer::Consume(size_t size)
+{
+    head_ += size;
+    if(head_ == tail_)
+    {
+        head_ = tail_ = 0;
+    }
+}
+
+void RecvBuffer::Reserve(size_t size)
+{
+    if(size <= capacity_) return;
+
+    std::unique_ptr<char[]> buffer(new char[size]);
+    memcpy(buffer.get(), buffer_.get() + head_, Size());
+    tail_ -= head_;
+    head_ = 0;
+    buffer_ = std::move(buffer);
+    capacity_ = size;
+}
+
+char* RecvBuffer::WriteBegin()
+{
+    // переносим остаток в начало, если свободного места в хвосте осталось меньше четверти буфера
+    if(head_ > 0 && capacity_ - tail_ < capacity_ / 4)
+    {
+        memmove(buffer_.get(), buffer_.get() + head_, Size());
+        tail_ -= head_;
+        head_ = 0;
+    }
+    return buffer_.get() + tail_;
+}
+
+size_t RecvBuffer::WriteCapacity() const
+{
+    return capacity_ - tail_;
+}
+
+void RecvBuffer::Commit(size_t size)
+{
+    tail_ += size;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string_view>
+
+/*
+ * Переиспользуемый буфер приема данных из сокета, один на соединение.
+ * Данные дописываются в хвост и забираются с головы. Когда место в хвосте заканчивается, непрочитанный остаток
+ * (обычно это начало недочитанного сообщения) переносится в начало буфера, поэтому память выделяется только при
+ * создании буфера или если одно сообщение не помещается в него целиком.
+ * Непрочитанные данные всегда лежат непрерывно, так что сообщения можно разбирать прямо в буфере, без копирования
+ */
+class RecvBuffer {
+public:
+    explicit RecvBuffer(size_t capacity = DEFAULT_CAPACITY);
+
+    /*
+     * Принятые, но еще не разобранные данные.
+     * Указатель действителен до следующего вызова `Consume`, `Reserve` или `WriteBegin`
+     */
+    std::string_view Data() const;
+    size_t Size() const;
+
+    /*
+     * Отметить первые `size` байт как разобранные
+     */
+    void Consume(size_t size);
+
+    /*
+     * Гарантировать, что в буфере поместится `size` непрочитанных байт (например, целое сообщение)
+     */
+    void Reserve(size_t size);
+
+    /*
+     * Куда и сколько байт можно дописать. После записи надо вызвать `Commit`
+     */
+    char* WriteBegin();
+    size_t WriteCapacity() const;
+    void Commit(size_t size);
+
+    static constexpr size_t DEFAULT_CAPACITY = 1 << 16;
+private:
+    std::unique_ptr<char[]> buffer_;
+    size_t capacity_;
+    size_t head_;  // начало непрочитанных данных
+    size_t tail_;  // конец непрочитанных данных
+};
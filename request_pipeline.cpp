@@ -0,0 +1,129 @@
+#include "request_pipeline.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+constexpr double TYPICAL_BLOCK_SIZE = 1 << 14;
+constexpr auto MEASURE_WINDOW = std::chrono::seconds(1);
+constexpr double RATE_SMOOTHING = 0.3;  // вес нового окна в сглаженной скорости
+}
+
+RequestPipeline::RequestPipeline(size_t depth, bool adaptive)
+: depth_(std::clamp(depth, MIN_DEPTH, MAX_DEPTH))
+, adaptive_(adaptive)
+, rate_(0)
+, rtt_(0)
+, windowStart_(Clock::now())
+, windowBytes_(0)
+, windowRtt_(std::chrono::microseconds::max())
+{}
+
+void RequestPipeline::Configure(size_t depth, bool adaptive)
+{
+    depth_ = std::clamp(depth, MIN_DEPTH, MAX_DEPTH);
+    adaptive_ = adaptive;
+}
+
+size_t RequestPipeline::Size() const
+{
+    return requests_.size();
+}
+
+size_t RequestPipeline::Depth() const
+{
+    return depth_;
+}
+
+bool RequestPipeline::Full() const
+{
+    return requests_.size() >= depth_;
+}
+
+bool RequestPipeline::Empty() const
+{
+    return requests_.empty();
+}
+
+void RequestPipeline::Push(uint32_t piece, uint32_t offset, uint32_t length)
+{
+    requests_.push_back({piece, offset, length, Clock::now()});
+}
+
+bool RequestPipeline::Complete(uint32_t piece, uint32_t offset)
+{
+    // пиры обычно отвечают в порядке запросов, поэтому искомый запрос почти всегда первый
+    auto it = std::find_if(requests_.begin(), requests_.end(), [&](const BlockRequest& request) {
+        return request.piece == piece && request.offset == offset;
+    });
+    if(it == requests_.end())
+    {
+        return false;
+    }
+
+    auto now = Clock::now();
+    windowRtt_ = std::min(windowRtt_, std::chrono::duration_cast<std::chrono::microseconds>(now - it->sentAt));
+    windowBytes_ += it->length;
+    requests_.erase(it);
+
+    if(now - windowStart_ >= MEASURE_WINDOW)
+    {
+        double seconds = std::chrono::duration<double>(now - windowStart_).count();
+        double windowRate = windowBytes_ / seconds;
+        rate_ = rate_ == 0 ? windowRate : rate_ * (1 - RATE_SMOOTHING) + windowRate * RATE_SMOOTHING;
+        rtt_ = rtt_.count() == 0 ? windowRtt_ : (rtt_ * 3 + windowRtt_) / 4;
+
+        windowStart_ = now;
+        windowBytes_ = 0;
+        windowRtt_ = std::chrono::microseconds::max();
+
+        UpdateDepth();
+    }
+    return true;
+}
+
+bool RequestPipeline::Contains(uint32_t piece, uint32_t offset) const
+{
+    return std::any_of(requests_.begin(), requests_.end(), [&](const BlockRequest& request) {
+        return request.piece == piece && request.offset == offset;
+    });
+}
+
+void RequestPipeline::Cancel(uint32_t piece, uint32_t offset)
+{
+    auto it = std::find_if(requests_.begin(), requests_.end(), [&](const BlockRequest& request) {
+        return request.piece == piece && request.offset == offset;
+    });
+    if(it != requests_.end())
+    {
+        requests_.erase(it);
+    }
+}
+
+void RequestPipeline::Clear()
+{
+    requests_.clear();
+}
+
+const std::deque<BlockRequest>& RequestPipeline::Requests() const
+{
+    return requests_;
+}
+
+double RequestPipeline::Rate() const
+{
+    return rate_;
+}
+
+std::chrono::microseconds RequestPipeline::Rtt() const
+{
+    return rtt_;
+}
+
+void RequestPipeline::UpdateDepth()
+{
+    if(!adaptive_) return;
+
+    // сколько блоков помещается в канал к пиру, и еще столько же про запас, чтобы канал рос, пока не упрется в предел
+    double bdpBlocks = rate_ * std::chrono::duration<double>(rtt_).count() / TYPICAL_BLOCK_SIZE;
+    depth_ = std::clamp<size_t>(std::ceil(bdpBlocks) * 2 + 1, MIN_DEPTH, MAX_DEPTH);
+}
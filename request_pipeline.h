@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <chrono>
+#include <deque>
+
+/*
+ * Запрос одного блока, на который мы еще не получили ответ
+ */
+struct BlockRequest {
+    uint32_t piece;  // номер части файла
+    uint32_t offset;  // смещение блока внутри части
+    uint32_t length;  // длина блока
+    std::chrono::steady_clock::time_point sentAt;  // когда запрос был отправлен
+};
+
+/*
+ * Очередь запросов блоков, отправленных одному пиру (pipelining).
+ * Чтобы канал к пиру не простаивал, держим в полете сразу несколько запросов, а не ждем ответа на каждый.
+ * Глубина очереди задается явно или подстраивается под пира: в адаптивном режиме глубина следует за
+ * произведением измеренной скорости пира на время отклика (bandwidth-delay product), выраженным в блоках,
+ * с запасом, чтобы очередь не опустошалась между ответами.
+ * https://wiki.theory.org/BitTorrentSpecification#Queuing
+ */
+class RequestPipeline {
+public:
+    /*
+     * depth -- начальная глубина очереди.
+     * adaptive -- подстраивать ли глубину под скорость и время отклика пира
+     */
+    explicit RequestPipeline(size_t depth = DEFAULT_DEPTH, bool adaptive = true);
+
+    /*
+     * Задать глубину очереди и режим ее подстройки
+     */
+    void Configure(size_t depth, bool adaptive);
+
+    /*
+     * Сколько запросов сейчас в полете и сколько их можно держать одновременно
+     */
+    size_t Size() const;
+    size_t Depth() const;
+    bool Full() const;
+    bool Empty() const;
+
+    /*
+     * Запомнить отправленный запрос
+     */
+    void Push(uint32_t piece, uint32_t offset, uint32_t length);
+
+    /*
+     * Пришел ответ на запрос блока. Удаляет запрос из очереди и обновляет оценки скорости и времени отклика.
+     * Возвращает false, если такой блок мы не запрашивали
+     */
+    bool Complete(uint32_t piece, uint32_t offset);
+
+    /*
+     * Есть ли в очереди запрос блока
+     */
+    bool Contains(uint32_t piece, uint32_t offset) const;
+
+    /*
+     * Убрать запрос из очереди без обновления оценок (мы отменили его сообщением Cancel)
+     */
+    void Cancel(uint32_t piece, uint32_t offset);
+
+    /*
+     * Забыть все запросы (например, пир нас зачокал и их не выполнит)
+     */
+    void Clear();
+
+    /*
+     * Запросы в порядке отправки
+     */
+    const std::deque<BlockRequest>& Requests() const;
+
+    /*
+     * Текущие оценки: скорость пира в байтах в секунду и минимальное наблюдаемое время отклика
+     */
+    double Rate() const;
+    std::chrono::microseconds Rtt() const;
+
+    static constexpr size_t DEFAULT_DEPTH = 16;
+    static constexpr size_t MIN_DEPTH = 2;
+    static constexpr size_t MAX_DEPTH = 500;
+private:
+    using Clock = std::chrono::steady_clock;
+
+    std::deque<BlockRequest> requests_;
+    size_t depth_;
+    bool adaptive_;
+    double rate_;  // экспоненциально сглаженная скорость, байт/с
+    std::chrono::microseconds rtt_;  // сглаженный минимум времени отклика, почти не включающий ожидание в очереди пира
+    Clock::time_point windowStart_;  // начало текущего окна измерений
+    size_t windowBytes_;  // сколько байт пришло в текущем окне
+    std::chrono::microseconds windowRtt_;  // минимальное время отклика в текущем окне
+
+    void UpdateDepth();
+};
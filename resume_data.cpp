@@ -0,0 +1,145 @@
+#include "resume_data.h"
+#include "bencode.h"
+#include "mapped_file.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+const std::string RESUME_FORMAT = "torrent-client-resume-1";
+}
+
+FileStamp FileStamp::Of(const std::filesystem::path& path)
+{
+    FileStamp stamp;
+    stamp.path = path.filename().string();
+    stamp.size = std::filesystem::file_size(path);
+    stamp.mtime = std::filesystem::last_write_time(path).time_since_epoch().count();
+    return stamp;
+}
+
+std::optional<ResumeData> ResumeData::Load(const std::filesystem::path& path)
+{
+    if(!std::filesystem::exists(path)) return std::nullopt;
+
+    try
+    {
+        MappedFile file(path.string());
+        auto document = bencode::Document::Parse(file.Data());
+        auto root = document.root();
+        if(root["format"].string() != RESUME_FORMAT || !root["files"].isList()) return std::nullopt;
+
+        ResumeData data;
+        data.infoHash = root["info hash"].string();
+        data.pieces = root["pieces"].string();
+        for(auto file : root["files"])
+        {
+            data.files.push_back({std::string(file["path"].string()), static_cast<uint64_t>(file["size"].integer()),
+                                  file["mtime"].integer()});
+        }
+        return data;
+    } catch(const std::exception&)
+    {
+        // поврежденные данные равносильны их отсутствию: файлы будут перепроверены
+        return std::nullopt;
+    }
+}
+
+void ResumeData::Save(const std::filesystem::path& path) const
+{
+    // файлы хранятся в порядке таблицы файлов торрента
+    std::vector<std::shared_ptr<bencode::bcType>> stamps;
+    for(const auto& file : files)
+    {
+        stamps.push_back(std::make_shared<bencode::Dictionary>(std::map<std::string, std::shared_ptr<bencode::bcType>>{
+                {"path", std::make_shared<bencode::String>(file.path)},
+                {"size", std::make_shared<bencode::Integer>(file.size)},
+                {"mtime", std::make_shared<bencode::Integer>(file.mtime)},
+        }));
+    }
+    bencode::Dictionary dict({
+            {"format", std::make_shared<bencode::String>(RESUME_FORMAT)},
+            {"info hash", std::make_shared<bencode::String>(infoHash)},
+            {"pieces", std::make_shared<bencode::String>(pieces)},
+            {"files", std::make_shared<bencode::List>(stamps)},
+    });
+
+    // данные сбрасываются на диск до rename, иначе после отключения питания переименование может сохраниться,
+    // а содержимое -- нет
+    auto tmpPath = path;
+    tmpPath += ".tmp";
+    std::string encoded = dict.encode();
+    int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd == -1)
+    {
+        throw std::runtime_error("Error: cannot create resume data file " + tmpPath.string() + ": " + strerror(errno));
+    }
+    for(size_t written = 0; written < encoded.size();)
+    {
+        ssize_t result = write(fd, encoded.data() + written, encoded.size() - written);
+        if(result == -1 && errno == EINTR) continue;
+        if(result == -1)
+        {
+            int error = errno;
+            close(fd);
+            throw std::runtime_error(std::string("Error: cannot write resume data: ") + strerror(error));
+        }
+        written += result;
+    }
+    if(fsync(fd) == -1)
+    {
+        int error = errno;
+        close(fd);
+        throw std::runtime_error(std::string("Error: cannot sync resume data: ") + strerror(error));
+    }
+    close(fd);
+    std::filesystem::rename(tmpPath, path);
+
+    // сама запись о переименовании хранится в каталоге
+    auto directory = path.parent_path().empty() ? std::filesystem::path(".") : path.parent_path();
+    int dirFd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(dirFd == -1)
+    {
+        throw std::runtime_error("Error: cannot open directory " + directory.string() + ": " + strerror(errno));
+    }
+    int synced = fsync(dirFd);
+    int error = errno;
+    close(dirFd);
+    if(synced == -1)
+    {
+        throw std::runtime_error(std::string("Error: cannot sync resume data directory: ") + strerror(error));
+    }
+}
+
+bool ResumeData::FitsPieces(size_t piecesCount) const
+{
+    size_t fullSize = (piecesCount + 7) / 8;
+    if(pieces.size() > fullSize) return false;
+    if(pieces.size() < fullSize || piecesCount % 8 == 0) return true;
+
+    // лишние биты последнего байта должны быть нулевыми
+    uint8_t spare = 0xFF >> (piecesCount % 8);
+    return (static_cast<uint8_t>(pieces.back()) & spare) == 0;
+}
+
+void ResumeData::ResetPieces(size_t piecesCount)
+{
+    pieces.assign((piecesCount + 7) / 8, 0);
+}
+
+bool ResumeData::HasPiece(size_t pieceIndex) const
+{
+    if((pieceIndex >> 3) >= pieces.size()) return false;
+    return pieces[pieceIndex >> 3] & (1 << (7 - pieceIndex % 8));
+}
+
+void ResumeData::SetPiece(size_t pieceIndex)
+{
+    if((pieceIndex >> 3) >= pieces.size())
+    {
+        pieces.resize((pieceIndex >> 3) + 1, 0);
+    }
+    pieces[pieceIndex >> 3] |= (1 << (7 - pieceIndex % 8));
+}
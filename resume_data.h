@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <optional>
+#include <filesystem>
+
+/*
+ * Отметка о состоянии файла на диске: по ней определяется, менялся ли файл с момента записи данных для возобновления
+ */
+struct FileStamp {
+    std::string path;
+    uint64_t size = 0;
+    int64_t mtime = 0;  // время последней модификации в единицах `std::filesystem::file_time_type`
+
+    /*
+     * Снять отметку с файла `path`
+     */
+    static FileStamp Of(const std::filesystem::path& path);
+
+    bool operator==(const FileStamp& other) const = default;
+};
+
+/*
+ * Данные для быстрого возобновления скачивания (fast resume).
+ * Хранятся рядом со скачиваемым файлом в формате bencode: info hash торрента, bitfield частей, которые уже проверены
+ * и сохранены на диск, и отметки о файлах. Если при запуске отметки совпадают с реальными файлами, проверенные части
+ * не нужно ни скачивать заново, ни перепроверять
+ */
+struct ResumeData {
+    std::string infoHash;
+    std::string pieces;  // i-й бит -- часть i проверена и сохранена, порядок битов как в сообщении BitField
+    std::vector<FileStamp> files;
+
+    /*
+     * Прочитать данные из файла. Возвращает std::nullopt, если файла нет или он поврежден
+     */
+    static std::optional<ResumeData> Load(const std::filesystem::path& path);
+
+    /*
+     * Записать данные в файл. Сначала пишется и сбрасывается на диск временный файл, который затем
+     * переименовывается, так что при падении или отключении питания посреди записи на диске останется
+     * предыдущая версия
+     */
+    void Save(const std::filesystem::path& path) const;
+
+    /*
+     * Подходит ли bitfield торренту из `piecesCount` частей: он не длиннее полного bitfield и не отмечает частей
+     * за последней. Недостающие в конце байты означают несохраненные части (так писали старые версии)
+     */
+    bool FitsPieces(size_t piecesCount) const;
+
+    /*
+     * Завести пустой bitfield на `piecesCount` частей
+     */
+    void ResetPieces(size_t piecesCount);
+
+    bool HasPiece(size_t pieceIndex) const;
+    void SetPiece(size_t pieceIndex);
+};
@@ -0,0 +1,539 @@
+#include "sha1_batch.h"
+#include "byte_tools.h"
+#include <immintrin.h>
+#include <cpuid.h>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+
+namespace {
+constexpr size_t BLOCK_SIZE = 64;
+constexpr size_t MAX_LANES = 16;
+constexpr uint32_t INITIAL_STATE[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+constexpr uint32_t ROUND_CONSTANTS[4] = {0x5A827999, 0x6ED9EBA1, 0x8F1BBCDC, 0xCA62C1D6};
+
+/*
+ * Сжатие `blocks` блоков. Состояние многодорожечных реализаций хранится по словам: state[i * lanes + lane]
+ */
+using SingleCompress = void (*)(uint32_t* state, const unsigned char* data, size_t blocks);
+using LanesCompress = void (*)(uint32_t* state, const unsigned char* const* lanes, size_t blocks);
+
+uint32_t Rol(uint32_t x, int n)
+{
+    return (x << n) | (x >> (32 - n));
+}
+
+uint32_t LoadBigEndian(const unsigned char* data)
+{
+    return (uint32_t(data[0]) << 24) | (uint32_t(data[1]) << 16) | (uint32_t(data[2]) << 8) | uint32_t(data[3]);
+}
+
+void CompressScalar(uint32_t* state, const unsigned char* data, size_t blocks)
+{
+    for(; blocks > 0; --blocks, data += BLOCK_SIZE)
+    {
+        uint32_t w[16];
+        for(int i = 0; i < 16; ++i)
+        {
+            w[i] = LoadBigEndian(data + 4 * i);
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+        for(int t = 0; t < 80; ++t)
+        {
+            if(t >= 16)
+            {
+                w[t & 15] = Rol(w[(t + 13) & 15] ^ w[(t + 8) & 15] ^ w[(t + 2) & 15] ^ w[t & 15], 1);
+            }
+            uint32_t f;
+            if(t < 20) f = d ^ (b & (c ^ d));
+            else if(t < 40 || t >= 60) f = b ^ c ^ d;
+            else f = (b & c) | (d & (b | c));
+
+            uint32_t temp = Rol(a, 5) + f + e + ROUND_CONSTANTS[t / 20] + w[t & 15];
+            e = d;
+            d = c;
+            c = Rol(b, 30);
+            b = a;
+            a = temp;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+    }
+}
+
+#pragma GCC push_options
+#pragma GCC target("sha,sse4.1")
+
+/*
+ * Четыре раунда SHA-NI. Расписание сообщения считается на лету: msg2 заканчивает слова следующей четверки,
+ * msg1 и xor начинают слова четверок через две и три
+ */
+#define SHA_NI_ROUNDS(current, next, afterNext, last, eIn, eOut, func, withMsg2, withMsg1, withXor) \
+    eIn = _mm_sha1nexte_epu32(eIn, current);                                                        \
+    eOut = abcd;                                                                                    \
+    if(withMsg2) next = _mm_sha1msg2_epu32(next, current);                                          \
+    abcd = _mm_sha1rnds4_epu32(abcd, eIn, func);                                                    \
+    if(withMsg1) last = _mm_sha1msg1_epu32(last, current);                                          \
+    if(withXor) afterNext = _mm_xor_si128(afterNext, current);
+
+void CompressShaNi(uint32_t* state, const unsigned char* data, size_t blocks)
+{
+    const __m128i byteSwap = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+
+    __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state)), 0x1B);
+    __m128i e0 = _mm_set_epi32(state[4], 0, 0, 0);
+    __m128i e1;
+
+    for(; blocks > 0; --blocks, data += BLOCK_SIZE)
+    {
+        __m128i abcdSaved = abcd;
+        __m128i eSaved = e0;
+
+        __m128i msg0 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data)), byteSwap);
+        __m128i msg1 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16)), byteSwap);
+        __m128i msg2 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 32)), byteSwap);
+        __m128i msg3 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 48)), byteSwap);
+
+        // раунды 0-3: e еще не надо сдвигать, к нему просто добавляются слова
+        e0 = _mm_add_epi32(e0, msg0);
+        e1 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+        SHA_NI_ROUNDS(msg1, msg2, msg3, msg0, e1, e0, 0, false, true, false)  // 4-7
+        SHA_NI_ROUNDS(msg2, msg3, msg0, msg1, e0, e1, 0, false, true, true)  // 8-11
+        SHA_NI_ROUNDS(msg3, msg0, msg1, msg2, e1, e0, 0, true, true, true)  // 12-15
+        SHA_NI_ROUNDS(msg0, msg1, msg2, msg3, e0, e1, 0, true, true, true)  // 16-19
+        SHA_NI_ROUNDS(msg1, msg2, msg3, msg0, e1, e0, 1, true, true, true)  // 20-23
+        SHA_NI_ROUNDS(msg2, msg3, msg0, msg1, e0, e1, 1, true, true, true)  // 24-27
+        SHA_NI_ROUNDS(msg3, msg0, msg1, msg2, e1, e0, 1, true, true, true)  // 28-31
+        SHA_NI_ROUNDS(msg0, msg1, msg2, msg3, e0, e1, 1, true, true, true)  // 32-35
+        SHA_NI_ROUNDS(msg1, msg2, msg3, msg0, e1, e0, 1, true, true, true)  // 36-39
+        SHA_NI_ROUNDS(msg2, msg3, msg0, msg1, e0, e1, 2, true, true, true)  // 40-43
+        SHA_NI_ROUNDS(msg3, msg0, msg1, msg2, e1, e0, 2, true, true, true)  // 44-47
+        SHA_NI_ROUNDS(msg0, msg1, msg2, msg3, e0, e1, 2, true, true, true)  // 48-51
+        SHA_NI_ROUNDS(msg1, msg2, msg3, msg0, e1, e0, 2, true, true, true)  // 52-55
+        SHA_NI_ROUNDS(msg2, msg3, msg0, msg1, e0, e1, 2, true, true, true)  // 56-59
+        SHA_NI_ROUNDS(msg3, msg0, msg1, msg2, e1, e0, 3, true, true, true)  // 60-63
+        SHA_NI_ROUNDS(msg0, msg1, msg2, msg3, e0, e1, 3, true, true, true)  // 64-67
+        SHA_NI_ROUNDS(msg1, msg2, msg3, msg0, e1, e0, 3, true, false, true)  // 68-71
+        SHA_NI_ROUNDS(msg2, msg3, msg0, msg1, e0, e1, 3, true, false, false)  // 72-75
+        SHA_NI_ROUNDS(msg3, msg0, msg1, msg2, e1, e0, 3, false, false, false)  // 76-79
+
+        e0 = _mm_sha1nexte_epu32(e0, eSaved);
+        abcd = _mm_add_epi32(abcd, abcdSaved);
+    }
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(state), _mm_shuffle_epi32(abcd, 0x1B));
+    state[4] = _mm_extract_epi32(e0, 3);
+}
+
+#undef SHA_NI_ROUNDS
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+
+__m256i Rol(__m256i x, int n)
+{
+    return _mm256_or_si256(_mm256_slli_epi32(x, n), _mm256_srli_epi32(x, 32 - n));
+}
+
+/*
+ * Восемь подряд идущих слов блока с 8 дорожек, начиная с `offset`: транспонирование 8x8, после которого
+ * words[i] содержит i-е слово всех дорожек, и перевод из big endian
+ */
+void LoadWords(const unsigned char* const* lanes, size_t offset, __m256i* words)
+{
+    const __m256i byteSwap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                              3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    __m256i r[8];
+    for(int i = 0; i < 8; ++i)
+    {
+        r[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lanes[i] + offset));
+    }
+
+    __m256i t[8];
+    for(int i = 0; i < 8; i += 2)
+    {
+        t[i] = _mm256_unpacklo_epi32(r[i], r[i + 1]);
+        t[i + 1] = _mm256_unpackhi_epi32(r[i], r[i + 1]);
+    }
+    __m256i u[8];
+    for(int i = 0; i < 8; i += 4)
+    {
+        u[i] = _mm256_unpacklo_epi64(t[i], t[i + 2]);
+        u[i + 1] = _mm256_unpackhi_epi64(t[i], t[i + 2]);
+        u[i + 2] = _mm256_unpacklo_epi64(t[i + 1], t[i + 3]);
+        u[i + 3] = _mm256_unpackhi_epi64(t[i + 1], t[i + 3]);
+    }
+    for(int i = 0; i < 4; ++i)
+    {
+        words[i] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u[i], u[i + 4], 0x20), byteSwap);
+        words[i + 4] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u[i], u[i + 4], 0x31), byteSwap);
+    }
+}
+
+void CompressAvx2(uint32_t* state, const unsigned char* const* lanes, size_t blocks)
+{
+    constexpr size_t LANES = 8;
+    __m256i h[5];
+    for(int i = 0; i < 5; ++i)
+    {
+        h[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(state + i * LANES));
+    }
+
+    for(size_t offset = 0; offset < blocks * BLOCK_SIZE; offset += BLOCK_SIZE)
+    {
+        __m256i w[16];
+        LoadWords(lanes, offset, w);
+        LoadWords(lanes, offset + 32, w + 8);
+
+        __m256i a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        auto round = [&](int t, __m256i f) {
+            if(t >= 16)
+            {
+                __m256i x = _mm256_xor_si256(_mm256_xor_si256(w[(t + 13) & 15], w[(t + 8) & 15]),
+                                             _mm256_xor_si256(w[(t + 2) & 15], w[t & 15]));
+                w[t & 15] = Rol(x, 1);
+            }
+            __m256i temp = _mm256_add_epi32(_mm256_add_epi32(Rol(a, 5), f),
+                                            _mm256_add_epi32(e, _mm256_set1_epi32(ROUND_CONSTANTS[t / 20])));
+            e = d;
+            d = c;
+            c = Rol(b, 30);
+            b = a;
+            a = _mm256_add_epi32(temp, w[t & 15]);
+        };
+        // расписание слов `w[t]` считается внутри `round` до использования, а f -- от еще не сдвинутых b, c, d
+        for(int t = 0; t < 20; ++t)
+        {
+            round(t, _mm256_xor_si256(d, _mm256_and_si256(b, _mm256_xor_si256(c, d))));
+        }
+        for(int t = 20; t < 40; ++t)
+        {
+            round(t, _mm256_xor_si256(_mm256_xor_si256(b, c), d));
+        }
+        for(int t = 40; t < 60; ++t)
+        {
+            round(t, _mm256_or_si256(_mm256_and_si256(b, c), _mm256_and_si256(d, _mm256_or_si256(b, c))));
+        }
+        for(int t = 60; t < 80; ++t)
+        {
+            round(t, _mm256_xor_si256(_mm256_xor_si256(b, c), d));
+        }
+
+        h[0] = _mm256_add_epi32(h[0], a);
+        h[1] = _mm256_add_epi32(h[1], b);
+        h[2] = _mm256_add_epi32(h[2], c);
+        h[3] = _mm256_add_epi32(h[3], d);
+        h[4] = _mm256_add_epi32(h[4], e);
+    }
+
+    for(int i = 0; i < 5; ++i)
+    {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(state + i * LANES), h[i]);
+    }
+}
+
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx2")
+#pragma GCC diagnostic push
+// GCC не видит, что rol и ternarylogic в раундах перезаписывают все дорожки, и предупреждает о неинициализированном
+// исходном значении внутри встроенных функций
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+void CompressAvx512(uint32_t* state, const unsigned char* const* lanes, size_t blocks)
+{
+    constexpr size_t LANES = 16;
+    __m512i h[5];
+    for(int i = 0; i < 5; ++i)
+    {
+        h[i] = _mm512_loadu_si512(state + i * LANES);
+    }
+
+    for(size_t offset = 0; offset < blocks * BLOCK_SIZE; offset += BLOCK_SIZE)
+    {
+        // транспонируем половинами по 8 дорожек и склеиваем
+        __m512i w[16];
+        for(int half = 0; half < 2; ++half)
+        {
+            __m256i low[8];
+            __m256i high[8];
+            LoadWords(lanes, offset + half * 32, low);
+            LoadWords(lanes + 8, offset + half * 32, high);
+            for(int i = 0; i < 8; ++i)
+            {
+                w[half * 8 + i] = _mm512_inserti64x4(_mm512_zextsi256_si512(low[i]), high[i], 1);
+            }
+        }
+
+        __m512i a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        auto round = [&](int t, __m512i f) {
+            if(t >= 16)
+            {
+                // 0x96 -- xor трех аргументов
+                __m512i x = _mm512_ternarylogic_epi32(w[(t + 13) & 15], w[(t + 8) & 15], w[(t + 2) & 15], 0x96);
+                w[t & 15] = _mm512_rol_epi32(_mm512_xor_si512(x, w[t & 15]), 1);
+            }
+            __m512i temp = _mm512_add_epi32(_mm512_add_epi32(_mm512_rol_epi32(a, 5), f),
+                                            _mm512_add_epi32(e, _mm512_set1_epi32(ROUND_CONSTANTS[t / 20])));
+            e = d;
+            d = c;
+            c = _mm512_rol_epi32(b, 30);
+            b = a;
+            a = _mm512_add_epi32(temp, w[t & 15]);
+        };
+        // логические функции раундов одной инструкцией: 0xCA -- выбор (b ? c : d), 0x96 -- xor, 0xE8 -- большинство
+        for(int t = 0; t < 20; ++t)
+        {
+            round(t, _mm512_ternarylogic_epi32(b, c, d, 0xCA));
+        }
+        for(int t = 20; t < 40; ++t)
+        {
+            round(t, _mm512_ternarylogic_epi32(b, c, d, 0x96));
+        }
+        for(int t = 40; t < 60; ++t)
+        {
+            round(t, _mm512_ternarylogic_epi32(b, c, d, 0xE8));
+        }
+        for(int t = 60; t < 80; ++t)
+        {
+            round(t, _mm512_ternarylogic_epi32(b, c, d, 0x96));
+        }
+
+        h[0] = _mm512_add_epi32(h[0], a);
+        h[1] = _mm512_add_epi32(h[1], b);
+        h[2] = _mm512_add_epi32(h[2], c);
+        h[3] = _mm512_add_epi32(h[3], d);
+        h[4] = _mm512_add_epi32(h[4], e);
+    }
+
+    for(int i = 0; i < 5; ++i)
+    {
+        _mm512_storeu_si512(state + i * LANES, h[i]);
+    }
+}
+
+#pragma GCC diagnostic pop
+#pragma GCC pop_options
+
+bool CpuHasShaNi()
+{
+    unsigned int eax, ebx, ecx, edx;
+    if(!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) return false;
+    return (ebx & bit_SHA) && __builtin_cpu_supports("sse4.1");
+}
+
+/*
+ * Последние неполный блок и дополнение сообщения: байт 0x80, нули и длина сообщения в битах.
+ * Возвращает число получившихся блоков (1 или 2)
+ */
+size_t BuildTail(std::string_view message, unsigned char* tail)
+{
+    size_t rest = message.size() % BLOCK_SIZE;
+    memset(tail, 0, 2 * BLOCK_SIZE);
+    memcpy(tail, message.data() + message.size() - rest, rest);
+    tail[rest] = 0x80;
+
+    size_t blocks = rest + 1 + sizeof(uint64_t) <= BLOCK_SIZE ? 1 : 2;
+    uint64_t bits = uint64_t(message.size()) * 8;
+    for(size_t i = 0; i < sizeof(uint64_t); ++i)
+    {
+        tail[blocks * BLOCK_SIZE - 1 - i] = static_cast<unsigned char>(bits >> (8 * i));
+    }
+    return blocks;
+}
+
+std::string StoreDigest(const uint32_t* state, size_t stride)
+{
+    std::string digest(20, '\0');
+    for(size_t i = 0; i < 5; ++i)
+    {
+        uint32_t word = state[i * stride];
+        for(size_t j = 0; j < 4; ++j)
+        {
+            digest[4 * i + j] = static_cast<char>(word >> (24 - 8 * j));
+        }
+    }
+    return digest;
+}
+
+std::string HashSingle(std::string_view message, SingleCompress compress)
+{
+    uint32_t state[5];
+    std::copy(std::begin(INITIAL_STATE), std::end(INITIAL_STATE), state);
+    compress(state, reinterpret_cast<const unsigned char*>(message.data()), message.size() / BLOCK_SIZE);
+
+    unsigned char tail[2 * BLOCK_SIZE];
+    size_t tailBlocks = BuildTail(message, tail);
+    compress(state, tail, tailBlocks);
+    return StoreDigest(state, 1);
+}
+
+/*
+ * Захешировать до `lanes` сообщений одной длины. Незанятые дорожки повторяют первое сообщение, их результат
+ * отбрасывается
+ */
+void HashLanes(const std::vector<std::string_view>& messages, const size_t* indices, size_t count,
+               LanesCompress compress, size_t lanes, std::vector<std::string>& results)
+{
+    const unsigned char* pointers[MAX_LANES];
+    for(size_t lane = 0; lane < lanes; ++lane)
+    {
+        pointers[lane] = reinterpret_cast<const unsigned char*>(messages[indices[std::min(lane, count - 1)]].data());
+    }
+
+    uint32_t state[5 * MAX_LANES];
+    for(size_t i = 0; i < 5; ++i)
+    {
+        std::fill_n(state + i * lanes, lanes, INITIAL_STATE[i]);
+    }
+
+    std::string_view first = messages[indices[0]];
+    compress(state, pointers, first.size() / BLOCK_SIZE);
+
+    unsigned char tails[MAX_LANES][2 * BLOCK_SIZE];
+    size_t tailBlocks = 0;
+    for(size_t lane = 0; lane < lanes; ++lane)
+    {
+        tailBlocks = BuildTail(messages[indices[std::min(lane, count - 1)]], tails[lane]);
+        pointers[lane] = tails[lane];
+    }
+    compress(state, pointers, tailBlocks);
+
+    for(size_t lane = 0; lane < count; ++lane)
+    {
+        results[indices[lane]] = StoreDigest(state + lane, lanes);
+    }
+}
+
+/*
+ * Хеширование одного сообщения: собственные реализации -- только если их выбрали явно, иначе OpenSSL,
+ * который сам использует SHA-NI, если он есть, и не уступает `CompressShaNi`
+ */
+std::string HashOne(std::string_view message, Sha1Kernel kernel)
+{
+    switch(kernel)
+    {
+        case Sha1Kernel::Scalar:
+            return HashSingle(message, CompressScalar);
+        case Sha1Kernel::ShaNi:
+            return HashSingle(message, CompressShaNi);
+        default:
+            return CalculateSHA1(message);
+    }
+}
+
+/*
+ * С какого числа сообщений многодорожечный проход обгоняет хеширование их по одному через OpenSSL.
+ * Проход стоит почти одинаково при любом числе занятых дорожек: по замерам (bench/sha1_bench.cpp) столько же,
+ * сколько 7 сообщений через OpenSSL с SHA-NI для AVX2 и 9 для AVX-512, а без SHA-NI -- около 4
+ */
+size_t MinLanes(Sha1Kernel kernel, bool shaNi)
+{
+    if(!shaNi) return 4;
+    return kernel == Sha1Kernel::Avx512 ? 9 : 7;
+}
+}
+
+bool Sha1KernelSupported(Sha1Kernel kernel)
+{
+    switch(kernel)
+    {
+        case Sha1Kernel::OpenSsl:
+        case Sha1Kernel::Scalar:
+            return true;
+        case Sha1Kernel::ShaNi:
+            return CpuHasShaNi();
+        case Sha1Kernel::Avx2:
+            return __builtin_cpu_supports("avx2");
+        case Sha1Kernel::Avx512:
+            return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx2");
+    }
+    return false;
+}
+
+Sha1Kernel DetectSha1Kernel()
+{
+    // 16 дорожек AVX-512 обгоняют OpenSSL и с SHA-NI, а 8 дорожек AVX2 -- только без него
+    static const Sha1Kernel kernel = [] {
+        if(Sha1KernelSupported(Sha1Kernel::Avx512)) return Sha1Kernel::Avx512;
+        if(Sha1KernelSupported(Sha1Kernel::Avx2) && !Sha1KernelSupported(Sha1Kernel::ShaNi)) return Sha1Kernel::Avx2;
+        return Sha1Kernel::OpenSsl;
+    }();
+    return kernel;
+}
+
+size_t Sha1BatchWidth(Sha1Kernel kernel)
+{
+    switch(kernel)
+    {
+        case Sha1Kernel::Avx2:
+            return 8;
+        case Sha1Kernel::Avx512:
+            return 16;
+        default:
+            return 1;
+    }
+}
+
+std::vector<std::string> CalculateSHA1Batch(const std::vector<std::string_view>& messages, Sha1Kernel kernel)
+{
+    if(!Sha1KernelSupported(kernel))
+    {
+        throw std::runtime_error("Error: SHA1 kernel is not supported by this CPU");
+    }
+
+    std::vector<std::string> results(messages.size());
+    size_t lanes = Sha1BatchWidth(kernel);
+
+    if(lanes == 1)
+    {
+        for(size_t i = 0; i < messages.size(); ++i)
+        {
+            results[i] = HashOne(messages[i], kernel);
+        }
+        return results;
+    }
+
+    LanesCompress compress = kernel == Sha1Kernel::Avx512 ? CompressAvx512 : CompressAvx2;
+    size_t minLanes = MinLanes(kernel, Sha1KernelSupported(Sha1Kernel::ShaNi));
+
+    // одновременно хешируются только сообщения одной длины, поэтому группируем их по длине
+    std::vector<size_t> order(messages.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&messages](size_t lhs, size_t rhs) {
+        return messages[lhs].size() < messages[rhs].size();
+    });
+
+    for(size_t begin = 0; begin < order.size();)
+    {
+        size_t end = begin + 1;
+        while(end < order.size() && end - begin < lanes && messages[order[end]].size() == messages[order[begin]].size())
+        {
+            ++end;
+        }
+
+        if(end - begin >= minLanes)
+        {
+            HashLanes(messages, order.data() + begin, end - begin, compress, lanes, results);
+        }
+        else
+        {
+            for(size_t i = begin; i < end; ++i)
+            {
+                results[order[i]] = HashOne(messages[order[i]], kernel);
+            }
+        }
+        begin = end;
+    }
+    return results;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+ * Пакетный расчет SHA1 для массовой проверки частей (перепроверка существующих файлов, проверка при возобновлении).
+ * SHA1 одного потока данных не распараллеливается: каждый блок зависит от результата предыдущего. Зато несколько
+ * независимых сообщений одинаковой длины можно хешировать одновременно, раскладывая их по дорожкам SIMD регистра:
+ * 8 сообщений в AVX2 и 16 в AVX-512. Сообщения, которым не хватило пары, хешируются по одному через OpenSSL.
+ * Многодорожечная реализация выбирается во время работы, только если она обгоняет OpenSSL на этом процессоре:
+ * 8 дорожек AVX2 не быстрее OpenSSL с SHA-NI, и тогда хеширование остается однопоточным через OpenSSL
+ * Полезная информация:
+ * - https://www.intel.com/content/www/us/en/developer/articles/technical/intel-sha-extensions.html
+ * - https://www.intel.com/content/dam/www/public/us/en/documents/white-papers/communications-ia-multi-buffer-paper.pdf
+ */
+enum class Sha1Kernel {
+    OpenSsl,  // `CalculateSHA1` по одному сообщению; OpenSSL сам использует SHA-NI, если он есть
+    Scalar,  // переносимая реализация, для сравнения
+    ShaNi,  // инструкции SHA-NI, одно сообщение за раз
+    Avx2,  // 8 сообщений одновременно
+    Avx512,  // 16 сообщений одновременно
+};
+
+/*
+ * Лучшая реализация для этого процессора
+ */
+Sha1Kernel DetectSha1Kernel();
+
+/*
+ * Поддерживает ли процессор реализацию `kernel`
+ */
+bool Sha1KernelSupported(Sha1Kernel kernel);
+
+/*
+ * Сколько сообщений реализация хеширует одновременно. Чтобы пакет загружал все дорожки, в нем должно быть кратное
+ * этому число сообщений одинаковой длины
+ */
+size_t Sha1BatchWidth(Sha1Kernel kernel = DetectSha1Kernel());
+
+/*
+ * SHA1 каждого сообщения, результаты в том же формате, что и у `CalculateSHA1` (20 байт).
+ * Сообщения разной длины допустимы, но одновременно хешируются только сообщения одинаковой длины.
+ * `kernel` должен поддерживаться процессором
+ */
+std::vector<std::string> CalculateSHA1Batch(const std::vector<std::string_view>& messages,
+                                            Sha1Kernel kernel = DetectSha1Kernel());
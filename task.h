@@ -0,0 +1,205 @@
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+/*
+ * Корутина C++20, результат которой можно дождаться через `co_await`.
+ * Корутина ленивая: тело начинает выполняться, только когда ее ждут (`co_await task`) или запускают явно (`Start`).
+ * Когда она завершается, управление сразу передается ждущей корутине (symmetric transfer), так что длинные цепочки
+ * `co_await` не растят стек. Исключение из тела корутины пробрасывается в того, кто ее ждет.
+ * Сама по себе корутина не знает ни о потоках, ни о сокетах: приостанавливается она на ожиданиях вроде
+ * `AsyncSocket::Wait`, а продолжается из callback'а цикла событий. Приостановленная корутина занимает только
+ * свой фрейм в куче, а не стек потока
+ * https://en.cppreference.com/w/cpp/language/coroutines
+ */
+template<typename T = void>
+class Task;
+
+namespace task_detail {
+
+class PromiseBase {
+public:
+    std::suspend_always initial_suspend() noexcept
+    {
+        return {};
+    }
+
+    /*
+     * Завершившись, корутина передает управление ждущей ее корутине, если такая есть
+     */
+    struct FinalAwaiter {
+        bool await_ready() noexcept
+        {
+            return false;
+        }
+
+        template<typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+        {
+            auto continuation = handle.promise().continuation_;
+            return continuation ? continuation : std::noop_coroutine();
+        }
+
+        void await_resume() noexcept {}
+    };
+
+    FinalAwaiter final_suspend() noexcept
+    {
+        return {};
+    }
+
+    void unhandled_exception() noexcept
+    {
+        exception_ = std::current_exception();
+    }
+
+    void SetContinuation(std::coroutine_handle<> continuation)
+    {
+        continuation_ = continuation;
+    }
+protected:
+    std::coroutine_handle<> continuation_;
+    std::exception_ptr exception_;
+
+    void RethrowIfFailed()
+    {
+        if(exception_)
+        {
+            std::rethrow_exception(exception_);
+        }
+    }
+};
+
+template<typename T>
+class Promise : public PromiseBase {
+public:
+    Task<T> get_return_object() noexcept;
+
+    template<typename U>
+    void return_value(U&& value)
+    {
+        value_.emplace(std::forward<U>(value));
+    }
+
+    T Result()
+    {
+        RethrowIfFailed();
+        return std::move(*value_);
+    }
+private:
+    std::optional<T> value_;
+};
+
+template<>
+class Promise<void> : public PromiseBase {
+public:
+    Task<void> get_return_object() noexcept;
+
+    void return_void() noexcept {}
+
+    void Result()
+    {
+        RethrowIfFailed();
+    }
+};
+
+}  // namespace task_detail
+
+template<typename T>
+class Task {
+public:
+    using promise_type = task_detail::Promise<T>;
+
+    Task() = default;
+
+    explicit Task(std::coroutine_handle<promise_type> handle)
+    : handle_(handle)
+    {}
+
+    Task(Task&& other) noexcept
+    : handle_(std::exchange(other.handle_, {}))
+    {}
+
+    Task& operator=(Task&& other) noexcept
+    {
+        if(this != &other)
+        {
+            Reset();
+            handle_ = std::exchange(other.handle_, {});
+        }
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    /*
+     * Уничтожает фрейм корутины. Приостановленную корутину уничтожать можно, только если ее никто не продолжит
+     */
+    ~Task()
+    {
+        Reset();
+    }
+
+    /*
+     * Запустить корутину, которую никто не ждет (корутину верхнего уровня). Она выполняется до первой
+     * приостановки, дальше ее продолжает тот, кто ее разбудит
+     */
+    void Start()
+    {
+        handle_.resume();
+    }
+
+    /*
+     * Корутина выполнилась до конца
+     */
+    bool Done() const
+    {
+        return !handle_ || handle_.done();
+    }
+
+    bool await_ready() const noexcept
+    {
+        return false;
+    }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        handle_.promise().SetContinuation(awaiting);
+        return handle_;
+    }
+
+    T await_resume()
+    {
+        return handle_.promise().Result();
+    }
+private:
+    std::coroutine_handle<promise_type> handle_;
+
+    void Reset()
+    {
+        if(handle_)
+        {
+            handle_.destroy();
+            handle_ = {};
+        }
+    }
+};
+
+namespace task_detail {
+
+template<typename T>
+Task<T> Promise<T>::get_return_object() noexcept
+{
+    return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+
+inline Task<void> Promise<void>::get_return_object() noexcept
+{
+    return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+
+}  // namespace task_detail
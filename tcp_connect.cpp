@@ -1,9 +1,25 @@
 #pragma once
 #include "tcp_connect.h"
+#include <utility>
+#include <sys/sendfile.h>
 
 void TcpConnect::EstablishConnection()
 {
-    sock_ = socket(AF_INET, SOCK_STREAM, 0);
+    if(StartConnect())
+    {
+        return;
+    }
+
+    WaitFor(POLLOUT, connectTimeout_);
+    FinishConnect();
+}
+bool TcpConnect::StartConnect()
+{
+    // адрес строится прямо из двоичного вида пира, без разбора строки
+    sockaddr_storage sock_address;
+    socklen_t sock_address_length = peer_.ToSockaddr(sock_address);
+
+    sock_ = socket(sock_address.ss_family, SOCK_STREAM, 0);
     if(sock_ == -1)
     {
         throw std::runtime_error("Error: cannot create socket:(");
@@ -11,45 +27,65 @@ void TcpConnect::EstablishConnection()
 
     closed = false;
 
-    sockaddr_in sock_address;
-    memset(&sock_address, '0', sizeof(sock_address));
-    sock_address.sin_family = AF_INET;
-    sock_address.sin_addr.s_addr = inet_addr(ip_.c_str());
-    sock_address.sin_port = htons(port_);
-
-    int default_flags = fcntl(sock_, F_GETFL, 0);
-    set_nonblock_mode(default_flags);
+    set_nonblock_mode(fcntl(sock_, F_GETFL, 0));
 
-    int connection_result = connect(sock_, (const sockaddr*) &sock_address, sizeof(sock_address));
+    int connection_result = connect(sock_, (const sockaddr*) &sock_address, sock_address_length);
 
     if(connection_result == 0)
     {
-        set_default_mode(default_flags);
-        return;
+        return true;
     }
+    if(errno != EINPROGRESS)
+    {
+        throw std::runtime_error(std::string("Error: cannot connect: ") + strerror(errno));
+    }
+    return false;
+}
+void TcpConnect::FinishConnect() const
+{
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if(getsockopt(sock_, SOL_SOCKET, SO_ERROR, &error, &length) == -1)
+    {
+        error = errno;
+    }
+    if(error != 0)
+    {
+        throw std::runtime_error(std::string("Error: cannot connect: ") + strerror(error));
+    }
+}
+void TcpConnect::Adopt(int sock)
+{
+    CloseConnection();
+    sock_ = sock;
+    closed = false;
+}
+int TcpConnect::Release()
+{
+    Unwatch();
+    closed = true;
+    return std::exchange(sock_, -1);
+}
+bool TcpConnect::IsOpen() const
+{
+    return !closed;
+}
+void TcpConnect::WaitFor(short events, std::chrono::milliseconds timeout) const
+{
+    pollfd arr{};
+    arr.fd = sock_;
+    arr.events = events;
 
-    pollfd arr;
-    memset(&arr, '0', sizeof(arr));
-    arr =
-            {
-                    .fd = sock_,
-                    .events = POLLOUT
-            };
-
-    connection_result = poll(&arr, 1, connectTimeout_.count());
+    int result = poll(&arr, 1, timeout.count());
 
-    if(connection_result == -1)
+    if(result == -1)
     {
-        set_default_mode(default_flags);
         throw std::runtime_error("Error: something went wrong...");
     }
-    else if(connection_result == 0)
+    else if(result == 0)
     {
-        set_default_mode(default_flags);
         throw std::runtime_error("Error: time limit exceeded");
     }
-
-    set_default_mode(default_flags);
 }
 void TcpConnect::set_default_mode(int default_flags) const
 {
@@ -74,11 +110,12 @@ std::shared_ptr<char[]> TcpConnect::LoopRecieve(size_t bufferSize) const
 
     while(needToGet > 0)
     {
-        int curSession = recv(sock_, buffer.get() + (bufferSize - needToGet), needToGet, 0);
+        size_t curSession = ReceiveSome(buffer.get() + (bufferSize - needToGet), needToGet);
 
-        if(curSession <= 0)
+        if(curSession == 0)
         {
-            throw std::runtime_error("Error: cannot send data");
+            WaitFor(POLLIN, readTimeout_);
+            continue;
         }
 
         needToGet -= curSession;
@@ -92,55 +129,83 @@ std::string TcpConnect::ReceiveData(size_t bufferSize) const
         throw std::runtime_error("Error: socket is not connected");
     }
 
-    timeval TimeOut =
-            {
-                    .tv_sec = readTimeout_.count() / 1000,
-                    .tv_usec = readTimeout_.count() % 1000 * 1000
-            };
-    timeval DefaultTimeOut =
-            {
-                    .tv_sec = 0,
-                    .tv_usec = 0
-            };
-
-    setsockopt(sock_, SOL_SOCKET, SO_RCVTIMEO, (const char*) &TimeOut, sizeof(TimeOut));
-
     if(bufferSize == 0)
     {
-        std::shared_ptr<char[]> size;
-        try {
-            size = LoopRecieve(4);
-        } catch (...) {
-            setsockopt(sock_, SOL_SOCKET, SO_RCVTIMEO, (const char*) &DefaultTimeOut, sizeof(DefaultTimeOut));
-            throw;
-        }
+        auto size = LoopRecieve(4);
         bufferSize = BytesToInt(std::string_view(size.get(), 4));
     }
 
     if(!bufferSize) return "";
 
-    std::shared_ptr<char[]> buffer;
+    auto buffer = LoopRecieve(bufferSize);
+    return std::string(buffer.get(), buffer.get() + bufferSize);
+}
+size_t TcpConnect::ReceiveSome(char* buffer, size_t bufferSize) const
+{
+    ssize_t curSession = recv(sock_, buffer, bufferSize, 0);
+
+    if(curSession > 0)
+    {
+        return curSession;
+    }
+    if(curSession == 0)
+    {
+        throw std::runtime_error("Error: connection closed by peer");
+    }
+    if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+    {
+        return 0;
+    }
+    throw std::runtime_error(std::string("Error: cannot receive data: ") + strerror(errno));
+}
+size_t TcpConnect::SendSome(const char* data, size_t size, bool more) const
+{
+    ssize_t curSession = send(sock_, data, size, MSG_NOSIGNAL | (more ? MSG_MORE : 0));
 
-    try {
-        buffer = LoopRecieve(bufferSize);
-    } catch(...) {
-        setsockopt(sock_, SOL_SOCKET, SO_RCVTIMEO, (const char*) &DefaultTimeOut, sizeof(DefaultTimeOut));
-        throw;
+    if(curSession >= 0)
+    {
+        return curSession;
     }
+    if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+    {
+        return 0;
+    }
+    throw std::runtime_error(std::string("Error: cannot send data: ") + strerror(errno));
+}
+size_t TcpConnect::SendFile(int fd, uint64_t offset, size_t length) const
+{
+    off_t position = offset;
+    ssize_t sent = sendfile(sock_, fd, &position, length);
 
-    setsockopt(sock_, SOL_SOCKET, SO_RCVTIMEO, (const char*) &DefaultTimeOut, sizeof(DefaultTimeOut));
-    return std::string(buffer.get(), buffer.get() + bufferSize);
+    if(sent > 0)
+    {
+        return sent;
+    }
+    if(sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    {
+        return 0;
+    }
+    if(sent == 0)
+    {
+        throw std::runtime_error("Error: file is shorter than expected");
+    }
+    throw std::runtime_error(std::string("Error: cannot send file: ") + strerror(errno));
+}
+void TcpConnect::WaitForData() const
+{
+    WaitFor(POLLIN, readTimeout_);
 }
 void TcpConnect::LoopSend(const std::string &data) const
 {
     size_t notSent = data.size();
     while(notSent > 0)
     {
-        int curSession = send(sock_, data.c_str() + (data.size() - notSent), notSent, 0);
+        size_t curSession = SendSome(data.c_str() + (data.size() - notSent), notSent);
 
-        if(curSession < 0)
+        if(curSession == 0)
         {
-            throw std::runtime_error("Error: cannot send data");
+            WaitFor(POLLOUT, readTimeout_);
+            continue;
         }
 
         notSent -= curSession;
@@ -153,25 +218,41 @@ void TcpConnect::SendData(const std::string& data) const
         throw std::runtime_error("Error: bad socket");
     }
 
-    try {
-        LoopSend(data);
-    } catch(...) {
-        throw;
+    LoopSend(data);
+}
+void TcpConnect::Watch(EventLoop& loop, uint32_t events, EventLoop::Callback callback)
+{
+    Unwatch();
+    loop.Add(sock_, events, std::move(callback));
+    loop_ = &loop;
+}
+void TcpConnect::Unwatch()
+{
+    if(loop_)
+    {
+        loop_->Remove(sock_);
+        loop_ = nullptr;
     }
 }
 void TcpConnect::CloseConnection()
 {
     if(!closed)
     {
+        Unwatch();
         closed = true;
         close(sock_);
+        sock_ = -1;
     }
 }
-const std::string& TcpConnect::GetIp() const
+const Peer& TcpConnect::GetPeer() const
+{
+    return peer_;
+}
+int TcpConnect::GetSocket() const
 {
-    return ip_;
+    return sock_;
 }
-int TcpConnect::GetPort() const
+std::chrono::milliseconds TcpConnect::GetConnectTimeout() const
 {
-    return port_;
+    return connectTimeout_;
 }
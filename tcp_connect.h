@@ -15,6 +15,8 @@
 #include <cstring>
 #include <sys/poll.h>
 #include "byte_tools.h"
+#include "event_loop.h"
+#include "peer.h"
 #include <memory>
 #include <cassert>
 
@@ -23,12 +25,13 @@
  */
 class TcpConnect {
 public:
-    TcpConnect(std::string ip, int port, std::chrono::milliseconds connectTimeout, std::chrono::milliseconds readTimeout)
-            : ip_(ip)
-            , port_(port)
+    TcpConnect(const Peer& peer, std::chrono::milliseconds connectTimeout, std::chrono::milliseconds readTimeout)
+            : peer_(peer)
             , connectTimeout_(connectTimeout)
             , readTimeout_(readTimeout)
+            , sock_(-1)
             , closed(true)
+            , loop_(nullptr)
     {}
 
     ~TcpConnect()
@@ -50,6 +53,36 @@ public:
      * - https://man7.org/linux/man-pages/man3/strerror.3.html
      */
     void EstablishConnection();
+
+    /*
+     * Неблокирующая часть `EstablishConnection`: создать сокет в режиме O_NONBLOCK и начать подключение.
+     * Возвращает true, если соединение установилось сразу. Иначе надо дождаться готовности сокета к записи
+     * (например, через EventLoop) и вызвать `FinishConnect`.
+     * Сокет остается неблокирующим все время жизни соединения: блокирующие `SendData`/`ReceiveData`
+     * ждут готовности через poll с таймаутом `readTimeout`
+     */
+    bool StartConnect();
+
+    /*
+     * Проверить результат неблокирующего подключения (SO_ERROR). Бросает исключение, если подключиться не удалось
+     */
+    void FinishConnect() const;
+
+    /*
+     * Взять уже подключенный неблокирующий сокет `sock` (например, от Connector) вместо `StartConnect`
+     */
+    void Adopt(int sock);
+
+    /*
+     * Отдать сокет, не закрывая его: дальше им владеет вызывающий. Возвращает дескриптор
+     */
+    int Release();
+
+    /*
+     * Сокет создан и не закрыт
+     */
+    bool IsOpen() const;
+
     void set_default_mode(int default_flags) const;
     void set_nonblock_mode(int current_flags) const;
     /*
@@ -74,17 +107,50 @@ public:
     std::shared_ptr<char[]> LoopRecieve(size_t bufferSize) const;
     std::string ReceiveData(size_t bufferSize = 0) const;
 
+    /*
+     * Неблокирующие операции для работы из цикла событий.
+     * Читают / пишут столько, сколько сокет готов принять или отдать прямо сейчас, и возвращают количество байт
+     * (0, если операция заблокировалась бы). При разрыве соединения или ошибке бросают исключение.
+     * more -- следом сразу пойдут еще данные (MSG_MORE): ядро не отправляет короткий пакет, а дописывает их к нему
+     */
+    size_t ReceiveSome(char* buffer, size_t bufferSize) const;
+    size_t SendSome(const char* data, size_t size, bool more = false) const;
+
+    /*
+     * Отправить `length` байт файла `fd` начиная с `offset` прямо из page cache, без копирования в память процесса
+     * (sendfile). Неблокирующая, как `SendSome`
+     * - https://man7.org/linux/man-pages/man2/sendfile.2.html
+     */
+    size_t SendFile(int fd, uint64_t offset, size_t length) const;
+
+    /*
+     * Дождаться, пока в сокете появятся данные для чтения. Бросает исключение, если за `readTimeout` их не пришло
+     */
+    void WaitForData() const;
+
+    /*
+     * Подписать сокет на события в цикле `loop`. Подписка снимается в `Unwatch` или при закрытии соединения
+     */
+    void Watch(EventLoop& loop, uint32_t events, EventLoop::Callback callback);
+    void Unwatch();
+
     /*
      * Закрыть сокет
      */
     void CloseConnection();
 
-    const std::string& GetIp() const;
-    int GetPort() const;
+    const Peer& GetPeer() const;
+    int GetSocket() const;
+    std::chrono::milliseconds GetConnectTimeout() const;
 private:
-    const std::string ip_;
-    const int port_;
+    const Peer peer_;
     std::chrono::milliseconds connectTimeout_, readTimeout_;
     int sock_;
     bool closed;
+    EventLoop* loop_;  // цикл, в котором зарегистрирован сокет, если есть
+
+    /*
+     * Дождаться через poll событий `events` на сокете. Бросает исключение по таймауту
+     */
+    void WaitFor(short events, std::chrono::milliseconds timeout) const;
 };
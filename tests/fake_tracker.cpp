@@ -0,0 +1,253 @@
+#include "fake_tracker.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+
+namespace {
+constexpr uint64_t PROTOCOL_ID = 0x41727101980;
+constexpr uint32_t ACTION_CONNECT = 0;
+constexpr uint32_t ACTION_ANNOUNCE = 1;
+constexpr uint32_t ACTION_ERROR = 3;
+constexpr size_t CONNECT_REQUEST_LENGTH = 16;
+constexpr size_t ANNOUNCE_REQUEST_LENGTH = 98;
+constexpr int POLL_TIMEOUT_MS = 50;  // как часто поток проверяет, не пора ли остановиться
+
+void AppendInt(std::string& out, uint64_t value, size_t size)
+{
+    for(size_t i = size; i-- > 0;)
+    {
+        out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+    }
+}
+
+uint64_t ReadInt(std::string_view data, size_t offset, size_t size)
+{
+    uint64_t value = 0;
+    for(size_t i = 0; i < size; ++i)
+    {
+        value = (value << 8) | static_cast<unsigned char>(data[offset + i]);
+    }
+    return value;
+}
+
+/*
+ * Сокет, привязанный к 127.0.0.1 на свободном порту. Возвращает сокет, порт -- в `port`
+ */
+int BindLoopback(int type, uint16_t& port)
+{
+    int sock = socket(AF_INET, type, 0);
+    if(sock < 0)
+    {
+        throw std::runtime_error(std::string("Error: cannot create socket: ") + strerror(errno));
+    }
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    if(bind(sock, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1 ||
+       getsockname(sock, reinterpret_cast<sockaddr*>(&address), &length) == -1 ||
+       (type == SOCK_STREAM && listen(sock, 16) == -1))
+    {
+        int error = errno;
+        close(sock);
+        throw std::runtime_error(std::string("Error: cannot bind loopback socket: ") + strerror(error));
+    }
+    port = ntohs(address.sin_port);
+    return sock;
+}
+
+/*
+ * Дождаться, пока на сокете появятся данные. false -- за `POLL_TIMEOUT_MS` ничего не пришло
+ */
+bool WaitReadable(int sock)
+{
+    pollfd fd{};
+    fd.fd = sock;
+    fd.events = POLLIN;
+    return poll(&fd, 1, POLL_TIMEOUT_MS) > 0;
+}
+}
+
+std::string CompactPeers(const std::vector<Peer>& peers)
+{
+    std::string compact;
+    for(const Peer& peer : peers)
+    {
+        compact.append(reinterpret_cast<const char*>(peer.address.data()), 4);
+        AppendInt(compact, peer.port, 2);
+    }
+    return compact;
+}
+
+FakeUdpTracker::FakeUdpTracker(Options options)
+: options_(std::move(options))
+, sock_(BindLoopback(SOCK_DGRAM, port_))
+, connectionId_(std::mt19937_64{std::random_device{}()}())
+, stop_(false)
+, connects_(0)
+, announces_(0)
+{
+    thread_ = std::thread(&FakeUdpTracker::Serve, this);
+}
+
+FakeUdpTracker::~FakeUdpTracker()
+{
+    stop_ = true;
+    thread_.join();
+    close(sock_);
+}
+
+std::string FakeUdpTracker::Url() const
+{
+    return "udp://127.0.0.1:" + std::to_string(port_) + "/announce";
+}
+
+size_t FakeUdpTracker::Connects() const
+{
+    return connects_;
+}
+
+size_t FakeUdpTracker::Announces() const
+{
+    return announces_;
+}
+
+void FakeUdpTracker::Serve()
+{
+    std::string datagram(1 << 16, '\0');
+    while(!stop_)
+    {
+        if(!WaitReadable(sock_)) continue;
+
+        sockaddr_storage from{};
+        socklen_t fromLength = sizeof(from);
+        ssize_t received = recvfrom(sock_, datagram.data(), datagram.size(), 0, reinterpret_cast<sockaddr*>(&from),
+                                    &fromLength);
+        if(received < static_cast<ssize_t>(CONNECT_REQUEST_LENGTH)) continue;
+        std::string_view request(datagram.data(), received);
+
+        uint32_t action = ReadInt(request, 8, 4);
+        uint32_t transactionId = ReadInt(request, 12, 4);
+        std::string reply;
+        if(action == ACTION_CONNECT && ReadInt(request, 0, 8) == PROTOCOL_ID)
+        {
+            size_t number = connects_++;
+            if(options_.silent || number < options_.dropConnects) continue;
+
+            if(!options_.error.empty())
+            {
+                AppendInt(reply, ACTION_ERROR, 4);
+                AppendInt(reply, transactionId, 4);
+                reply += options_.error;
+            }
+            else
+            {
+                AppendInt(reply, ACTION_CONNECT, 4);
+                AppendInt(reply, transactionId, 4);
+                AppendInt(reply, connectionId_, 8);
+            }
+        }
+        else if(action == ACTION_ANNOUNCE && request.size() >= ANNOUNCE_REQUEST_LENGTH &&
+                ReadInt(request, 0, 8) == connectionId_)
+        {
+            size_t number = announces_++;
+            if(options_.silent || number < options_.dropAnnounces) continue;
+
+            AppendInt(reply, ACTION_ANNOUNCE, 4);
+            AppendInt(reply, transactionId, 4);
+            AppendInt(reply, options_.interval, 4);
+            AppendInt(reply, 0, 4);  // leechers
+            AppendInt(reply, options_.peers.size(), 4);  // seeders
+            reply += CompactPeers(options_.peers);
+        }
+        else
+        {
+            continue;
+        }
+        sendto(sock_, reply.data(), reply.size(), 0, reinterpret_cast<sockaddr*>(&from), fromLength);
+    }
+}
+
+FakeHttpTracker::FakeHttpTracker(Options options)
+: options_(std::move(options))
+, sock_(BindLoopback(SOCK_STREAM, port_))
+, stop_(false)
+{
+    thread_ = std::thread(&FakeHttpTracker::Serve, this);
+}
+
+FakeHttpTracker::~FakeHttpTracker()
+{
+    stop_ = true;
+    thread_.join();
+    close(sock_);
+}
+
+std::string FakeHttpTracker::Url() const
+{
+    return "http://127.0.0.1:" + std::to_string(port_) + "/announce";
+}
+
+std::vector<std::string> FakeHttpTracker::Requests() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return requests_;
+}
+
+void FakeHttpTracker::Serve()
+{
+    while(!stop_)
+    {
+        if(!WaitReadable(sock_)) continue;
+
+        int client = accept(sock_, nullptr, nullptr);
+        if(client < 0) continue;
+        Answer(client);
+        close(client);
+    }
+}
+
+void FakeHttpTracker::Answer(int client)
+{
+    // запрос GET без тела: читаем до пустой строки после заголовков
+    std::string request;
+    char buffer[4096];
+    while(request.find("\r\n\r\n") == std::string::npos && !stop_)
+    {
+        if(!WaitReadable(client)) continue;
+        ssize_t received = recv(client, buffer, sizeof(buffer), 0);
+        if(received <= 0) return;
+        request.append(buffer, received);
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        requests_.push_back(request.substr(0, request.find("\r\n")));
+    }
+
+    std::string body;
+    if(!options_.failure.empty())
+    {
+        body = "d14:failure reason" + std::to_string(options_.failure.size()) + ":" + options_.failure + "e";
+    }
+    else
+    {
+        std::string peers = CompactPeers(options_.peers);
+        body = "d8:intervali" + std::to_string(options_.interval) + "e5:peers" + std::to_string(peers.size()) + ":" +
+               peers + "e";
+    }
+    std::string response = "HTTP/1.1 " + std::to_string(options_.status) + (options_.status == 200 ? " OK" : " Error") +
+                           "\r\nContent-Type: text/plain\r\nContent-Length: " + std::to_string(body.size()) +
+                           "\r\nConnection: close\r\n\r\n" + body;
+    for(size_t sent = 0; sent < response.size();)
+    {
+        ssize_t result = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+        if(result <= 0) return;
+        sent += result;
+    }
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "../peer.h"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * Поддельный UDP трекер для тестов: слушает 127.0.0.1 на свободном порту в своем потоке и отвечает на connect и
+ * announce по BEP 15. Умеет терять первые запросы (проверка повторов), отвечать ошибкой или молчать совсем
+ * http://www.bittorrent.org/beps/bep_0015.html
+ */
+class FakeUdpTracker {
+public:
+    struct Options {
+        std::vector<Peer> peers{};  // пиры IPv4 для ответа на announce
+        uint32_t interval = 1800;
+        size_t dropConnects = 0;  // сколько первых connect оставить без ответа
+        size_t dropAnnounces = 0;  // сколько первых announce оставить без ответа
+        bool silent = false;  // не отвечать ни на что
+        std::string error{};  // если не пусто -- отвечать на connect ошибкой с этим текстом
+    };
+
+    explicit FakeUdpTracker(Options options);
+    ~FakeUdpTracker();
+
+    FakeUdpTracker(const FakeUdpTracker&) = delete;
+    FakeUdpTracker& operator=(const FakeUdpTracker&) = delete;
+
+    /*
+     * udp://127.0.0.1:<port>/announce
+     */
+    std::string Url() const;
+
+    /*
+     * Сколько запросов connect и announce пришло, включая потерянные
+     */
+    size_t Connects() const;
+    size_t Announces() const;
+private:
+    const Options options_;
+    int sock_;
+    uint16_t port_;
+    uint64_t connectionId_;
+    std::atomic_bool stop_;
+    std::atomic<size_t> connects_;
+    std::atomic<size_t> announces_;
+    std::thread thread_;
+
+    void Serve();
+};
+
+/*
+ * Поддельный HTTP трекер для тестов: слушает 127.0.0.1 на свободном порту в своем потоке и на каждое соединение
+ * отвечает одним bencode словарем с компактным списком пиров, после чего закрывает соединение
+ */
+class FakeHttpTracker {
+public:
+    struct Options {
+        std::vector<Peer> peers{};  // пиры IPv4 для поля peers
+        uint32_t interval = 1800;
+        int status = 200;  // код ответа; не 200 -- трекер недоступен
+        std::string failure{};  // если не пусто -- ответить словарем с failure reason
+    };
+
+    explicit FakeHttpTracker(Options options);
+    ~FakeHttpTracker();
+
+    FakeHttpTracker(const FakeHttpTracker&) = delete;
+    FakeHttpTracker& operator=(const FakeHttpTracker&) = delete;
+
+    /*
+     * http://127.0.0.1:<port>/announce
+     */
+    std::string Url() const;
+
+    /*
+     * Строки запросов (метод, путь с параметрами и версия) в порядке поступления
+     */
+    std::vector<std::string> Requests() const;
+private:
+    const Options options_;
+    int sock_;
+    uint16_t port_;
+    std::atomic_bool stop_;
+    mutable std::mutex mutex_;
+    std::vector<std::string> requests_;
+    std::thread thread_;
+
+    void Serve();
+
+    /*
+     * Прочитать запрос из принятого соединения и ответить на него
+     */
+    void Answer(int client);
+};
+
+/*
+ * Пиры в компактном виде трекера: по 4 байта адреса и 2 байта порта в сетевом порядке
+ */
+std::string CompactPeers(const std::vector<Peer>& peers);
@@ -0,0 +1,223 @@
+/*
+ * Проверки клиентов трекеров против поддельных трекеров на 127.0.0.1 (см. fake_tracker.h): повторы запросов
+ * UDP трекера, переход к следующему уровню announce-list, отмена анонса. Сеть наружу не нужна.
+ * Сборка из корня репозитория:
+ * g++ -std=c++20 -pthread -o tracker_test tests/tracker_test.cpp tests/fake_tracker.cpp tracker_list.cpp \
+ *     torrent_tracker.cpp udp_tracker.cpp peer.cpp bencode.cpp -lcpr -lcurl -lssl -lcrypto
+ */
+#undef NDEBUG
+#include "fake_tracker.h"
+#include "../tracker_list.h"
+#include "../udp_tracker.h"
+#include "../torrent_tracker.h"
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+const std::string PeerId = "-TT0001-012345678901";
+
+TorrentFile MakeTorrent()
+{
+    TorrentFile tf{};
+    tf.infoHash = std::string(20, '\x42');
+    tf.length = 1 << 20;
+    tf.pieceLength = 1 << 18;
+    tf.name = "test";
+    return tf;
+}
+
+const std::vector<Peer> SwarmA = {Peer("10.0.0.1", 6881), Peer("10.0.0.2", 6882)};
+const std::vector<Peer> SwarmB = {Peer("10.0.1.1", 51413)};
+
+/*
+ * Потерянные connect и announce повторяются по таймауту, и анонс все равно удается
+ */
+void TestUdpRetry()
+{
+    FakeUdpTracker fake({.peers = SwarmA, .interval = 900, .dropConnects = 1, .dropAnnounces = 1});
+    UdpTracker tracker(fake.Url(), std::chrono::milliseconds(100), 3);
+
+    TorrentFile tf = MakeTorrent();
+    std::string peers = tracker.Announce(tf, PeerId, 6881, 0, 0, tf.length);
+    assert(peers == CompactPeers(SwarmA));
+    assert(tracker.Interval() == std::chrono::seconds(900));
+    assert(fake.Connects() == 2);
+    assert(fake.Announces() == 2);
+
+    // connection id еще действителен: второй анонс обходится без connect
+    tracker.Announce(tf, PeerId, 6881, 0, 0, tf.length);
+    assert(fake.Connects() == 2);
+    assert(fake.Announces() == 3);
+}
+
+/*
+ * Молчащий трекер получает ровно 1 + maxRetries попыток с удваивающимся таймаутом, потом -- исключение
+ */
+void TestUdpGivesUp()
+{
+    FakeUdpTracker fake({.silent = true});
+    UdpTracker tracker(fake.Url(), std::chrono::milliseconds(50), 2);
+
+    TorrentFile tf = MakeTorrent();
+    auto start = Clock::now();
+    bool failed = false;
+    try
+    {
+        tracker.Announce(tf, PeerId, 6881, 0, 0, tf.length);
+    } catch(const std::runtime_error&)
+    {
+        failed = true;
+    }
+    auto elapsed = Clock::now() - start;
+    assert(failed);
+    assert(fake.Connects() == 3);
+    // таймауты округляются до миллисекунд, поэтому сумма может выйти чуть меньше 350 мс
+    assert(elapsed >= std::chrono::milliseconds(300));
+    assert(elapsed < std::chrono::seconds(2));
+}
+
+/*
+ * Ошибка трекера не повторяется, а сразу становится исключением с текстом трекера
+ */
+void TestUdpError()
+{
+    FakeUdpTracker fake({.error = "torrent not registered"});
+    UdpTracker tracker(fake.Url(), std::chrono::milliseconds(100), 3);
+
+    TorrentFile tf = MakeTorrent();
+    std::string message;
+    try
+    {
+        tracker.Announce(tf, PeerId, 6881, 0, 0, tf.length);
+    } catch(const std::runtime_error& e)
+    {
+        message = e.what();
+    }
+    assert(message.find("torrent not registered") != std::string::npos);
+    assert(fake.Connects() == 1);
+}
+
+/*
+ * HTTP трекер получает параметры анонса и отдает компактный список пиров
+ */
+void TestHttpAnnounce()
+{
+    FakeHttpTracker fake({.peers = SwarmA, .interval = 600});
+    TorrentTracker tracker(fake.Url());
+
+    TorrentFile tf = MakeTorrent();
+    assert(tracker.UpdatePeers(tf, PeerId, 6881, AnnounceStats{10, 20, 30}));
+    assert(tracker.GetPeers() == SwarmA);
+    assert(tracker.Interval() == std::chrono::seconds(600));
+
+    auto requests = fake.Requests();
+    assert(requests.size() == 1);
+    assert(requests[0].find("compact=1") != std::string::npos);
+    assert(requests[0].find("uploaded=10") != std::string::npos);
+    assert(requests[0].find("left=30") != std::string::npos);
+}
+
+/*
+ * Если не ответил ни один трекер первого уровня, опрашивается второй; ответивший трекер переносится в начало уровня,
+ * не дожидаясь молчащего соседа
+ */
+void TestTierFailover()
+{
+    FakeUdpTracker udpError({.error = "go away"});
+    FakeHttpTracker httpDown({.status = 503});
+    FakeHttpTracker httpFailure({.failure = "unregistered torrent"});
+    FakeUdpTracker udpSilent({.silent = true});
+    FakeUdpTracker udpAnswer({.peers = SwarmB, .interval = 1200});
+
+    TrackerList trackers({{udpError.Url(), httpDown.Url(), httpFailure.Url()}, {udpSilent.Url(), udpAnswer.Url()}});
+    TorrentFile tf = MakeTorrent();
+    std::vector<Peer> seen;
+    auto start = Clock::now();
+    std::vector<Peer> peers = trackers.Announce(tf, PeerId, 6881, [&seen](const std::vector<Peer>& found) {
+        seen.insert(seen.end(), found.begin(), found.end());
+    });
+    assert(Clock::now() - start < std::chrono::seconds(5));
+
+    assert(peers == SwarmB);
+    assert(seen == SwarmB);
+    assert(trackers.Answered());
+    assert(trackers.Interval() == std::chrono::seconds(1200));
+    assert(udpError.Connects() == 1);
+    assert(trackers.Tiers()[1][0] == udpAnswer.Url());
+}
+
+/*
+ * Отмена прерывает ожидание молчащего трекера, и следующие уровни уже не опрашиваются
+ */
+void TestCancel()
+{
+    FakeUdpTracker udpSilent({.silent = true});
+    FakeUdpTracker udpAnswer({.peers = SwarmA});
+
+    TrackerList trackers({{udpSilent.Url()}, {udpAnswer.Url()}});
+    TorrentFile tf = MakeTorrent();
+
+    std::thread canceller([&trackers] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        trackers.Cancel();
+    });
+    auto start = Clock::now();
+    std::vector<Peer> peers = trackers.Announce(tf, PeerId, 6881);
+    auto elapsed = Clock::now() - start;
+    canceller.join();
+    assert(peers.empty());
+    assert(!trackers.Answered());
+    assert(elapsed < std::chrono::milliseconds(300) + UdpTracker::POLL_SLICE * 3);
+    assert(udpAnswer.Connects() == 0);
+
+    // отмена действует и на следующий анонс
+    size_t connects = udpSilent.Connects();
+    assert(trackers.Announce(tf, PeerId, 6881).empty());
+    assert(udpSilent.Connects() == connects);
+}
+
+/*
+ * Отмена до анонса не теряется, а после `Resume` трекеры снова опрашиваются
+ */
+void TestCancelBeforeAnnounce()
+{
+    FakeUdpTracker udpAnswer({.peers = SwarmA});
+    TrackerList trackers({{udpAnswer.Url()}});
+    TorrentFile tf = MakeTorrent();
+
+    trackers.Cancel();
+    assert(trackers.Announce(tf, PeerId, 6881).empty());
+    assert(udpAnswer.Connects() == 0);
+
+    trackers.Resume();
+    assert(trackers.Announce(tf, PeerId, 6881) == SwarmA);
+    assert(udpAnswer.Connects() == 1);
+}
+
+void Run(const char* name, void (*test)())
+{
+    auto start = Clock::now();
+    test();
+    std::cerr << "OK " << name << " ("
+              << std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count() << " ms)"
+              << std::endl;
+}
+}
+
+int main()
+{
+    Run("UdpRetry", TestUdpRetry);
+    Run("UdpGivesUp", TestUdpGivesUp);
+    Run("UdpError", TestUdpError);
+    Run("HttpAnnounce", TestHttpAnnounce);
+    Run("TierFailover", TestTierFailover);
+    Run("Cancel", TestCancel);
+    Run("CancelBeforeAnnounce", TestCancelBeforeAnnounce);
+    return 0;
+}
@@ -0,0 +1,125 @@
+#include "token_bucket.h"
+#include <algorithm>
+#include <cmath>
+
+TokenBucket::TokenBucket(uint64_t rate, TokenBucket* parent)
+: rate_(rate)
+, tokens_(0)
+, updated_(Clock::now())
+, parent_(parent)
+{
+    tokens_ = Capacity();
+}
+
+void TokenBucket::SetRate(uint64_t rate)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto now = Clock::now();
+    Refill(now);
+    bool wasLimited = rate_ != 0;
+    rate_ = rate;
+    // без ограничения байты не копились, поэтому начинаем с полной корзины
+    tokens_ = wasLimited ? std::min(tokens_, Capacity()) : Capacity();
+    updated_ = now;
+}
+
+uint64_t TokenBucket::Rate() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return rate_;
+}
+
+void TokenBucket::SetParent(TokenBucket* parent)
+{
+    parent_ = parent;
+}
+
+bool TokenBucket::Limited() const
+{
+    for(const TokenBucket* bucket = this; bucket; bucket = bucket->parent_)
+    {
+        if(bucket->Rate() != 0) return true;
+    }
+    return false;
+}
+
+size_t TokenBucket::Available(Clock::time_point now)
+{
+    size_t available = UNLIMITED;
+    for(TokenBucket* bucket = this; bucket; bucket = bucket->parent_)
+    {
+        available = std::min(available, bucket->OwnAvailable(now));
+    }
+    return available;
+}
+
+size_t TokenBucket::Take(size_t wanted, Clock::time_point now)
+{
+    size_t taken = std::min(wanted, Available(now));
+    if(taken > 0)
+    {
+        Add(-(double) taken, now);
+    }
+    return taken;
+}
+
+bool TokenBucket::TakeExactly(size_t bytes, Clock::time_point now)
+{
+    if(Available(now) < bytes) return false;
+    Add(-(double) bytes, now);
+    return true;
+}
+
+void TokenBucket::Refund(size_t bytes)
+{
+    if(bytes > 0)
+    {
+        Add(bytes, Clock::now());
+    }
+}
+
+std::chrono::milliseconds TokenBucket::TimeUntil(size_t bytes, Clock::time_point now)
+{
+    double wait = 0;  // секунды
+    for(TokenBucket* bucket = this; bucket; bucket = bucket->parent_)
+    {
+        std::lock_guard<std::mutex> lock(bucket->mutex_);
+        if(bucket->rate_ == 0) continue;
+        bucket->Refill(now);
+        // больше, чем вмещает корзина, в ней не накопится никогда
+        double missing = std::min<double>(bytes, bucket->Capacity()) - bucket->tokens_;
+        wait = std::max(wait, missing / bucket->rate_);
+    }
+    return std::chrono::milliseconds((int64_t) std::ceil(wait * 1000));
+}
+
+double TokenBucket::Capacity() const
+{
+    return std::max<double>(rate_ * std::chrono::duration<double>(BURST).count(), MIN_CAPACITY);
+}
+
+void TokenBucket::Refill(Clock::time_point now)
+{
+    if(now <= updated_) return;
+    tokens_ = std::min(tokens_ + rate_ * std::chrono::duration<double>(now - updated_).count(), Capacity());
+    updated_ = now;
+}
+
+size_t TokenBucket::OwnAvailable(Clock::time_point now)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(rate_ == 0) return UNLIMITED;
+    Refill(now);
+    return tokens_ > 0 ? (size_t) tokens_ : 0;
+}
+
+void TokenBucket::Add(double bytes, Clock::time_point now)
+{
+    for(TokenBucket* bucket = this; bucket; bucket = bucket->parent_)
+    {
+        std::lock_guard<std::mutex> lock(bucket->mutex_);
+        if(bucket->rate_ == 0) continue;
+        bucket->Refill(now);
+        bucket->tokens_ = std::min(bucket->tokens_ + bytes, bucket->Capacity());
+    }
+}
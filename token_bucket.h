@@ -0,0 +1,95 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+
+/*
+ * Ограничение скорости (token bucket).
+ * Корзина пополняется `rate` байтами в секунду и вмещает их не больше, чем набирается за `BURST` (но не меньше
+ * `MIN_CAPACITY`, чтобы влезал блок): так скорость держится ровной, а не выдается рывками после простоя.
+ * Корзины складываются в иерархию (общая -> торрент -> пир): байты берутся сразу из всей цепочки родителей,
+ * и доступно столько, сколько есть в самой пустой из них. rate = 0 -- без ограничения.
+ * Корзина потокобезопасна. Два потока могут одновременно взять одни и те же байты; тогда корзина уходит в минус,
+ * и следующим придется подождать дольше, так что средняя скорость все равно не превышает `rate`
+ * https://en.wikipedia.org/wiki/Token_bucket
+ */
+class TokenBucket {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit TokenBucket(uint64_t rate = 0, TokenBucket* parent = nullptr);
+
+    TokenBucket(const TokenBucket&) = delete;
+    TokenBucket& operator=(const TokenBucket&) = delete;
+
+    /*
+     * Поменять ограничение, байт/с (0 -- без ограничения). Можно вызывать из любого потока
+     */
+    void SetRate(uint64_t rate);
+    uint64_t Rate() const;
+
+    /*
+     * Вложить корзину в `parent`. Вызывается до того, как корзиной начали пользоваться
+     */
+    void SetParent(TokenBucket* parent);
+
+    /*
+     * Ограничена ли скорость этой корзиной или кем-то из ее родителей
+     */
+    bool Limited() const;
+
+    /*
+     * Сколько байт можно взять прямо сейчас (`UNLIMITED`, если ограничений нет)
+     */
+    size_t Available(Clock::time_point now = Clock::now());
+
+    /*
+     * Взять до `wanted` байт: столько, сколько доступно. Возвращает, сколько взято
+     */
+    size_t Take(size_t wanted, Clock::time_point now = Clock::now());
+
+    /*
+     * Взять ровно `bytes` байт, если столько доступно. Иначе ничего не брать и вернуть false
+     */
+    bool TakeExactly(size_t bytes, Clock::time_point now = Clock::now());
+
+    /*
+     * Вернуть взятые, но не потраченные байты (например, сокет принял меньше, чем было взято)
+     */
+    void Refund(size_t bytes);
+
+    /*
+     * Через сколько станет доступно `bytes` байт, если их никто не возьмет раньше
+     */
+    std::chrono::milliseconds TimeUntil(size_t bytes, Clock::time_point now = Clock::now());
+
+    static constexpr size_t UNLIMITED = std::numeric_limits<size_t>::max();
+    static constexpr std::chrono::milliseconds BURST{100};
+    static constexpr size_t MIN_CAPACITY = 1 << 15;
+private:
+    mutable std::mutex mutex_;
+    uint64_t rate_;
+    double tokens_;  // может уйти в минус, см. описание класса
+    Clock::time_point updated_;  // когда корзина последний раз пополнялась
+    TokenBucket* parent_;
+
+    double Capacity() const;
+
+    /*
+     * Пополнить корзину за время с прошлого пополнения. Вызывается под `mutex_`
+     */
+    void Refill(Clock::time_point now);
+
+    /*
+     * Сколько байт есть в этой корзине без учета родителей
+     */
+    size_t OwnAvailable(Clock::time_point now);
+
+    /*
+     * Добавить `bytes` байт (отрицательное значение -- списать) в этой корзине и во всех родителях
+     */
+    void Add(double bytes, Clock::time_point now);
+};
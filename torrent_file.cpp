@@ -1,44 +1,406 @@
 #pragma once
 
 #include "torrent_file.h"
-#include <openssl/sha.h>
-#include <cassert>
+#include "byte_tools.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <optional>
+#include <stdexcept>
 
-void CountInfoHash(std::string& infoHash, const bencode::Dictionary& dict)
+namespace {
+constexpr size_t READ_CHUNK_SIZE = 64 * 1024;
+constexpr size_t HASH_LENGTH = 20;
+
+using Event = bencode::Reader::Event;
+
+/*
+ * События bencode из .torrent файла, который читается кусками фиксированного размера.
+ * Попутно по исходным байтам словаря `info` считается info hash, так что в памяти не держится ни файл целиком,
+ * ни словарь `info`
+ */
+class TorrentStream {
+public:
+    explicit TorrentStream(const std::string& filename)
+    : fd_(open(filename.c_str(), O_RDONLY | O_CLOEXEC))
+    , chunk_(READ_CHUNK_SIZE, '\0')
+    {
+        if(fd_ == -1)
+        {
+            throw std::runtime_error("Error: cannot open " + filename + ": " + strerror(errno));
+        }
+    }
+
+    ~TorrentStream()
+    {
+        close(fd_);
+    }
+
+    TorrentStream(const TorrentStream&) = delete;
+    TorrentStream& operator=(const TorrentStream&) = delete;
+
+    Event Next()
+    {
+        for(;;)
+        {
+            Event event = reader_.next();
+            if(event != Event::NeedMore) return event;
+            HashChunk();
+            ReadChunk();
+        }
+    }
+
+    void Expect(Event event, Event expected, const char* what)
+    {
+        if(event != expected)
+        {
+            throw std::runtime_error(std::string("Error: bad torrent file: ") + what);
+        }
+    }
+
+    std::string Key() const
+    {
+        return std::string(reader_.key());
+    }
+
+    /*
+     * Пропустить остаток значения, первым событием которого было `event`
+     */
+    void SkipValue(Event event)
+    {
+        if(event == Event::BeginList || event == Event::BeginDictionary || (event == Event::String && !reader_.last()))
+        {
+            reader_.skip();
+        }
+    }
+
+    void Skip()
+    {
+        reader_.skip();
+    }
+
+    /*
+     * Прочитать значение текущего ключа целиком
+     */
+    std::string ReadString(const char* what)
+    {
+        Expect(Next(), Event::String, what);
+        return CollectString(what);
+    }
+
+    /*
+     * Собрать строку, первый кусок которой выдан последним событием
+     */
+    std::string CollectString(const char* what)
+    {
+        std::string result;
+        result.reserve(reader_.stringLength());
+        result += reader_.string();
+        while(!reader_.last())
+        {
+            Expect(Next(), Event::String, what);
+            result += reader_.string();
+        }
+        return result;
+    }
+
+    int64_t ReadInteger(const char* what)
+    {
+        Expect(Next(), Event::Integer, what);
+        return reader_.integer();
+    }
+
+    /*
+     * Значение текущего ключа -- словарь info: считаем хеш с его первого байта и до закрывающего 'e'
+     */
+    void BeginInfo()
+    {
+        infoBegin_ = hashed_ = reader_.offset();
+    }
+    void EndInfo()
+    {
+        infoEnd_ = reader_.offset();
+        HashChunk();
+    }
+    std::string InfoHash()
+    {
+        return hasher_.Final();
+    }
+private:
+    int fd_;
+    bencode::Reader reader_;
+    std::string chunk_;  // последний прочитанный кусок файла
+    size_t chunkLength_ = 0;
+    size_t chunkOffset_ = 0;  // смещение этого куска от начала файла
+    std::optional<size_t> infoBegin_;
+    std::optional<size_t> infoEnd_;
+    size_t hashed_ = 0;  // до какого смещения байты info уже переданы в хеш
+    Sha1Context hasher_;
+
+    void ReadChunk()
+    {
+        chunkOffset_ += chunkLength_;
+        ssize_t length;
+        do
+        {
+            length = read(fd_, chunk_.data(), chunk_.size());
+        } while(length == -1 && errno == EINTR);
+        if(length == -1)
+        {
+            throw std::runtime_error(std::string("Error: cannot read torrent file: ") + strerror(errno));
+        }
+
+        chunkLength_ = length;
+        if(length == 0)
+        {
+            reader_.finish();
+            return;
+        }
+        reader_.feed(std::string_view(chunk_).substr(0, chunkLength_));
+    }
+
+    /*
+     * Передать в хеш байты словаря info из текущего куска. Вызывается до того, как кусок будет перезаписан:
+     * к этому моменту разобрано все, что в нем есть, поэтому начало и конец info, если они в нем, уже известны
+     */
+    void HashChunk()
+    {
+        if(!infoBegin_) return;
+        size_t end = std::min(chunkOffset_ + chunkLength_, infoEnd_.value_or(SIZE_MAX));
+        if(end <= hashed_) return;
+        hasher_.Update(std::string_view(chunk_).substr(hashed_ - chunkOffset_, end - hashed_));
+        hashed_ = end;
+    }
+};
+
+bool IsBadPathComponent(const std::string& component)
 {
-    assert(infoHash.empty());
-    unsigned char hash[20];
-    std::string dictHash = dict.encode();
-    SHA1((const unsigned char*) dictHash.c_str(), dictHash.size(), hash);
-    for(int i = 0; i < 20; ++i)
+    return component.empty() || component == "." || component == ".." || component.find('/') != std::string::npos;
+}
+
+/*
+ * Элемент списка files: словарь {length, path}, path -- список компонент пути
+ */
+TorrentFileEntry ReadFileEntry(TorrentStream& stream)
+{
+    std::optional<int64_t> length;
+    std::string path;
+    for(Event event = stream.Next(); event != Event::End; event = stream.Next())
     {
-        infoHash.push_back(hash[i]);
+        stream.Expect(event, Event::Key, "file entry is not a dictionary");
+        std::string key = stream.Key();
+        if(key == "length")
+        {
+            length = stream.ReadInteger("file length is not an integer");
+        }
+        else if(key == "path")
+        {
+            stream.Expect(stream.Next(), Event::BeginList, "file path is not a list");
+            for(Event item = stream.Next(); item != Event::End; item = stream.Next())
+            {
+                stream.Expect(item, Event::String, "file path component is not a string");
+                std::string component = stream.CollectString("file path component is not a string");
+                if(IsBadPathComponent(component))
+                {
+                    throw std::runtime_error("Error: bad path component in torrent file: " + component);
+                }
+                path += "/";
+                path += component;
+            }
+        }
+        else
+        {
+            stream.Skip();
+        }
     }
+    if(!length || *length < 0 || path.empty())
+    {
+        throw std::runtime_error("Error: torrent file entry has no path or length");
+    }
+    return {std::move(path), static_cast<size_t>(*length), 0};
 }
-void CountPieceHashes(std::vector<std::string>& pieceHashes, bencode::Dictionary& info)
+
+/*
+ * Список announce-list: список уровней, каждый уровень -- список адресов трекеров.
+ * Поле необязательное, поэтому неправильные элементы и пустые уровни пропускаются, а не ломают весь торрент
+ */
+std::vector<std::vector<std::string>> ReadAnnounceList(TorrentStream& stream)
 {
-    std::string pieces = std::dynamic_pointer_cast<bencode::String>(info["pieces"])->get();
-    for(size_t i = 0; i < pieces.size(); i += 20)
+    std::vector<std::vector<std::string>> tiers;
+    Event event = stream.Next();
+    if(event != Event::BeginList)
     {
-        pieceHashes.emplace_back(pieces.substr(i, 20));
+        stream.SkipValue(event);
+        return tiers;
+    }
+    for(Event tier = stream.Next(); tier != Event::End; tier = stream.Next())
+    {
+        if(tier != Event::BeginList)
+        {
+            stream.SkipValue(tier);
+            continue;
+        }
+        std::vector<std::string> urls;
+        for(Event item = stream.Next(); item != Event::End; item = stream.Next())
+        {
+            if(item == Event::String)
+            {
+                urls.push_back(stream.CollectString("announce url is not a string"));
+            }
+            else
+            {
+                stream.SkipValue(item);
+            }
+        }
+        if(!urls.empty())
+        {
+            tiers.push_back(std::move(urls));
+        }
+    }
+    return tiers;
+}
+}
+
+size_t TorrentFile::PiecesCount() const
+{
+    return pieceHashes.size() / HASH_LENGTH;
+}
+std::string_view TorrentFile::PieceHash(size_t pieceIndex) const
+{
+    return std::string_view(pieceHashes).substr(pieceIndex * HASH_LENGTH, HASH_LENGTH);
+}
+std::vector<std::vector<std::string>> TorrentFile::AnnounceTiers() const
+{
+    // по BEP 12 клиенты, понимающие announce-list, поле announce не используют
+    if(!announceList.empty()) return announceList;
+    if(announce.empty()) return {};
+    return {{announce}};
+}
+void CountFiles(TorrentFile& torrent, std::vector<TorrentFileEntry> files)
+{
+    if(files.empty())
+    {
+        torrent.files = {{torrent.name, torrent.length, 0}};
+        return;
+    }
+
+    // пути в списке files заданы относительно каталога торрента `name`
+    torrent.length = 0;
+    torrent.files = std::move(files);
+    for(auto& file : torrent.files)
+    {
+        file.path.insert(0, torrent.name);
+        file.offset = torrent.length;
+        torrent.length += file.length;
     }
 }
 TorrentFile LoadTorrentFile(const std::string& filename)
 {
     TorrentFile torrent;
-    std::ifstream stream(filename);
-    auto fileDict = *std::dynamic_pointer_cast<bencode::Dictionary>(bencode::ParseBencode<std::ifstream>(stream, static_cast<char>(stream.get())));
+    TorrentStream stream(filename);
+    bool hasAnnounce = false;
+    bool hasInfo = false;
+    std::optional<int64_t> pieceLength;
+    std::optional<int64_t> length;
+    std::optional<std::string> name;
+    std::string pieces;
+    std::vector<TorrentFileEntry> files;
+
+    // из корневого словаря и словаря info берем только нужные поля, остальные пропускаем не разбирая
+    stream.Expect(stream.Next(), Event::BeginDictionary, "root is not a dictionary");
+    for(Event event = stream.Next(); event != Event::End; event = stream.Next())
+    {
+        std::string key = stream.Key();
+        if(key == "announce")
+        {
+            torrent.announce = stream.ReadString("announce is not a string");
+            hasAnnounce = true;
+        }
+        else if(key == "announce-list")
+        {
+            torrent.announceList = ReadAnnounceList(stream);
+        }
+        else if(key == "comment")
+        {
+            torrent.comment = stream.ReadString("comment is not a string");
+        }
+        else if(key == "info" && !hasInfo)
+        {
+            hasInfo = true;
+            stream.BeginInfo();
+            stream.Expect(stream.Next(), Event::BeginDictionary, "info is not a dictionary");
+            for(Event infoEvent = stream.Next(); infoEvent != Event::End; infoEvent = stream.Next())
+            {
+                std::string infoKey = stream.Key();
+                if(infoKey == "piece length")
+                {
+                    pieceLength = stream.ReadInteger("piece length is not an integer");
+                }
+                else if(infoKey == "name")
+                {
+                    name = stream.ReadString("name is not a string");
+                }
+                else if(infoKey == "length")
+                {
+                    length = stream.ReadInteger("length is not an integer");
+                }
+                else if(infoKey == "pieces")
+                {
+                    pieces = stream.ReadString("pieces is not a string");
+                }
+                else if(infoKey == "files")
+                {
+                    stream.Expect(stream.Next(), Event::BeginList, "files is not a list");
+                    for(Event item = stream.Next(); item != Event::End; item = stream.Next())
+                    {
+                        stream.Expect(item, Event::BeginDictionary, "file entry is not a dictionary");
+                        files.push_back(ReadFileEntry(stream));
+                    }
+                }
+                else
+                {
+                    stream.Skip();
+                }
+            }
+            stream.EndInfo();
+        }
+        else
+        {
+            stream.Skip();
+        }
+    }
 
-    torrent.announce = std::dynamic_pointer_cast<bencode::String>(fileDict["announce"])->get();
-    torrent.comment = std::dynamic_pointer_cast<bencode::String>(fileDict["comment"])->get();
+    if(!hasAnnounce && torrent.announceList.empty())
+    {
+        throw std::runtime_error("Error: torrent file has no announce");
+    }
+    if(!hasInfo)
+    {
+        throw std::runtime_error("Error: torrent file has no info dictionary");
+    }
+    if(!pieceLength || *pieceLength <= 0 || !name || (!length && files.empty()) || (length && *length < 0))
+    {
+        throw std::runtime_error("Error: torrent file info dictionary is incomplete");
+    }
 
-    auto infoDict = *std::dynamic_pointer_cast<bencode::Dictionary>(fileDict["info"]);
-    CountInfoHash(torrent.infoHash, infoDict);
+    torrent.infoHash = stream.InfoHash();
+    torrent.pieceLength = *pieceLength;
+    torrent.name = std::move(*name);
+    if(IsBadPathComponent(torrent.name))
+    {
+        throw std::runtime_error("Error: bad torrent name: " + torrent.name);
+    }
+    torrent.length = length.value_or(0);
+    CountFiles(torrent, std::move(files));
 
-    torrent.length = std::dynamic_pointer_cast<bencode::Integer>(infoDict["length"])->get();
-    torrent.pieceLength = std::dynamic_pointer_cast<bencode::Integer>(infoDict["piece length"])->get();
-    torrent.name = std::dynamic_pointer_cast<bencode::String>(infoDict["name"])->get();
-    CountPieceHashes(torrent.pieceHashes, infoDict);
+    // хеши частей остаются одной строкой, без отдельного объекта на каждую часть
+    if(pieces.size() % HASH_LENGTH)
+    {
+        throw std::runtime_error("Error: piece hashes length is not a multiple of 20");
+    }
+    torrent.pieceHashes = std::move(pieces);
 
     return torrent;
 }
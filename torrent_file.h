@@ -4,16 +4,47 @@
 #include <vector>
 #include "bencode.h"
 
+/*
+ * Один файл из торрента. Файлы идут друг за другом, и части файла нарезаются из их общего потока данных
+ */
+struct TorrentFileEntry {
+    std::string path;  // путь относительно каталога загрузки, для многофайловых торрентов начинается с `name`
+    size_t length;
+    size_t offset;  // смещение начала файла в общем потоке данных торрента
+};
+
 struct TorrentFile {
     std::string announce;
+    std::vector<std::vector<std::string>> announceList;  // уровни трекеров из announce-list (BEP 12), может быть пустым
     std::string comment;
-    std::vector<std::string> pieceHashes;
+    std::string pieceHashes;  // хеши всех частей подряд, по 20 байт на часть
     size_t pieceLength;
     size_t length;
     std::string name;
     std::string infoHash;
+    std::vector<TorrentFileEntry> files;  // для однофайлового торрента -- один файл `name`
+
+    /*
+     * Число частей и хеш части `pieceIndex` (20 байт)
+     */
+    size_t PiecesCount() const;
+    std::string_view PieceHash(size_t pieceIndex) const;
+
+    /*
+     * Уровни трекеров для анонса: announce-list, а если его нет -- один уровень из announce
+     * http://www.bittorrent.org/beps/bep_0012.html
+     */
+    std::vector<std::vector<std::string>> AnnounceTiers() const;
 };
 
-void CountPieceHashes(std::vector<std::string>& pieceHashes, bencode::Dictionary& info);
-void CountInfoHash(std::string& infoHash, const bencode::Dictionary& dict);
+/*
+ * Заполнить таблицу файлов торрента. `files` -- элементы списка files из словаря info с путями относительно `name`,
+ * пустой для однофайлового торрента
+ */
+void CountFiles(TorrentFile& torrent, std::vector<TorrentFileEntry> files);
+
+/*
+ * Прочитать .torrent файл. Файл разбирается потоково, кусками, а info hash -- SHA1 от исходных байтов словаря `info`
+ * в том виде, в каком он записан в файле -- считается по ходу чтения
+ */
 TorrentFile LoadTorrentFile(const std::string& filename);
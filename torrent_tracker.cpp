@@ -1,44 +1,213 @@
 #pragma once
 #include "torrent_tracker.h"
+#include <netinet/in.h>
+#include <algorithm>
 
 TorrentTracker::TorrentTracker(const std::string& url)
         : url_(url)
+        , udp_(UdpTracker::IsUdpUrl(url) ? std::make_unique<UdpTracker>(url) : nullptr)
+        , interval_(0)
+        , minInterval_(0)
 {}
 
-void TorrentTracker::UpdatePeers(const TorrentFile &tf, std::string peerId, int port)
+bool TorrentTracker::UpdatePeers(const TorrentFile &tf, std::string peerId, int port)
 {
+    return UpdatePeers(tf, std::move(peerId), port, AnnounceStats{0, 0, tf.length});
+}
+
+bool TorrentTracker::UpdatePeers(const TorrentFile &tf, std::string peerId, int port, const AnnounceStats& stats,
+                                 const std::atomic_bool* cancelled)
+{
+    auto isCancelled = [cancelled] { return cancelled && *cancelled; };
+    if(udp_)
+    {
+        std::string peers = udp_->Announce(tf, peerId, port, stats.uploaded, stats.downloaded, stats.left, cancelled);
+        // трекер, к которому подключились по IPv6, отвечает адресами IPv6 (BEP 15)
+        peers_.clear();
+        PeerSet unique(peers.size() / 6);
+        AppendCompactPeers(peers, udp_->Family() == AF_INET6 ? Peer::Family::V6 : Peer::Family::V4, unique);
+        interval_ = udp_->Interval();
+        minInterval_ = std::chrono::seconds(0);
+        return true;
+    }
+
+    // ответ разбираем потоково, прямо по мере получения тела: из него нужны только поля peers, peers6,
+    // failure reason и интервалы анонса, остальное пропускается без разбора.
+    // Пиры приходят либо компактной строкой, либо списком словарей {ip, port}
+    bencode::Reader reader;
+    std::string peers;
+    std::string peers6;
+    std::string failure;
+    int64_t interval = 0;
+    int64_t minInterval = 0;
+    std::string* field = nullptr;  // поле, строку которого сейчас собираем
+    int64_t* number = nullptr;  // поле, число которого ждем
+    std::vector<Peer> listed;  // пиры из списка словарей
+    bool inPeerList = false;
+    char ip[INET6_ADDRSTRLEN];  // поле ip текущего словаря пира
+    size_t ipLength = 0;
+    int64_t peerPort = -1;
+    enum class PeerField { None, Ip, Port } peerField = PeerField::None;
+    std::exception_ptr error;
+
+    auto drain = [&]() {
+        for(auto event = reader.next(); event != bencode::Reader::Event::NeedMore && event != bencode::Reader::Event::Done;
+            event = reader.next())
+        {
+            if(event == bencode::Reader::Event::Key && reader.depth() == 1)
+            {
+                std::string_view key = reader.key();
+                field = key == "peers" ? &peers : key == "peers6" ? &peers6 : key == "failure reason" ? &failure : nullptr;
+                number = key == "interval" ? &interval : key == "min interval" ? &minInterval : nullptr;
+                if(!field && !number) reader.skip();
+            }
+            else if(event == bencode::Reader::Event::Integer && number)
+            {
+                *number = reader.integer();
+                number = nullptr;
+            }
+            else if(event == bencode::Reader::Event::String && field && reader.depth() == 1)
+            {
+                field->append(reader.string());
+                if(reader.last()) field = nullptr;
+            }
+            else if(event == bencode::Reader::Event::BeginList && reader.depth() == 2 && field && field != &failure)
+            {
+                inPeerList = true;
+                field = nullptr;
+            }
+            else if(event == bencode::Reader::Event::BeginDictionary && reader.depth() == 3 && inPeerList)
+            {
+                ipLength = 0;
+                peerPort = -1;
+            }
+            else if(event == bencode::Reader::Event::Key && reader.depth() == 3 && inPeerList)
+            {
+                peerField = reader.key() == "ip" ? PeerField::Ip : reader.key() == "port" ? PeerField::Port : PeerField::None;
+                if(peerField == PeerField::None) reader.skip();
+            }
+            else if(event == bencode::Reader::Event::String && peerField == PeerField::Ip)
+            {
+                // длинное значение -- не IP адрес (например, доменное имя), такого пира пропустим
+                std::string_view chunk = reader.string();
+                size_t length = std::min(chunk.size(), sizeof(ip) - ipLength);
+                std::copy(chunk.begin(), chunk.begin() + length, ip + ipLength);
+                ipLength = chunk.size() > length ? sizeof(ip) : ipLength + length;
+                if(reader.last()) peerField = PeerField::None;
+            }
+            else if(event == bencode::Reader::Event::Integer && peerField == PeerField::Port)
+            {
+                peerPort = reader.integer();
+                peerField = PeerField::None;
+            }
+            else if(event == bencode::Reader::Event::End && inPeerList)
+            {
+                if(reader.depth() == 1)
+                {
+                    inPeerList = false;
+                }
+                else if(reader.depth() == 2 && ipLength < sizeof(ip) && peerPort > 0 && peerPort <= UINT16_MAX)
+                {
+                    try
+                    {
+                        listed.emplace_back(std::string_view(ip, ipLength), static_cast<uint16_t>(peerPort));
+                    } catch(const std::exception&)
+                    {
+                    }
+                }
+            }
+            else if((event == bencode::Reader::Event::BeginList || event == bencode::Reader::Event::BeginDictionary) &&
+                    reader.depth() > 1)
+            {
+                field = nullptr;
+                reader.skip();
+            }
+        }
+    };
+
     cpr::Response Resp = cpr::Get(
             cpr::Url{url_},
             cpr::Parameters {
                     {"info_hash", tf.infoHash},
                     {"peer_id", peerId},
                     {"port", std::to_string(port)},
-                    {"uploaded", std::to_string(0)},
-                    {"downloaded", std::to_string(0)},
-                    {"left", std::to_string(tf.length)},
+                    {"uploaded", std::to_string(stats.uploaded)},
+                    {"downloaded", std::to_string(stats.downloaded)},
+                    {"left", std::to_string(stats.left)},
                     {"compact", std::to_string(1)}
             },
-            cpr::Timeout{20000}
+            cpr::Timeout{20000},
+            // libcurl вызывает его и во время ожидания ответа, так что отмена прерывает запрос, не дожидаясь таймаута
+            cpr::ProgressCallback{[&isCancelled](cpr::cpr_off_t, cpr::cpr_off_t, cpr::cpr_off_t, cpr::cpr_off_t, intptr_t) {
+                return !isCancelled();
+            }},
+            cpr::WriteCallback{[&](std::string_view data, intptr_t) {
+                if(isCancelled()) return false;
+                try
+                {
+                    reader.feed(data);
+                    drain();
+                }
+                catch(...)
+                {
+                    error = std::current_exception();
+                    return false;  // прерываем загрузку ответа
+                }
+                return true;
+            }}
     );
 
+    // отмена обрывает загрузку тела, и недочитанный ответ -- не ошибка трекера
+    if(isCancelled())
+    {
+        return false;
+    }
     if(Resp.status_code != 200)
     {
         std::cerr << "Something went wrong... Status code: " << Resp.status_code << std::endl;
-        return;
+        return false;
     }
+    if(error) std::rethrow_exception(error);
 
-    if(Resp.text.find("failure reason") != std::string::npos)
+    reader.finish();
+    drain();
+
+    if(!failure.empty())
     {
-        std::cerr << "Something went wrong... Text of responce: " << Resp.text << std::endl;
-        return;
+        std::cerr << "Something went wrong... Failure reason: " << failure << std::endl;
+        return false;
     }
 
-    std::stringstream stream;
-    stream << Resp.text;
+    // один и тот же пир может прийти и в компактном виде, и в списке
+    peers_.clear();
+    PeerSet unique(peers.size() / 6 + peers6.size() / 18 + listed.size());
+    AppendCompactPeers(peers, Peer::Family::V4, unique);
+    AppendCompactPeers(peers6, Peer::Family::V6, unique);
+    for(const Peer& peer : listed)
+    {
+        if(unique.Insert(peer))
+        {
+            peers_.push_back(peer);
+        }
+    }
+    interval_ = std::chrono::seconds(std::max<int64_t>(interval, 0));
+    minInterval_ = std::chrono::seconds(std::max<int64_t>(minInterval, 0));
+    return true;
+}
 
-    auto Dict = *std::dynamic_pointer_cast<bencode::Dictionary>(bencode::ParseBencode(stream, (char) stream.get()));
+const std::string& TorrentTracker::GetUrl() const
+{
+    return url_;
+}
+
+std::chrono::seconds TorrentTracker::Interval() const
+{
+    return interval_;
+}
 
-    peers_ = ParsePeer(std::dynamic_pointer_cast<bencode::String>(Dict["peers"])->get());
+std::chrono::seconds TorrentTracker::MinInterval() const
+{
+    return minInterval_;
 }
 
 const std::vector<Peer>& TorrentTracker::GetPeers() const
@@ -46,25 +215,16 @@ const std::vector<Peer>& TorrentTracker::GetPeers() const
     return peers_;
 }
 
-std::vector<Peer> TorrentTracker::ParsePeer(const std::string &peers)
+void TorrentTracker::AppendCompactPeers(std::string_view peers, Peer::Family family, PeerSet& unique)
 {
-    std::vector<Peer> result;
-    for(size_t i = 0; i < peers.size(); i += 6)
+    size_t length = Peer::CompactLength(family);
+    peers_.reserve(peers_.size() + peers.size() / length);
+    for(size_t i = 0; i + length <= peers.size(); i += length)
     {
-        result.emplace_back();
-
-        std::string IP = peers.substr(i, 4);
-
-        for(size_t j = 0; j < 4; ++j)
+        Peer peer = Peer::FromCompact(peers.data() + i, family);
+        if(peer.port != 0 && unique.Insert(peer))
         {
-            result.back().ip += std::to_string((uint8_t ) (unsigned char) IP[j]);
-
-            if(j < 3) result.back().ip.push_back('.');
+            peers_.push_back(peer);
         }
-
-        std::string port = peers.substr(i + 4, 2);
-
-        result.back().port = (uint16_t((unsigned char) port[0]) << 8) + uint16_t((unsigned char) port[1]);
     }
-    return result;
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 
 #include "peer.h"
 #include "torrent_file.h"
+#include "udp_tracker.h"
 #include <string>
 #include <vector>
 #include <openssl/sha.h>
@@ -10,12 +11,30 @@
 #include <list>
 #include <map>
 #include <sstream>
+#include <exception>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <cpr/cpr.h>
 
+/*
+ * Сколько мы отдали и скачали за эту сессию и сколько байт еще осталось скачать -- сообщается трекеру в каждом анонсе
+ */
+struct AnnounceStats {
+    uint64_t uploaded = 0;
+    uint64_t downloaded = 0;
+    uint64_t left = 0;
+};
+
+/*
+ * Один трекер. Адреса http(s):// опрашиваются HTTP GET запросом, адреса udp:// -- по протоколу UDP трекера
+ * (см. UdpTracker)
+ */
 class TorrentTracker {
 public:
     /*
-     * url - адрес трекера, берется из поля announce в .torrent-файле
+     * url - адрес трекера, берется из поля announce или announce-list в .torrent-файле
      */
     TorrentTracker(const std::string& url);
 
@@ -29,8 +48,26 @@ public:
      * peerId: id, под которым представляется наш клиент.
      * port: порт, на котором наш клиент будет слушать входящие соединения (пока что мы не слушаем и на этот порт никто
      *  не сможет подключиться).
+     * Возвращает true, если трекер ответил списком пиров (возможно, пустым)
+     */
+    bool UpdatePeers(const TorrentFile& tf, std::string peerId, int port);
+
+    /*
+     * То же, но с настоящей статистикой скачивания вместо "ничего не скачано".
+     * cancelled -- флаг отмены, который выставляют из другого потока, чтобы прервать запрос, не дожидаясь таймаута.
+     * Флаг должен жить до возврата из `UpdatePeers`
      */
-    void UpdatePeers(const TorrentFile& tf, std::string peerId, int port);
+    bool UpdatePeers(const TorrentFile& tf, std::string peerId, int port, const AnnounceStats& stats,
+                     const std::atomic_bool* cancelled = nullptr);
+
+    const std::string& GetUrl() const;
+
+    /*
+     * Через сколько трекер просит повторить анонс (interval) и чаще какого периода его не беспокоить (min interval).
+     * Если трекер их не сообщил, то 0
+     */
+    std::chrono::seconds Interval() const;
+    std::chrono::seconds MinInterval() const;
 
     /*
      * Отдает полученный ранее список пиров
@@ -40,5 +77,13 @@ public:
 private:
     std::string url_;
     std::vector<Peer> peers_;
-    std::vector<Peer> ParsePeer(const std::string& peers);
+    std::unique_ptr<UdpTracker> udp_;  // для адресов udp://
+    std::chrono::seconds interval_;
+    std::chrono::seconds minInterval_;
+
+    /*
+     * Дописать в `peers_` пиров из компактной строки (по 6 байт на пира IPv4, по 18 -- IPv6), пропуская тех,
+     * кто уже есть в `unique`
+     */
+    void AppendCompactPeers(std::string_view peers, Peer::Family family, PeerSet& unique);
 };
\ No newline at end of file
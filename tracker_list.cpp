@@ -0,0 +1,177 @@
+#include "tracker_list.h"
+#include <algorithm>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <unordered_set>
+
+namespace {
+/*
+ * Общее состояние опроса одного уровня: его держат и `Announce`, и потоки трекеров, которые могут пережить его
+ */
+struct TierRound {
+    std::mutex mutex;
+    std::condition_variable changed;
+    size_t pending = 0;  // сколько трекеров еще не ответили и не отказали
+    std::optional<size_t> winner;  // номер первого ответившего трекера в уровне
+    std::vector<Peer> peers;
+    std::chrono::seconds interval{0};
+    std::chrono::seconds minInterval{0};
+};
+}
+
+TrackerList::TrackerList(std::vector<std::vector<std::string>> tiers)
+: answered_(false)
+, interval_(0)
+, minInterval_(0)
+, cancelled_(false)
+{
+    std::mt19937 rng{std::random_device{}()};
+    std::unordered_set<std::string> seen;
+    for(auto& tier : tiers)
+    {
+        std::vector<std::string> urls;
+        for(auto& url : tier)
+        {
+            if(seen.insert(url).second)
+            {
+                urls.push_back(std::move(url));
+            }
+        }
+        if(urls.empty()) continue;
+
+        std::shuffle(urls.begin(), urls.end(), rng);
+        for(const auto& url : urls)
+        {
+            trackers_.emplace(url, std::make_unique<TorrentTracker>(url));
+        }
+        tiers_.push_back(std::move(urls));
+    }
+}
+
+TrackerList::~TrackerList()
+{
+    CancelPending();
+}
+
+std::vector<Peer> TrackerList::Announce(const TorrentFile& tf, const std::string& peerId, int port, PeersCallback onPeers)
+{
+    return Announce(tf, peerId, port, AnnounceStats{0, 0, tf.length}, std::move(onPeers));
+}
+
+std::vector<Peer> TrackerList::Announce(const TorrentFile& tf, const std::string& peerId, int port, const AnnounceStats& stats,
+                                        PeersCallback onPeers)
+{
+    CancelPending();
+    answered_ = false;
+
+    std::shared_ptr<std::atomic_bool> cancelled;
+    {
+        std::lock_guard<std::mutex> lock(cancelMutex_);
+        if(cancelled_) return {};
+        round_ = std::make_shared<std::atomic_bool>(false);
+        cancelled = round_;
+    }
+
+    for(auto& tier : tiers_)
+    {
+        if(*cancelled) break;
+
+        auto round = std::make_shared<TierRound>();
+        round->pending = tier.size();
+        for(size_t i = 0; i < tier.size(); ++i)
+        {
+            TorrentTracker& tracker = *trackers_.at(tier[i]);
+            pending_.emplace_back([round, cancelled, &tracker, i, &tf, peerId, port, stats, onPeers] {
+                bool answered = false;
+                try
+                {
+                    answered = tracker.UpdatePeers(tf, peerId, port, stats, cancelled.get());
+                } catch(const std::exception& e)
+                {
+                    std::cerr << "Logger: tracker " << tracker.GetUrl() << " failed -- " << e.what() << std::endl;
+                }
+                if(answered && onPeers)
+                {
+                    onPeers(tracker.GetPeers());
+                }
+
+                std::lock_guard<std::mutex> lock(round->mutex);
+                --round->pending;
+                if(answered && !round->winner)
+                {
+                    round->winner = i;
+                    round->peers = tracker.GetPeers();
+                    round->interval = tracker.Interval();
+                    round->minInterval = tracker.MinInterval();
+                }
+                round->changed.notify_all();
+            });
+        }
+
+        std::unique_lock<std::mutex> lock(round->mutex);
+        round->changed.wait(lock, [&round] { return round->winner || round->pending == 0; });
+        if(round->winner)
+        {
+            std::cerr << "Logger: tracker " << tier[*round->winner] << " answered with " << round->peers.size()
+                      << " peer(s)" << std::endl;
+            std::rotate(tier.begin(), tier.begin() + *round->winner, tier.begin() + *round->winner + 1);
+            answered_ = true;
+            interval_ = round->interval;
+            minInterval_ = round->minInterval;
+            return std::move(round->peers);
+        }
+    }
+
+    std::cerr << (*cancelled ? "Logger: announce cancelled" : "Logger: no tracker answered") << std::endl;
+    return {};
+}
+
+const std::vector<std::vector<std::string>>& TrackerList::Tiers() const
+{
+    return tiers_;
+}
+
+bool TrackerList::Answered() const
+{
+    return answered_;
+}
+
+std::chrono::seconds TrackerList::Interval() const
+{
+    return interval_;
+}
+
+std::chrono::seconds TrackerList::MinInterval() const
+{
+    return minInterval_;
+}
+
+void TrackerList::Cancel()
+{
+    std::lock_guard<std::mutex> lock(cancelMutex_);
+    cancelled_ = true;
+    if(round_) *round_ = true;
+}
+
+void TrackerList::Resume()
+{
+    std::lock_guard<std::mutex> lock(cancelMutex_);
+    cancelled_ = false;
+}
+
+void TrackerList::CancelPending()
+{
+    {
+        // опросы прошлого `Announce` прерываются только своим флагом, новые анонсы остаются разрешены
+        std::lock_guard<std::mutex> lock(cancelMutex_);
+        if(round_) *round_ = true;
+    }
+    for(auto& thread : pending_)
+    {
+        thread.join();
+    }
+    pending_.clear();
+}
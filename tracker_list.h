@@ -0,0 +1,99 @@
+#pragma once
+
+#include "peer.h"
+#include "torrent_file.h"
+#include "torrent_tracker.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <unordered_map>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+
+/*
+ * Все трекеры торрента, сгруппированные по уровням (announce-list).
+ * Уровни опрашиваются по порядку: следующий -- только если не ответил ни один трекер предыдущего. Внутри уровня
+ * все трекеры опрашиваются одновременно, каждый в своем потоке, и `Announce` возвращается, как только ответил
+ * первый из них, не дожидаясь медленных и недоступных. Ответивший трекер переносится в начало своего уровня,
+ * чтобы в следующий раз спрашивать его первым.
+ * Остальные трекеры уровня продолжают работать в фоне и тоже отдают своих пиров через callback, пока не начнется
+ * следующий `Announce` или список не будет удален
+ * http://www.bittorrent.org/beps/bep_0012.html
+ */
+class TrackerList {
+public:
+    /*
+     * Вызывается из потока трекера для каждого ответа
+     */
+    using PeersCallback = std::function<void(const std::vector<Peer>& peers)>;
+
+    /*
+     * tiers -- уровни трекеров (см. `TorrentFile::AnnounceTiers`). Порядок трекеров внутри уровня перемешивается,
+     * повторяющиеся адреса отбрасываются
+     */
+    explicit TrackerList(std::vector<std::vector<std::string>> tiers);
+
+    /*
+     * Прерывает опросы, которые еще идут в фоне, и дожидается их потоков
+     */
+    ~TrackerList();
+
+    TrackerList(const TrackerList&) = delete;
+    TrackerList& operator=(const TrackerList&) = delete;
+
+    /*
+     * Опросить трекеры и вернуть пиров от первого ответившего (пустой список, если не ответил никто).
+     * `onPeers` получает пиров от каждого ответившего трекера, в том числе от первого -- еще до возврата из
+     * `Announce`. `tf` и все, что использует `onPeers`, должны жить, пока идут фоновые опросы.
+     * stats -- статистика скачивания для трекеров; без нее трекерам сообщается, что ничего не скачано
+     */
+    std::vector<Peer> Announce(const TorrentFile& tf, const std::string& peerId, int port, PeersCallback onPeers = nullptr);
+    std::vector<Peer> Announce(const TorrentFile& tf, const std::string& peerId, int port, const AnnounceStats& stats,
+                               PeersCallback onPeers = nullptr);
+
+    /*
+     * Ответил ли хоть один трекер на последний `Announce`
+     */
+    bool Answered() const;
+
+    /*
+     * interval и min interval ответившего трекера из последнего `Announce`, 0 -- если трекер их не сообщил
+     */
+    std::chrono::seconds Interval() const;
+    std::chrono::seconds MinInterval() const;
+
+    /*
+     * Прервать идущий `Announce` из другого потока: ожидающие ответа трекеры бросают свои запросы, а следующие
+     * уровни не опрашиваются. Отмена действует и на `Announce`, который еще не начался, пока не вызван `Resume`,
+     * поэтому отмена, пришедшая чуть раньше анонса, не теряется
+     */
+    void Cancel();
+
+    /*
+     * Снова разрешить анонсы после `Cancel`
+     */
+    void Resume();
+
+    /*
+     * Уровни трекеров в текущем порядке
+     */
+    const std::vector<std::vector<std::string>>& Tiers() const;
+private:
+    std::vector<std::vector<std::string>> tiers_;
+    std::unordered_map<std::string, std::unique_ptr<TorrentTracker>> trackers_;  // адрес -> трекер
+    std::vector<std::thread> pending_;  // потоки опросов прошлого `Announce`, которые могут еще идти
+    bool answered_;
+    std::chrono::seconds interval_;
+    std::chrono::seconds minInterval_;
+    std::mutex cancelMutex_;
+    bool cancelled_;  // вызван `Cancel`, но не `Resume`
+    std::shared_ptr<std::atomic_bool> round_;  // флаг отмены последнего `Announce`; его опросы только читают флаг
+
+    /*
+     * Прервать опросы прошлого `Announce` и дождаться их потоков
+     */
+    void CancelPending();
+};
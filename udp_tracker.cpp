@@ -0,0 +1,261 @@
+#include "udp_tracker.h"
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <iostream>
+
+namespace {
+constexpr uint64_t PROTOCOL_ID = 0x41727101980;  // магическая константа запроса connect
+constexpr uint32_t ACTION_CONNECT = 0;
+constexpr uint32_t ACTION_ANNOUNCE = 1;
+constexpr uint32_t ACTION_ERROR = 3;
+constexpr size_t CONNECT_REPLY_LENGTH = 16;
+constexpr size_t ANNOUNCE_REPLY_HEADER_LENGTH = 20;  // action, transaction id, interval, leechers, seeders
+constexpr size_t MAX_DATAGRAM_LENGTH = 1 << 16;
+constexpr auto CONNECTION_ID_LIFETIME = std::chrono::minutes(1);
+
+uint32_t RandomId()
+{
+    thread_local std::mt19937 rng{std::random_device{}()};
+    return rng();
+}
+
+/*
+ * Дописать `value` в `out` в формате big endian, `size` байт
+ */
+void AppendInt(std::string& out, uint64_t value, size_t size)
+{
+    for(size_t i = size; i-- > 0;)
+    {
+        out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+    }
+}
+
+uint64_t ReadInt(std::string_view data, size_t offset, size_t size)
+{
+    uint64_t value = 0;
+    for(size_t i = 0; i < size; ++i)
+    {
+        value = (value << 8) | static_cast<unsigned char>(data[offset + i]);
+    }
+    return value;
+}
+}
+
+UdpTracker::UdpTracker(const std::string& url, std::chrono::milliseconds baseTimeout, size_t maxRetries)
+: url_(url)
+, baseTimeout_(baseTimeout)
+, maxRetries_(maxRetries)
+, sock_(-1)
+, family_(AF_UNSPEC)
+, connectionId_(0)
+, interval_(0)
+, cancelled_(nullptr)
+{
+}
+
+UdpTracker::~UdpTracker()
+{
+    if(sock_ >= 0)
+    {
+        close(sock_);
+    }
+}
+
+std::chrono::seconds UdpTracker::Interval() const
+{
+    return interval_;
+}
+
+int UdpTracker::Family() const
+{
+    return family_;
+}
+
+bool UdpTracker::IsUdpUrl(const std::string& url)
+{
+    return url.rfind("udp://", 0) == 0;
+}
+
+std::pair<std::string, std::string> UdpTracker::ParseUrl(const std::string& url)
+{
+    if(!IsUdpUrl(url))
+    {
+        throw std::runtime_error("Error: not a UDP tracker url: " + url);
+    }
+    std::string_view rest = std::string_view(url).substr(6);
+    rest = rest.substr(0, rest.find('/'));
+
+    size_t colon = rest.rfind(':');
+    if(colon == std::string_view::npos || colon == 0 || colon + 1 == rest.size())
+    {
+        throw std::runtime_error("Error: UDP tracker url has no port: " + url);
+    }
+    std::string_view host = rest.substr(0, colon);
+    if(host.front() == '[' && host.back() == ']')
+    {
+        host = host.substr(1, host.size() - 2);
+    }
+    return {std::string(host), std::string(rest.substr(colon + 1))};
+}
+
+void UdpTracker::Open()
+{
+    if(sock_ >= 0) return;
+
+    auto [host, port] = ParseUrl(url_);
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    addrinfo* addresses = nullptr;
+    int result = getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses);
+    if(result != 0)
+    {
+        throw std::runtime_error("Error: cannot resolve UDP tracker " + host + " -- " + gai_strerror(result));
+    }
+
+    // connect у датаграммного сокета только запоминает адрес: теперь приходят лишь ответы этого трекера
+    for(addrinfo* address = addresses; address && sock_ < 0; address = address->ai_next)
+    {
+        sock_ = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if(sock_ >= 0 && connect(sock_, address->ai_addr, address->ai_addrlen) == -1)
+        {
+            close(sock_);
+            sock_ = -1;
+        }
+        else if(sock_ >= 0)
+        {
+            family_ = address->ai_family;
+        }
+    }
+    freeaddrinfo(addresses);
+
+    if(sock_ < 0)
+    {
+        throw std::runtime_error("Error: cannot create socket for UDP tracker " + url_);
+    }
+}
+
+void UdpTracker::Connect()
+{
+    if(connectionId_ && Clock::now() - connectedAt_ < CONNECTION_ID_LIFETIME) return;
+
+    uint32_t transactionId = RandomId();
+    std::string request;
+    AppendInt(request, PROTOCOL_ID, 8);
+    AppendInt(request, ACTION_CONNECT, 4);
+    AppendInt(request, transactionId, 4);
+
+    std::string reply = Exchange(request, ACTION_CONNECT, transactionId);
+    if(reply.size() < CONNECT_REPLY_LENGTH)
+    {
+        throw std::runtime_error("Error: UDP tracker sent short connect reply");
+    }
+    connectionId_ = ReadInt(reply, 8, 8);
+    connectedAt_ = Clock::now();
+}
+
+std::string UdpTracker::Announce(const TorrentFile& tf, const std::string& peerId, int port,
+                                 uint64_t uploaded, uint64_t downloaded, uint64_t left,
+                                 const std::atomic_bool* cancelled)
+{
+    cancelled_ = cancelled;
+    Open();
+    Connect();
+
+    uint32_t transactionId = RandomId();
+    std::string request;
+    AppendInt(request, connectionId_, 8);
+    AppendInt(request, ACTION_ANNOUNCE, 4);
+    AppendInt(request, transactionId, 4);
+    request += tf.infoHash;
+    request += peerId;
+    AppendInt(request, downloaded, 8);
+    AppendInt(request, left, 8);
+    AppendInt(request, uploaded, 8);
+    AppendInt(request, 0, 4);  // event: none
+    AppendInt(request, 0, 4);  // IP: адрес отправителя
+    AppendInt(request, RandomId(), 4);  // key
+    AppendInt(request, UINT32_MAX, 4);  // num_want: -1, сколько трекер сочтет нужным
+    AppendInt(request, port, 2);
+
+    std::string reply = Exchange(request, ACTION_ANNOUNCE, transactionId);
+    if(reply.size() < ANNOUNCE_REPLY_HEADER_LENGTH)
+    {
+        throw std::runtime_error("Error: UDP tracker sent short announce reply");
+    }
+    interval_ = std::chrono::seconds(ReadInt(reply, 8, 4));
+    std::cerr << "Logger: UDP tracker " << url_ << " -- interval " << interval_.count() << " s, "
+              << ReadInt(reply, 16, 4) << " seeders, " << ReadInt(reply, 12, 4) << " leechers" << std::endl;
+    return reply.substr(ANNOUNCE_REPLY_HEADER_LENGTH);
+}
+
+std::string UdpTracker::Exchange(const std::string& request, uint32_t action, uint32_t transactionId)
+{
+    for(size_t attempt = 0; attempt <= maxRetries_; ++attempt)
+    {
+        if(send(sock_, request.data(), request.size(), 0) == -1)
+        {
+            throw std::runtime_error(std::string("Error: cannot send to UDP tracker: ") + strerror(errno));
+        }
+
+        auto timeout = baseTimeout_ * (1 << attempt);
+        auto deadline = Clock::now() + timeout;
+        std::string reply;
+        // чужие и запоздавшие ответы на прошлые попытки пропускаем, пока не истек таймаут этой попытки
+        while(Receive(reply, std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now())))
+        {
+            if(reply.size() < 8 || ReadInt(reply, 4, 4) != transactionId) continue;
+
+            uint32_t replyAction = ReadInt(reply, 0, 4);
+            if(replyAction == ACTION_ERROR)
+            {
+                throw std::runtime_error("Error: UDP tracker error: " + reply.substr(8));
+            }
+            if(replyAction == action)
+            {
+                return reply;
+            }
+        }
+    }
+    throw std::runtime_error("Error: UDP tracker " + url_ + " does not respond");
+}
+
+bool UdpTracker::Receive(std::string& datagram, std::chrono::milliseconds timeout)
+{
+    auto deadline = Clock::now() + timeout;
+    while(true)
+    {
+        if(cancelled_ && *cancelled_)
+        {
+            throw std::runtime_error("Error: UDP tracker request cancelled");
+        }
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now());
+        if(left.count() <= 0) return false;
+
+        pollfd fd{};
+        fd.fd = sock_;
+        fd.events = POLLIN;
+        int result = poll(&fd, 1, std::min(left, POLL_SLICE).count());
+        if(result == -1 && errno != EINTR)
+        {
+            throw std::runtime_error(std::string("Error: poll failed: ") + strerror(errno));
+        }
+        if(result <= 0) continue;
+
+        datagram.resize(MAX_DATAGRAM_LENGTH);
+        ssize_t received = recv(sock_, datagram.data(), datagram.size(), 0);
+        if(received == -1)
+        {
+            // ICMP "порт недоступен" приходит как ошибка recv; это та же потеря ответа, ждем повтора
+            if(errno == ECONNREFUSED || errno == EINTR || errno == EAGAIN) continue;
+            throw std::runtime_error(std::string("Error: cannot receive from UDP tracker: ") + strerror(errno));
+        }
+        datagram.resize(received);
+        return true;
+    }
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "torrent_file.h"
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <sys/socket.h>
+
+/*
+ * Клиент UDP трекера (адреса вида udp://host:port/announce).
+ * Вместо HTTP запроса с bencode ответом -- два коротких бинарных обмена датаграммами: connect (получить
+ * connection id, который действителен минуту) и announce (получить компактный список пиров).
+ * UDP не гарантирует доставку, поэтому запрос, на который не пришел ответ, повторяется с удваивающимся таймаутом:
+ * `baseTimeout * 2^n` на n-й попытке, всего не больше `maxRetries` повторов
+ * http://www.bittorrent.org/beps/bep_0015.html
+ */
+class UdpTracker {
+public:
+    /*
+     * url -- адрес трекера, udp://host:port с необязательным путем.
+     * baseTimeout, maxRetries -- сколько ждать ответа на первую попытку и сколько раз повторять запрос
+     */
+    explicit UdpTracker(const std::string& url, std::chrono::milliseconds baseTimeout = DEFAULT_BASE_TIMEOUT,
+                        size_t maxRetries = DEFAULT_MAX_RETRIES);
+    ~UdpTracker();
+
+    UdpTracker(const UdpTracker&) = delete;
+    UdpTracker& operator=(const UdpTracker&) = delete;
+
+    /*
+     * Анонсировать торрент и получить пиров в компактном формате (по 6 байт на пира, как поле peers HTTP трекера;
+     * если сокет IPv6 -- по 18 байт, как peers6).
+     * uploaded, downloaded, left -- статистика скачивания для трекера.
+     * cancelled -- флаг отмены, который выставляют из другого потока: тогда `Announce` бросит исключение
+     * не позже чем через `POLL_SLICE`. Флаг должен жить до возврата из `Announce`.
+     * Бросает исключение, если трекер вернул ошибку или так и не ответил
+     */
+    std::string Announce(const TorrentFile& tf, const std::string& peerId, int port,
+                         uint64_t uploaded, uint64_t downloaded, uint64_t left,
+                         const std::atomic_bool* cancelled = nullptr);
+
+    /*
+     * Через сколько трекер просил повторить анонс в последнем ответе
+     */
+    std::chrono::seconds Interval() const;
+
+    /*
+     * Семейство адресов сокета (AF_INET или AF_INET6): от него зависит формат пиров в ответе.
+     * До первого `Announce` -- AF_UNSPEC
+     */
+    int Family() const;
+
+    /*
+     * Разобрать адрес udp://host:port[/path] на хост и порт. Бросает исключение, если адрес не такой
+     */
+    static std::pair<std::string, std::string> ParseUrl(const std::string& url);
+
+    static bool IsUdpUrl(const std::string& url);
+
+    static constexpr std::chrono::milliseconds DEFAULT_BASE_TIMEOUT{15000};  // 15 с по BEP 15
+    static constexpr size_t DEFAULT_MAX_RETRIES = 3;  // BEP 15 допускает 8, но это больше часа ожидания
+    static constexpr std::chrono::milliseconds POLL_SLICE{200};
+private:
+    using Clock = std::chrono::steady_clock;
+
+    const std::string url_;
+    const std::chrono::milliseconds baseTimeout_;
+    const size_t maxRetries_;
+    int sock_;
+    int family_;
+    uint64_t connectionId_;
+    Clock::time_point connectedAt_;  // когда получен `connectionId_`
+    std::chrono::seconds interval_;
+    const std::atomic_bool* cancelled_;  // флаг отмены текущего `Announce`, если есть
+
+    /*
+     * Создать сокет и привязать его к адресу трекера, если это еще не сделано
+     */
+    void Open();
+
+    /*
+     * Получить connection id, если текущий устарел
+     */
+    void Connect();
+
+    /*
+     * Отправить `request` и дождаться ответа с тем же transaction id и действием `action`, повторяя запрос по таймауту.
+     * Возвращает ответ целиком
+     */
+    std::string Exchange(const std::string& request, uint32_t action, uint32_t transactionId);
+
+    /*
+     * Дождаться датаграммы не дольше `timeout`. Возвращает false по таймауту
+     */
+    bool Receive(std::string& datagram, std::chrono::milliseconds timeout);
+};
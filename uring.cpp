@@ -0,0 +1,183 @@
+#include "uring.h"
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <algorithm>
+
+namespace {
+static_assert(sizeof(std::atomic<unsigned>) == sizeof(unsigned) && std::atomic<unsigned>::is_always_lock_free);
+
+template<typename T>
+T* RingField(void* ring, uint32_t offset)
+{
+    return reinterpret_cast<T*>(static_cast<char*>(ring) + offset);
+}
+
+[[noreturn]] void ThrowErrno(const std::string& what)
+{
+    throw std::runtime_error("Error: " + what + ": " + strerror(errno));
+}
+}
+
+IoUring::IoUring(unsigned entries)
+: ring_(-1)
+, sqRing_(MAP_FAILED)
+, cqRing_(MAP_FAILED)
+, sqes_(static_cast<io_uring_sqe*>(MAP_FAILED))
+, pending_(0)
+{
+    io_uring_params params{};
+    ring_ = syscall(__NR_io_uring_setup, entries, &params);
+    if(ring_ == -1)
+    {
+        ThrowErrno("io_uring_setup failed");
+    }
+    entries_ = params.sq_entries;
+
+    sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if(singleMmap)
+    {
+        sqRingSize_ = cqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+    }
+
+    sqRing_ = mmap(nullptr, sqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_, IORING_OFF_SQ_RING);
+    cqRing_ = singleMmap ? sqRing_
+            : mmap(nullptr, cqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_, IORING_OFF_CQ_RING);
+    sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = static_cast<io_uring_sqe*>(mmap(nullptr, sqesSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                            ring_, IORING_OFF_SQES));
+    if(sqRing_ == MAP_FAILED || cqRing_ == MAP_FAILED || sqes_ == MAP_FAILED)
+    {
+        int error = errno;
+        Unmap();
+        errno = error;
+        ThrowErrno("cannot map io_uring rings");
+    }
+
+    sqHead_ = RingField<std::atomic<unsigned>>(sqRing_, params.sq_off.head);
+    sqTail_ = RingField<std::atomic<unsigned>>(sqRing_, params.sq_off.tail);
+    sqMask_ = RingField<const unsigned>(sqRing_, params.sq_off.ring_mask);
+    sqArray_ = RingField<unsigned>(sqRing_, params.sq_off.array);
+    cqHead_ = RingField<std::atomic<unsigned>>(cqRing_, params.cq_off.head);
+    cqTail_ = RingField<std::atomic<unsigned>>(cqRing_, params.cq_off.tail);
+    cqMask_ = RingField<const unsigned>(cqRing_, params.cq_off.ring_mask);
+    cqes_ = RingField<const io_uring_cqe>(cqRing_, params.cq_off.cqes);
+}
+
+IoUring::~IoUring()
+{
+    Unmap();
+}
+
+void IoUring::Unmap()
+{
+    if(sqes_ != MAP_FAILED) munmap(sqes_, sqesSize_);
+    if(cqRing_ != MAP_FAILED && cqRing_ != sqRing_) munmap(cqRing_, cqRingSize_);
+    if(sqRing_ != MAP_FAILED) munmap(sqRing_, sqRingSize_);
+    if(ring_ != -1) close(ring_);
+    sqes_ = static_cast<io_uring_sqe*>(MAP_FAILED);
+    cqRing_ = sqRing_ = MAP_FAILED;
+    ring_ = -1;
+}
+
+bool IoUring::RegisterBuffers(const std::vector<BufferPool::Region>& regions)
+{
+    if(regions.empty()) return false;
+
+    std::vector<iovec> iov;
+    for(const auto& region : regions)
+    {
+        iov.push_back({region.data, region.size});
+    }
+    if(syscall(__NR_io_uring_register, ring_, IORING_REGISTER_BUFFERS, iov.data(), iov.size()) == -1)
+    {
+        return false;
+    }
+    fixed_ = regions;
+    return true;
+}
+
+int IoUring::FixedBufferIndex(const char* data, size_t size) const
+{
+    for(size_t i = 0; i < fixed_.size(); ++i)
+    {
+        if(fixed_[i].data <= data && data + size <= fixed_[i].data + fixed_[i].size) return i;
+    }
+    return -1;
+}
+
+unsigned IoUring::SpaceLeft() const
+{
+    return entries_ - (sqTail_->load(std::memory_order_relaxed) - sqHead_->load(std::memory_order_acquire));
+}
+
+io_uring_sqe* IoUring::NextSqe()
+{
+    if(SpaceLeft() == 0)
+    {
+        throw std::runtime_error("Error: io_uring submission queue is full");
+    }
+
+    unsigned tail = sqTail_->load(std::memory_order_relaxed);
+    unsigned index = tail & *sqMask_;
+    io_uring_sqe* sqe = &sqes_[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqArray_[index] = index;
+    sqTail_->store(tail + 1, std::memory_order_release);
+    ++pending_;
+    return sqe;
+}
+
+void IoUring::PrepareWrite(int fd, const iovec* iov, unsigned iovCount, uint64_t offset, uint64_t userData)
+{
+    io_uring_sqe* sqe = NextSqe();
+    sqe->fd = fd;
+    sqe->off = offset;
+    sqe->user_data = userData;
+
+    if(iovCount == 1)
+    {
+        int fixed = FixedBufferIndex(static_cast<const char*>(iov->iov_base), iov->iov_len);
+        sqe->opcode = fixed == -1 ? IORING_OP_WRITE : IORING_OP_WRITE_FIXED;
+        sqe->addr = reinterpret_cast<uint64_t>(iov->iov_base);
+        sqe->len = iov->iov_len;
+        sqe->buf_index = fixed == -1 ? 0 : fixed;
+    }
+    else
+    {
+        sqe->opcode = IORING_OP_WRITEV;
+        sqe->addr = reinterpret_cast<uint64_t>(iov);
+        sqe->len = iovCount;
+    }
+}
+
+void IoUring::PrepareDataSync(int fd, uint64_t userData)
+{
+    io_uring_sqe* sqe = NextSqe();
+    sqe->opcode = IORING_OP_FSYNC;
+    sqe->fd = fd;
+    sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+    sqe->flags = IOSQE_IO_DRAIN;
+    sqe->user_data = userData;
+}
+
+void IoUring::Submit(unsigned waitFor)
+{
+    do
+    {
+        long submitted = syscall(__NR_io_uring_enter, ring_, pending_, waitFor, waitFor ? IORING_ENTER_GETEVENTS : 0,
+                                 nullptr, 0);
+        if(submitted == -1)
+        {
+            if(errno == EINTR) continue;
+            ThrowErrno("io_uring_enter failed");
+        }
+        pending_ -= std::min<unsigned>(submitted, pending_);
+    } while(pending_ > 0);
+}
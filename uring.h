@@ -0,0 +1,108 @@
+#pragma once
+
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <vector>
+#include "buffer_pool.h"
+
+/*
+ * Минимальная обертка над io_uring без liburing: кольца отправки и завершения отображаются в память процесса,
+ * запросы складываются в кольцо отправки пачкой и отправляются одним системным вызовом `io_uring_enter`,
+ * а результаты читаются прямо из кольца завершения, без системного вызова на каждую операцию.
+ * Регионы пула буферов можно зарегистрировать в ядре, тогда запись из них (`IORING_OP_WRITE_FIXED`)
+ * обходится без отображения страниц на каждую операцию.
+ * Объект не потокобезопасен: у каждого потока должно быть свое кольцо.
+ * Полезная информация:
+ * - https://man7.org/linux/man-pages/man7/io_uring.7.html
+ * - https://kernel.dk/io_uring.pdf
+ */
+class IoUring {
+public:
+    /*
+     * entries -- размер кольца отправки. Бросает исключение, если ядро не поддерживает io_uring
+     */
+    explicit IoUring(unsigned entries);
+    ~IoUring();
+
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    /*
+     * Зарегистрировать регионы пула как фиксированные буферы. Возвращает false, если ядро отказало
+     * (например, из-за лимита на заблокированную память), тогда запись идет без фиксированных буферов
+     */
+    bool RegisterBuffers(const std::vector<BufferPool::Region>& regions);
+
+    /*
+     * Номер зарегистрированного буфера, целиком содержащего [data, data + size), или -1
+     */
+    int FixedBufferIndex(const char* data, size_t size) const;
+
+    /*
+     * Сколько еще запросов можно положить в кольцо отправки
+     */
+    unsigned SpaceLeft() const;
+
+    /*
+     * Положить в кольцо запросы. `userData` возвращается вместе с результатом операции.
+     * Если `iov` содержит один участок, запись идет операцией WRITE (или WRITE_FIXED из зарегистрированного буфера),
+     * иначе -- WRITEV. Массив `iov` должен жить до завершения операции
+     */
+    void PrepareWrite(int fd, const iovec* iov, unsigned iovCount, uint64_t offset, uint64_t userData);
+
+    /*
+     * `fdatasync`, который выполнится после всех ранее положенных в кольцо запросов
+     */
+    void PrepareDataSync(int fd, uint64_t userData);
+
+    /*
+     * Отправить все подготовленные запросы и дождаться, пока завершится хотя бы `waitFor` операций
+     */
+    void Submit(unsigned waitFor);
+
+    /*
+     * Забрать готовые результаты: для каждого вызывается handler(userData, res), где res -- результат операции
+     * в стиле системного вызова (число байт или -errno). Возвращает число обработанных результатов
+     */
+    template<typename Handler>
+    unsigned Reap(Handler&& handler)
+    {
+        unsigned head = cqHead_->load(std::memory_order_relaxed);
+        unsigned tail = cqTail_->load(std::memory_order_acquire);
+        unsigned count = 0;
+        for(; head != tail; ++head, ++count)
+        {
+            const io_uring_cqe& cqe = cqes_[head & *cqMask_];
+            handler(cqe.user_data, cqe.res);
+        }
+        cqHead_->store(head, std::memory_order_release);
+        return count;
+    }
+private:
+    int ring_;
+    unsigned entries_;
+    void* sqRing_;
+    size_t sqRingSize_;
+    void* cqRing_;
+    size_t cqRingSize_;
+    io_uring_sqe* sqes_;
+    size_t sqesSize_;
+
+    std::atomic<unsigned>* sqHead_;
+    std::atomic<unsigned>* sqTail_;
+    const unsigned* sqMask_;
+    unsigned* sqArray_;
+    std::atomic<unsigned>* cqHead_;
+    std::atomic<unsigned>* cqTail_;
+    const unsigned* cqMask_;
+    const io_uring_cqe* cqes_;
+
+    unsigned pending_;  // сколько запросов подготовлено, но еще не отправлено в ядро
+    std::vector<BufferPool::Region> fixed_;
+
+    io_uring_sqe* NextSqe();
+    void Unmap();
+};